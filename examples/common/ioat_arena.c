@@ -0,0 +1,66 @@
+// DMA buffer arena on hugepages, see ioat_arena.h.
+
+#include "ioat_arena.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "rte_errno.h"
+#include "rte_lcore.h"
+#include "rte_malloc.h"
+
+// Classes whose buffers are larger than bytes_per_class still hold this many,
+// so that a copy between two of them can be done
+#define IOAT_ARENA_MIN_BUFS 2
+
+static void prefault_buf(struct rte_mempool *mp, void *opaque, void *obj,
+                         unsigned int obj_idx) {
+    RTE_SET_USED(opaque);
+    RTE_SET_USED(obj_idx);
+    memset(obj, 0, mp->elt_size);
+}
+
+struct ioat_arena *ioat_arena_create(const char *name, int socket_id,
+                                     size_t bytes_per_class) {
+    char pool_name[RTE_MEMPOOL_NAMESIZE];
+    struct ioat_arena *arena;
+    unsigned int cls;
+
+    arena = rte_zmalloc_socket(name, sizeof(*arena), 0, socket_id);
+    if (arena == NULL) return NULL;
+
+    for (cls = 0; cls < IOAT_ARENA_NB_CLASSES; cls++) {
+        const size_t size = 1UL << (IOAT_ARENA_MIN_SHIFT + cls);
+        const unsigned int nb_bufs =
+            RTE_MAX(bytes_per_class / size, (size_t)IOAT_ARENA_MIN_BUFS);
+        // Keep most of the buffers of a class shareable between lcores
+        const unsigned int cache_size =
+            RTE_MIN(nb_bufs / (2 * rte_lcore_count()),
+                    (unsigned int)RTE_MEMPOOL_CACHE_MAX_SIZE);
+
+        snprintf(pool_name, sizeof(pool_name), "%s_%u", name, cls);
+        arena->pools[cls] =
+            rte_mempool_create(pool_name, nb_bufs, size, cache_size, 0, NULL,
+                               NULL, NULL, NULL, socket_id, 0);
+        if (arena->pools[cls] == NULL) {
+            printf("Cannot create arena pool %s: %s\n", pool_name,
+                   rte_strerror(rte_errno));
+            ioat_arena_destroy(arena);
+            return NULL;
+        }
+
+        // Take the page faults now rather than on the first copies
+        rte_mempool_obj_iter(arena->pools[cls], prefault_buf, NULL);
+    }
+
+    return arena;
+}
+
+void ioat_arena_destroy(struct ioat_arena *arena) {
+    unsigned int cls;
+
+    if (arena == NULL) return;
+    for (cls = 0; cls < IOAT_ARENA_NB_CLASSES; cls++)
+        rte_mempool_free(arena->pools[cls]);
+    rte_free(arena);
+}
@@ -0,0 +1,58 @@
+// DMA buffer arena on hugepages.
+//
+// Buffers are handed out from one mempool per power-of-two size class, from
+// 64 B to 1 MB, all in hugepage memory of one NUMA node. The EAL maps its
+// whole heap for DMA at startup (with VFIO, at the IOVA the mempool knows),
+// so unlike user memory, see ioat_regcache.h, arena buffers need no
+// registration; and every buffer is touched when the arena is created, so no
+// page fault is left for the data path either.
+//
+// Allocation and free are O(1): the size class is the log2 of the size, a
+// buffer finds its pool back from the mempool object header, and each lcore
+// goes through the per-lcore cache of the pool first.
+
+#ifndef IOAT_ARENA_H
+#define IOAT_ARENA_H
+
+#include <stddef.h>
+
+#include "rte_branch_prediction.h"
+#include "rte_common.h"
+#include "rte_mempool.h"
+
+#define IOAT_ARENA_MIN_SHIFT 6
+#define IOAT_ARENA_MAX_SHIFT 20
+#define IOAT_ARENA_NB_CLASSES (IOAT_ARENA_MAX_SHIFT - IOAT_ARENA_MIN_SHIFT + 1)
+
+struct ioat_arena {
+    struct rte_mempool *pools[IOAT_ARENA_NB_CLASSES];
+};
+
+// Reserves bytes_per_class bytes of buffers for each size class, or two
+// buffers for the classes whose buffers are larger than that
+struct ioat_arena *ioat_arena_create(const char *name, int socket_id,
+                                     size_t bytes_per_class);
+// All the buffers must have been freed
+void ioat_arena_destroy(struct ioat_arena *arena);
+
+// Returns a buffer of at least size bytes and its IOVA, or NULL if size is
+// above 1 MB or its class is exhausted
+static inline void *ioat_arena_alloc(struct ioat_arena *arena, size_t size,
+                                     rte_iova_t *iova) {
+    unsigned int cls = 0;
+    void *buf;
+
+    if (unlikely(size > (1UL << IOAT_ARENA_MAX_SHIFT))) return NULL;
+    if (size > (1UL << IOAT_ARENA_MIN_SHIFT))
+        cls = rte_log2_u64(size) - IOAT_ARENA_MIN_SHIFT;
+
+    if (rte_mempool_get(arena->pools[cls], &buf) != 0) return NULL;
+    if (iova != NULL) *iova = rte_mempool_virt2iova(buf);
+    return buf;
+}
+
+static inline void ioat_arena_free(void *buf) {
+    rte_mempool_put(rte_mempool_from_obj(buf), buf);
+}
+
+#endif  // IOAT_ARENA_H
@@ -0,0 +1,214 @@
+// CPU copy kernels, see ioat_copy.h.
+
+#include "ioat_copy.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "rte_common.h"
+#include "rte_cpuflags.h"
+#include "rte_memcpy.h"
+
+// Below this the AVX-512 kernel does not pay for its 64-byte tail
+#define WIDE_MIN 512
+// Below this streaming stores do not pay for the partial lines around them
+#define STREAM_MIN_FLOOR 256
+
+static void copy_rte(void *dst, const void *src, size_t n) {
+    rte_memcpy(dst, src, n);
+}
+
+struct ioat_copy_dispatch ioat_copy_dispatch = {
+    .wide_min = SIZE_MAX,
+    .stream_min = SIZE_MAX,
+    .narrow = copy_rte,
+    .wide = copy_rte,
+    .stream = copy_rte,
+};
+
+static const char *const kernel_names[IOAT_COPY_NB_KERNELS] = {
+    "rte", "avx2", "avx512", "nt"};
+
+// Head and tail of the kernels, with two overlapping loads and stores
+static inline void copy_lt32(uint8_t *d, const uint8_t *s, size_t n) {
+    if (n >= 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)s);
+        const __m128i b = _mm_loadu_si128((const __m128i *)(s + n - 16));
+
+        _mm_storeu_si128((__m128i *)d, a);
+        _mm_storeu_si128((__m128i *)(d + n - 16), b);
+    } else if (n >= 8) {
+        uint64_t a, b;
+
+        memcpy(&a, s, 8);
+        memcpy(&b, s + n - 8, 8);
+        memcpy(d, &a, 8);
+        memcpy(d + n - 8, &b, 8);
+    } else if (n >= 4) {
+        uint32_t a, b;
+
+        memcpy(&a, s, 4);
+        memcpy(&b, s + n - 4, 4);
+        memcpy(d, &a, 4);
+        memcpy(d + n - 4, &b, 4);
+    } else if (n > 0) {
+        const uint8_t a = s[0], b = s[n / 2], c = s[n - 1];
+
+        d[0] = a;
+        d[n / 2] = b;
+        d[n - 1] = c;
+    }
+}
+
+__attribute__((target("avx2"))) static void copy_avx2(void *dst,
+                                                      const void *src,
+                                                      size_t n) {
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    if (n < 32) {
+        copy_lt32(d, s, n);
+        return;
+    }
+
+    // The last 32 bytes, which the loops leave out, may overlap them
+    const __m256i last = _mm256_loadu_si256((const __m256i *)(s + n - 32));
+    uint8_t *const d_last = d + n - 32;
+
+    for (; n > 128; n -= 128, s += 128, d += 128) {
+        const __m256i a = _mm256_loadu_si256((const __m256i *)s);
+        const __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+        const __m256i c = _mm256_loadu_si256((const __m256i *)(s + 64));
+        const __m256i e = _mm256_loadu_si256((const __m256i *)(s + 96));
+
+        _mm256_storeu_si256((__m256i *)d, a);
+        _mm256_storeu_si256((__m256i *)(d + 32), b);
+        _mm256_storeu_si256((__m256i *)(d + 64), c);
+        _mm256_storeu_si256((__m256i *)(d + 96), e);
+    }
+    for (; n > 32; n -= 32, s += 32, d += 32)
+        _mm256_storeu_si256((__m256i *)d,
+                            _mm256_loadu_si256((const __m256i *)s));
+    _mm256_storeu_si256((__m256i *)d_last, last);
+}
+
+__attribute__((target("avx512f"))) static void copy_avx512(void *dst,
+                                                           const void *src,
+                                                           size_t n) {
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    if (n < 64) {
+        copy_avx2(d, s, n);
+        return;
+    }
+
+    const __m512i last = _mm512_loadu_si512((const void *)(s + n - 64));
+    uint8_t *const d_last = d + n - 64;
+
+    for (; n > 256; n -= 256, s += 256, d += 256) {
+        const __m512i a = _mm512_loadu_si512((const void *)s);
+        const __m512i b = _mm512_loadu_si512((const void *)(s + 64));
+        const __m512i c = _mm512_loadu_si512((const void *)(s + 128));
+        const __m512i e = _mm512_loadu_si512((const void *)(s + 192));
+
+        _mm512_storeu_si512((void *)d, a);
+        _mm512_storeu_si512((void *)(d + 64), b);
+        _mm512_storeu_si512((void *)(d + 128), c);
+        _mm512_storeu_si512((void *)(d + 192), e);
+    }
+    for (; n > 64; n -= 64, s += 64, d += 64)
+        _mm512_storeu_si512((void *)d, _mm512_loadu_si512((const void *)s));
+    _mm512_storeu_si512((void *)d_last, last);
+}
+
+// Streaming stores need an aligned destination: the head up to the first
+// 32-byte boundary and the tail are written with regular stores
+__attribute__((target("avx2"))) static void copy_stream(void *dst,
+                                                        const void *src,
+                                                        size_t n) {
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+    const size_t head = -(uintptr_t)d & 31;
+
+    if (n < STREAM_MIN_FLOOR) {
+        copy_avx2(d, s, n);
+        return;
+    }
+
+    copy_lt32(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    for (; n >= 128; n -= 128, s += 128, d += 128) {
+        const __m256i a = _mm256_loadu_si256((const __m256i *)s);
+        const __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+        const __m256i c = _mm256_loadu_si256((const __m256i *)(s + 64));
+        const __m256i e = _mm256_loadu_si256((const __m256i *)(s + 96));
+
+        _mm256_stream_si256((__m256i *)d, a);
+        _mm256_stream_si256((__m256i *)(d + 32), b);
+        _mm256_stream_si256((__m256i *)(d + 64), c);
+        _mm256_stream_si256((__m256i *)(d + 96), e);
+    }
+    for (; n >= 32; n -= 32, s += 32, d += 32)
+        _mm256_stream_si256((__m256i *)d,
+                            _mm256_loadu_si256((const __m256i *)s));
+    copy_lt32(d, s, n);
+}
+
+static void copy_nt(void *dst, const void *src, size_t n) {
+    copy_stream(dst, src, n);
+    _mm_sfence();
+}
+
+const char *ioat_copy_kernel_name(enum ioat_copy_kernel kernel) {
+    return kernel < IOAT_COPY_NB_KERNELS ? kernel_names[kernel] : "unknown";
+}
+
+enum ioat_copy_kernel ioat_copy_kernel_parse(const char *name) {
+    unsigned int k;
+
+    for (k = 0; k < IOAT_COPY_NB_KERNELS; k++)
+        if (strcmp(name, kernel_names[k]) == 0) break;
+    return k;
+}
+
+bool ioat_copy_kernel_supported(enum ioat_copy_kernel kernel) {
+    switch (kernel) {
+        case IOAT_COPY_RTE:
+            return true;
+        case IOAT_COPY_AVX2:
+        case IOAT_COPY_NT:
+            return rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) > 0;
+        case IOAT_COPY_AVX512:
+            return rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX512F) > 0;
+        default:
+            return false;
+    }
+}
+
+ioat_copy_fn ioat_copy_kernel_fn(enum ioat_copy_kernel kernel) {
+    static const ioat_copy_fn fns[IOAT_COPY_NB_KERNELS] = {
+        copy_rte, copy_avx2, copy_avx512, copy_nt};
+
+    return ioat_copy_kernel_supported(kernel) ? fns[kernel] : NULL;
+}
+
+void ioat_copy_init(size_t stream_min) {
+    struct ioat_copy_dispatch *d = &ioat_copy_dispatch;
+    const bool avx2 = ioat_copy_kernel_supported(IOAT_COPY_AVX2);
+
+    d->narrow = avx2 ? copy_avx2 : copy_rte;
+    d->wide = d->narrow;
+    d->wide_min = SIZE_MAX;
+    if (ioat_copy_kernel_supported(IOAT_COPY_AVX512)) {
+        d->wide = copy_avx512;
+        d->wide_min = WIDE_MIN;
+    }
+
+    d->stream = copy_stream;
+    d->stream_min = avx2 && stream_min > 0 ? stream_min : SIZE_MAX;
+    if (d->wide_min > d->stream_min) d->wide_min = d->stream_min;
+}
@@ -0,0 +1,69 @@
+// CPU copy kernels, picked at runtime by CPU feature and copy size.
+//
+// Besides rte_memcpy, copies are done with 32-byte AVX2 or 64-byte AVX-512
+// loads and stores, or with non-temporal AVX2 stores which write the
+// destination to memory around the caches: large copies the CPU does not read
+// back, eg packets handed over to a NIC, then leave the LLC to the data that
+// is. Streaming stores are weakly ordered, so they must be fenced before the
+// copy is handed over to another lcore or a device.
+//
+// The kernels are built for their instruction set whatever the compiler
+// flags, and only used if the CPU has it.
+
+#ifndef IOAT_COPY_H
+#define IOAT_COPY_H
+
+#include <immintrin.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+enum ioat_copy_kernel {
+    IOAT_COPY_RTE,     // rte_memcpy
+    IOAT_COPY_AVX2,    // 32-byte loads and stores
+    IOAT_COPY_AVX512,  // 64-byte loads and stores
+    IOAT_COPY_NT,      // AVX2 loads and streaming stores, then a fence
+    IOAT_COPY_NB_KERNELS
+};
+
+typedef void (*ioat_copy_fn)(void *dst, const void *src, size_t n);
+
+// Kernels of ioat_copy() by size: narrow below wide_min bytes, wide below
+// stream_min, and streaming, without the fence, from there
+struct ioat_copy_dispatch {
+    size_t wide_min;
+    size_t stream_min;
+    ioat_copy_fn narrow;
+    ioat_copy_fn wide;
+    ioat_copy_fn stream;
+};
+
+extern struct ioat_copy_dispatch ioat_copy_dispatch;
+
+const char *ioat_copy_kernel_name(enum ioat_copy_kernel kernel);
+// Returns IOAT_COPY_NB_KERNELS if the name is unknown
+enum ioat_copy_kernel ioat_copy_kernel_parse(const char *name);
+bool ioat_copy_kernel_supported(enum ioat_copy_kernel kernel);
+// The kernel alone, NULL if the CPU does not support it
+ioat_copy_fn ioat_copy_kernel_fn(enum ioat_copy_kernel kernel);
+
+// Pick the kernels of ioat_copy() for this CPU. Copies of stream_min bytes
+// and more use streaming stores if the CPU has AVX2, 0 to never use them.
+// Until then ioat_copy() is rte_memcpy.
+void ioat_copy_init(size_t stream_min);
+
+static inline void ioat_copy(void *dst, const void *src, size_t n) {
+    const struct ioat_copy_dispatch *d = &ioat_copy_dispatch;
+
+    if (n < d->wide_min)
+        d->narrow(dst, src, n);
+    else if (n < d->stream_min)
+        d->wide(dst, src, n);
+    else
+        d->stream(dst, src, n);
+}
+
+// Order the streaming stores of the previous ioat_copy() calls before the
+// stores that follow, eg the one publishing the copies
+static inline void ioat_copy_fence(void) { _mm_sfence(); }
+
+#endif  // IOAT_COPY_H
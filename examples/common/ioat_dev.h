@@ -0,0 +1,86 @@
+// Data path of an IOAT channel, either a CBDMA rawdev or a software one.
+//
+// Applications call ioat_dev_* instead of rte_ioat_* so that the same binary
+// runs on hosts with and without CBDMA, eg
+//   sudo ./build/hello_ioat --vdev=rawdev_ioat_sw0 --iova-mode=va
+// The arguments and return values are those of rte_ioat_*.
+
+#ifndef IOAT_DEV_H
+#define IOAT_DEV_H
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "ioat_sw.h"
+#include "rte_ioat_rawdev.h"
+
+// Whether a rawdev, given its driver name, can be driven through ioat_dev_*
+static inline bool ioat_dev_driver_supported(const char *driver_name) {
+    return driver_name != NULL &&
+           (strcmp(driver_name, IOAT_PMD_RAWDEV_NAME_STR) == 0 ||
+            strcmp(driver_name, IOAT_SW_PMD_RAWDEV_NAME_STR) == 0);
+}
+
+static inline int ioat_dev_enqueue_copy(int dev_id, phys_addr_t src,
+                                        phys_addr_t dst, unsigned int length,
+                                        uintptr_t src_hdl, uintptr_t dst_hdl) {
+    struct ioat_sw_rawdev *sw = ioat_sw_devs[dev_id];
+
+    if (unlikely(sw != NULL))
+        return ioat_sw_enqueue_copy(sw, src, dst, length, src_hdl, dst_hdl);
+    return rte_ioat_enqueue_copy(dev_id, src, dst, length, src_hdl, dst_hdl);
+}
+
+static inline int ioat_dev_enqueue_fill(int dev_id, uint64_t pattern,
+                                        phys_addr_t dst, unsigned int length,
+                                        uintptr_t dst_hdl) {
+    struct ioat_sw_rawdev *sw = ioat_sw_devs[dev_id];
+
+    if (unlikely(sw != NULL))
+        return ioat_sw_enqueue_fill(sw, pattern, dst, length, dst_hdl);
+    return rte_ioat_enqueue_fill(dev_id, pattern, dst, length, dst_hdl);
+}
+
+static inline int ioat_dev_fence(int dev_id) {
+    struct ioat_sw_rawdev *sw = ioat_sw_devs[dev_id];
+
+    if (unlikely(sw != NULL)) return ioat_sw_fence(sw);
+    return rte_ioat_fence(dev_id);
+}
+
+// Descriptors that can still be enqueued, like rte_ioat_burst_capacity of
+// later releases. 20.11 lacks it, but its inline data path keeps the ring
+// indexes in the rawdev private data. Read from another lcore than the one
+// polling completions, the result may be short, never over.
+static inline uint16_t ioat_dev_burst_capacity(int dev_id) {
+    const struct ioat_sw_rawdev *sw = ioat_sw_devs[dev_id];
+    const struct rte_ioat_rawdev *ioat;
+
+    if (unlikely(sw != NULL))
+        return (unsigned short)(sw->ring_size - 1 + sw->next_read -
+                                sw->next_write);
+    ioat = rte_rawdevs[dev_id].dev_private;
+    return (unsigned short)(ioat->ring_size - 1 + ioat->next_read -
+                            ioat->next_write);
+}
+
+static inline void ioat_dev_perform_ops(int dev_id) {
+    struct ioat_sw_rawdev *sw = ioat_sw_devs[dev_id];
+
+    if (unlikely(sw != NULL))
+        ioat_sw_perform_ops(sw);
+    else
+        rte_ioat_perform_ops(dev_id);
+}
+
+static inline int ioat_dev_completed_ops(int dev_id, uint8_t max_copies,
+                                         uintptr_t *src_hdls,
+                                         uintptr_t *dst_hdls) {
+    struct ioat_sw_rawdev *sw = ioat_sw_devs[dev_id];
+
+    if (unlikely(sw != NULL))
+        return ioat_sw_completed_ops(sw, max_copies, src_hdls, dst_hdls);
+    return rte_ioat_completed_ops(dev_id, max_copies, src_hdls, dst_hdls);
+}
+
+#endif  // IOAT_DEV_H
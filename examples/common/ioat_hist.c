@@ -0,0 +1,39 @@
+// Log-linear histograms of latencies, see ioat_hist.h.
+
+#include "ioat_hist.h"
+
+// Highest value of a bucket
+static uint64_t bucket_top(unsigned int b) {
+    unsigned int shift;
+
+    if (b < IOAT_HIST_SUB_COUNT) return b;
+    shift = (b >> IOAT_HIST_SUB_BITS) - 1;
+    return (((uint64_t)(IOAT_HIST_SUB_COUNT | (b & (IOAT_HIST_SUB_COUNT - 1)))
+             + 1) << shift) - 1;
+}
+
+void ioat_hist_merge(struct ioat_hist *dst, const struct ioat_hist *src) {
+    uint64_t max;
+    unsigned int b;
+
+    // Count first: the buckets may then be ahead of it, never behind, so
+    // that every rank below the count falls in a bucket
+    dst->count += __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    for (b = 0; b < IOAT_HIST_NB_BUCKETS; b++)
+        dst->buckets[b] += __atomic_load_n(&src->buckets[b], __ATOMIC_RELAXED);
+    max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+    if (max > dst->max) dst->max = max;
+}
+
+uint64_t ioat_hist_percentile(const struct ioat_hist *h, double p) {
+    const uint64_t rank = (uint64_t)(p * h->count);
+    uint64_t seen = 0;
+    unsigned int b;
+
+    if (h->count == 0) return 0;
+    for (b = 0; b < IOAT_HIST_NB_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > rank) return RTE_MIN(bucket_top(b), h->max);
+    }
+    return h->max;
+}
@@ -0,0 +1,59 @@
+// Log-linear histograms of latencies.
+//
+// Each power-of-two range of values is cut into IOAT_HIST_SUB_COUNT linear
+// buckets, so that any percentile is known within 1/IOAT_HIST_SUB_COUNT of
+// its value, in a few KB, and recording a value costs a bit scan and two
+// increments. Values from 2^32 up, eg TSC cycles above a second, all go to
+// the last bucket; the max is exact.
+//
+// A histogram has a single writer, which stores its counters atomically so
+// that readers on other lcores can merge it at any time without tearing.
+
+#ifndef IOAT_HIST_H
+#define IOAT_HIST_H
+
+#include <stdint.h>
+
+#include "rte_common.h"
+
+#define IOAT_HIST_SUB_BITS 5
+#define IOAT_HIST_SUB_COUNT (1U << IOAT_HIST_SUB_BITS)
+#define IOAT_HIST_NB_BUCKETS \
+    ((32 - IOAT_HIST_SUB_BITS + 1) * IOAT_HIST_SUB_COUNT)
+
+struct ioat_hist {
+    uint64_t count;
+    uint64_t max;
+    uint64_t buckets[IOAT_HIST_NB_BUCKETS];
+};
+
+// Values below IOAT_HIST_SUB_COUNT have a bucket each, then bucket
+// (e + 1) * IOAT_HIST_SUB_COUNT + s holds [(SUB_COUNT + s) << e,
+// (SUB_COUNT + s + 1) << e)
+static inline unsigned int ioat_hist_bucket(uint64_t v) {
+    unsigned int shift;
+
+    if (v < IOAT_HIST_SUB_COUNT) return v;
+    if (v > UINT32_MAX) v = UINT32_MAX;
+    shift = (31 - __builtin_clz((uint32_t)v)) - IOAT_HIST_SUB_BITS;
+    return ((shift + 1) << IOAT_HIST_SUB_BITS) |
+           ((v >> shift) & (IOAT_HIST_SUB_COUNT - 1));
+}
+
+static inline void ioat_hist_record(struct ioat_hist *h, uint64_t v) {
+    uint64_t *bucket = &h->buckets[ioat_hist_bucket(v)];
+
+    __atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+    if (v > h->max) __atomic_store_n(&h->max, v, __ATOMIC_RELAXED);
+}
+
+// Add src, which may be being written to, into dst
+void ioat_hist_merge(struct ioat_hist *dst, const struct ioat_hist *src);
+
+// Smallest value at or above a fraction p of the recorded ones, rounded up
+// to the top of its bucket but never above the max; 0 if the histogram is
+// empty
+uint64_t ioat_hist_percentile(const struct ioat_hist *h, double p);
+
+#endif  // IOAT_HIST_H
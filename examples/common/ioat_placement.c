@@ -0,0 +1,115 @@
+// Placement map of the IOAT channels of a host, see ioat_placement.h.
+
+#include "ioat_placement.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ioat_dev.h"
+#include "rte_rawdev.h"
+#include "rte_version.h"
+
+int ioat_placement_save(const char *file, const struct ioat_placement *map) {
+    FILE *f = fopen(file, "w");
+    unsigned int i;
+
+    if (f == NULL) return -errno;
+    fprintf(f, "{\n  \"version\": 1,\n  \"dpdk\": \"%s\",\n  \"channels\": [\n",
+            rte_version());
+    for (i = 0; i < map->nb_channels; i++) {
+        const struct ioat_placement_channel *c = &map->channels[i];
+
+        fprintf(f,
+                "    {\"name\": \"%s\", \"bus\": \"%s\", \"numa\": %d, "
+                "\"iommu_group\": %d, \"ring_min\": %u, \"ring_max\": %u, "
+                "\"fill\": %s, \"selftest\": %s, \"copy_gbps\": %.3f, "
+                "\"lat_ns\": %.0f}%s\n",
+                c->name, c->bus, c->numa_node, c->iommu_group, c->ring_min,
+                c->ring_max, c->fill ? "true" : "false",
+                c->selftest ? "true" : "false", c->copy_gbps, c->lat_ns,
+                i + 1 < map->nb_channels ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) == 0 ? 0 : -errno;
+}
+
+int ioat_placement_load(const char *file, struct ioat_placement *map) {
+    struct ioat_placement_channel *c;
+    char line[512], fill[8], selftest[8];
+    FILE *f = fopen(file, "r");
+
+    if (f == NULL) return -errno;
+    map->nb_channels = 0;
+    while (fgets(line, sizeof(line), f) != NULL &&
+           map->nb_channels < IOAT_PLACEMENT_MAX_CHANNELS) {
+        c = &map->channels[map->nb_channels];
+        if (sscanf(line,
+                   " {\"name\": \"%63[^\"]\", \"bus\": \"%7[a-z]\", \"numa\": "
+                   "%d, \"iommu_group\": %d, \"ring_min\": %u, \"ring_max\": "
+                   "%u, \"fill\": %7[a-z], \"selftest\": %7[a-z], "
+                   "\"copy_gbps\": %lf, \"lat_ns\": %lf}",
+                   c->name, c->bus, &c->numa_node, &c->iommu_group,
+                   &c->ring_min, &c->ring_max, fill, selftest, &c->copy_gbps,
+                   &c->lat_ns) != 10)
+            continue;
+        c->fill = strcmp(fill, "true") == 0;
+        c->selftest = strcmp(selftest, "true") == 0;
+        map->nb_channels++;
+    }
+    fclose(f);
+    return map->nb_channels;
+}
+
+// Rawdev id of the IOAT channel of a device, -1 if this process has none
+static int find_rawdev(const char *name) {
+    int dev_id;
+
+    for (dev_id = 0; dev_id < rte_rawdev_count(); dev_id++) {
+        struct rte_rawdev_info info = {.dev_private = NULL};
+
+        if (rte_rawdev_info_get(dev_id, &info, 0) == 0 &&
+            ioat_dev_driver_supported(info.driver_name) &&
+            info.device != NULL && strcmp(info.device->name, name) == 0)
+            return dev_id;
+    }
+    return -1;
+}
+
+// Whether channel a goes before channel b for socket_id
+static bool placed_before(const struct ioat_placement_channel *a,
+                          const struct ioat_placement_channel *b,
+                          int socket_id) {
+    const bool a_local = a->numa_node == socket_id;
+    const bool b_local = b->numa_node == socket_id;
+
+    if (a_local != b_local) return a_local;
+    return a->copy_gbps > b->copy_gbps;
+}
+
+unsigned int ioat_placement_order(const struct ioat_placement *map,
+                                  int socket_id, uint16_t *dev_ids,
+                                  unsigned int max) {
+    const struct ioat_placement_channel *order[IOAT_PLACEMENT_MAX_CHANNELS];
+    int ids[IOAT_PLACEMENT_MAX_CHANNELS];
+    unsigned int i, j, n = 0;
+    int dev_id;
+
+    // Insertion sort, maps have a few dozen channels at most
+    for (i = 0; i < map->nb_channels; i++) {
+        const struct ioat_placement_channel *c = &map->channels[i];
+
+        if (!c->selftest || (dev_id = find_rawdev(c->name)) < 0) continue;
+        for (j = n; j > 0 && placed_before(c, order[j - 1], socket_id); j--) {
+            order[j] = order[j - 1];
+            ids[j] = ids[j - 1];
+        }
+        order[j] = c;
+        ids[j] = dev_id;
+        n++;
+    }
+
+    n = n < max ? n : max;
+    for (i = 0; i < n; i++) dev_ids[i] = ids[i];
+    return n;
+}
@@ -0,0 +1,51 @@
+// Placement map of the IOAT channels of a host, as written by ioat_devices.
+//
+// The map is a JSON file with one channel per line, so that it is read back
+// line by line without a JSON parser:
+//   {"name": "0000:00:04.0", "bus": "pci", "numa": 0, "iommu_group": 12,
+//    "ring_min": 64, "ring_max": 4096, "fill": true, "selftest": true,
+//    "copy_gbps": 2.734, "lat_ns": 910}
+// on a single line. Channels are known by device name, the PCI address of
+// CBDMA channels, which stays the same across processes and reboots while
+// rawdev ids depend on the EAL options.
+
+#ifndef IOAT_PLACEMENT_H
+#define IOAT_PLACEMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IOAT_PLACEMENT_MAX_CHANNELS 64
+#define IOAT_PLACEMENT_NAME_LEN 64
+
+struct ioat_placement_channel {
+    char name[IOAT_PLACEMENT_NAME_LEN];
+    char bus[8];      // pci, or vdev for software channels
+    int numa_node;    // -1 if unknown
+    int iommu_group;  // -1 if none
+    unsigned int ring_min, ring_max;
+    bool fill;        // fills complete and write the pattern
+    bool selftest;    // passed the rawdev self test
+    double copy_gbps;  // 64K copies in batches of 32, 0 if not probed
+    double lat_ns;     // median of single 64-byte copies, 0 if not probed
+};
+
+struct ioat_placement {
+    unsigned int nb_channels;
+    struct ioat_placement_channel channels[IOAT_PLACEMENT_MAX_CHANNELS];
+};
+
+// Returns 0, or a negative errno
+int ioat_placement_save(const char *file, const struct ioat_placement *map);
+// Returns the number of channels read, or a negative errno
+int ioat_placement_load(const char *file, struct ioat_placement *map);
+
+// Rawdev ids, in this process, of up to max channels of the map which passed
+// their self test: those of socket_id first, then the others, each by
+// decreasing copy bandwidth. Channels of the map this process did not probe
+// are left out. Returns the number of ids.
+unsigned int ioat_placement_order(const struct ioat_placement *map,
+                                  int socket_id, uint16_t *dev_ids,
+                                  unsigned int max);
+
+#endif  // IOAT_PLACEMENT_H
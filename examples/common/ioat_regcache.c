@@ -0,0 +1,340 @@
+// Registration cache of user memory for IOAT DMA, see ioat_regcache.h.
+
+#include "ioat_regcache.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rte_common.h"
+#include "rte_errno.h"
+#include "rte_memory.h"
+
+struct regcache_region {
+    uintptr_t start, end;  // page aligned, [start, end)
+    unsigned int refcnt;
+};
+
+struct ioat_regcache {
+    struct rte_device *dev;
+    size_t page_size;
+    size_t max_idle_bytes;
+    // Held across the VFIO calls, which pin or unpin whole buffers and can
+    // take milliseconds: waiters sleep rather than spin
+    pthread_mutex_t lock;
+
+    // Sorted by address, never overlapping
+    struct regcache_region *regions;
+    unsigned int nb_regions, max_regions;
+
+    struct ioat_regcache_stats stats;
+};
+
+#define REGION_LEN(r) ((size_t)((r)->end - (r)->start))
+
+// Index of the first region ending after addr, or nb_regions
+static unsigned int region_lookup(const struct ioat_regcache *rc,
+                                  uintptr_t addr) {
+    unsigned int lo = 0, hi = rc->nb_regions;
+
+    while (lo < hi) {
+        const unsigned int mid = (lo + hi) / 2;
+
+        if (rc->regions[mid].end <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static int region_insert(struct ioat_regcache *rc, uintptr_t start,
+                         uintptr_t end) {
+    unsigned int idx;
+
+    if (rc->nb_regions == rc->max_regions) {
+        const unsigned int max = RTE_MAX(rc->max_regions * 2, 16U);
+        struct regcache_region *regions =
+            realloc(rc->regions, sizeof(*regions) * max);
+
+        if (regions == NULL) return -ENOMEM;
+        rc->regions = regions;
+        rc->max_regions = max;
+    }
+
+    idx = region_lookup(rc, start);
+    memmove(&rc->regions[idx + 1], &rc->regions[idx],
+            sizeof(*rc->regions) * (rc->nb_regions - idx));
+    rc->regions[idx] = (struct regcache_region){start, end, 0};
+    rc->nb_regions++;
+    return 0;
+}
+
+// Unmap an idle region from the IOMMU and DPDK, and drop it
+static int region_release(struct ioat_regcache *rc, unsigned int idx) {
+    struct regcache_region *r = &rc->regions[idx];
+    const size_t len = REGION_LEN(r);
+
+    if (rte_dev_dma_unmap(rc->dev, (void *)r->start, r->start, len) < 0 ||
+        rte_extmem_unregister((void *)r->start, len) < 0)
+        return -rte_errno;
+
+    rc->stats.unmaps++;
+    rc->stats.mapped_bytes -= len;
+    rc->stats.idle_bytes -= len;
+    rc->nb_regions--;
+    memmove(r, r + 1, sizeof(*r) * (rc->nb_regions - idx));
+    return 0;
+}
+
+// Release the idle regions, except those overlapping [keep_start, keep_end)
+static int flush_locked(struct ioat_regcache *rc, uintptr_t keep_start,
+                        uintptr_t keep_end) {
+    unsigned int i = rc->nb_regions;
+    int ret = 0;
+
+    while (i-- > 0 && ret == 0) {
+        const struct regcache_region *r = &rc->regions[i];
+
+        if (r->refcnt == 0 && (r->end <= keep_start || r->start >= keep_end))
+            ret = region_release(rc, i);
+    }
+    return ret;
+}
+
+// Register [start, end) to DPDK then to the IOMMU, as a new idle region
+static int region_map(struct ioat_regcache *rc, uintptr_t start,
+                      uintptr_t end) {
+    const size_t len = end - start;
+    int ret;
+
+    // DPDK needs to know the memory before mapping it for a device
+    ret = rte_extmem_register((void *)start, len, NULL, len / rc->page_size,
+                              rc->page_size);
+    if (ret < 0) return -rte_errno;
+
+    // IOVA as VA: the device sees the buffer at its virtual address
+    if (rte_dev_dma_map(rc->dev, (void *)start, start, len) < 0) {
+        ret = -rte_errno;
+        rte_extmem_unregister((void *)start, len);
+        return ret;
+    }
+
+    ret = region_insert(rc, start, end);
+    if (ret < 0) {
+        rte_dev_dma_unmap(rc->dev, (void *)start, start, len);
+        rte_extmem_unregister((void *)start, len);
+        return ret;
+    }
+
+    rc->stats.maps++;
+    rc->stats.mapped_bytes += len;
+    rc->stats.idle_bytes += len;
+    return 0;
+}
+
+// Make sure [start, end) is covered by regions
+static int range_fill(struct ioat_regcache *rc, uintptr_t start,
+                      uintptr_t end) {
+    uintptr_t span_start = start, span_end = end, cur;
+    bool flushed = false;
+    unsigned int i;
+    int ret;
+
+    // Idle regions overlapping or touching the range are merged into the
+    // new mapping, which saves both IOMMU entries and memseg lists.
+    i = region_lookup(rc, start > 0 ? start - 1 : 0);
+    while (i < rc->nb_regions && rc->regions[i].start <= end) {
+        const struct regcache_region *r = &rc->regions[i];
+
+        if (r->refcnt > 0) {
+            i++;
+            continue;
+        }
+        span_start = RTE_MIN(span_start, r->start);
+        span_end = RTE_MAX(span_end, r->end);
+        ret = region_release(rc, i);
+        if (ret < 0) return ret;
+    }
+
+    // Regions in use cannot be remapped, only the holes between them are
+    for (cur = span_start; cur < span_end;) {
+        const struct regcache_region *r;
+        uintptr_t next = span_end;
+
+        i = region_lookup(rc, cur);
+        r = i < rc->nb_regions ? &rc->regions[i] : NULL;
+        if (r != NULL && r->start <= cur) {
+            cur = r->end;
+            continue;
+        }
+        if (r != NULL && r->start < span_end) next = r->start;
+        ret = region_map(rc, cur, next);
+        // Each registration takes one of the few memseg lists, make room by
+        // unmapping the idle regions, but not the pieces mapped just before
+        if (ret == -ENOSPC && !flushed) {
+            flushed = true;
+            ret = flush_locked(rc, span_start, span_end);
+            if (ret < 0) return ret;
+            continue;
+        }
+        if (ret < 0) return ret;
+        cur = next;
+    }
+
+    return 0;
+}
+
+// 1 if [addr, addr + len) is memory of DPDK, which the EAL already mapped for
+// all devices, 0 if it is user memory the cache has to map, or -EINVAL if it
+// runs from one into the other
+static int dpdk_range(const void *addr, size_t len) {
+    const struct rte_memseg_list *first = rte_mem_virt2memseg_list(addr);
+    const struct rte_memseg_list *last =
+        rte_mem_virt2memseg_list(RTE_PTR_ADD(addr, len - 1));
+    const bool first_dpdk = first != NULL && !first->external;
+    const bool last_dpdk = last != NULL && !last->external;
+
+    if (first_dpdk && last == first) return 1;
+    if (!first_dpdk && !last_dpdk) return 0;
+    return -EINVAL;
+}
+
+static void page_align(const struct ioat_regcache *rc, const void *addr,
+                       size_t len, uintptr_t *start, uintptr_t *end) {
+    *start = RTE_ALIGN_FLOOR((uintptr_t)addr, rc->page_size);
+    *end = RTE_ALIGN_CEIL((uintptr_t)addr + len, rc->page_size);
+}
+
+struct ioat_regcache *ioat_regcache_create(struct rte_device *dev,
+                                           size_t max_idle_bytes) {
+    struct ioat_regcache *rc = calloc(1, sizeof(*rc));
+
+    if (rc == NULL) return NULL;
+    rc->dev = dev;
+    rc->page_size = getpagesize();
+    rc->max_idle_bytes = max_idle_bytes;
+    pthread_mutex_init(&rc->lock, NULL);
+    return rc;
+}
+
+void ioat_regcache_destroy(struct ioat_regcache *rc) {
+    unsigned int i;
+
+    if (rc == NULL) return;
+    for (i = 0; i < rc->nb_regions; i++) {
+        if (rc->regions[i].refcnt > 0) {
+            rc->regions[i].refcnt = 0;
+            rc->stats.idle_bytes += REGION_LEN(&rc->regions[i]);
+        }
+    }
+    flush_locked(rc, 0, 0);
+    pthread_mutex_destroy(&rc->lock);
+    free(rc->regions);
+    free(rc);
+}
+
+int ioat_regcache_map(struct ioat_regcache *rc, const void *addr, size_t len) {
+    uintptr_t start, end;
+    unsigned int i;
+    int ret = 0;
+
+    if (len == 0) return -EINVAL;
+
+    // Hugepages and the like are already mapped for all devices
+    ret = dpdk_range(addr, len);
+    if (ret != 0) return ret < 0 ? ret : 0;
+
+    page_align(rc, addr, len, &start, &end);
+    pthread_mutex_lock(&rc->lock);
+
+    i = region_lookup(rc, start);
+    if (i < rc->nb_regions && rc->regions[i].start <= start &&
+        rc->regions[i].end >= end) {
+        rc->stats.hits++;
+    } else {
+        rc->stats.misses++;
+        ret = range_fill(rc, start, end);
+    }
+
+    // Take a reference on every region the range spans
+    if (ret == 0) {
+        for (i = region_lookup(rc, start);
+             i < rc->nb_regions && rc->regions[i].start < end; i++)
+            if (rc->regions[i].refcnt++ == 0)
+                rc->stats.idle_bytes -= REGION_LEN(&rc->regions[i]);
+    }
+
+    pthread_mutex_unlock(&rc->lock);
+    return ret;
+}
+
+int ioat_regcache_unmap(struct ioat_regcache *rc, const void *addr,
+                        size_t len) {
+    uintptr_t start, end;
+    unsigned int i;
+    int ret = 0;
+
+    if (len == 0) return -EINVAL;
+
+    // Same ranges as ioat_regcache_map, which only mapped user memory
+    ret = dpdk_range(addr, len);
+    if (ret != 0) return ret < 0 ? ret : 0;
+
+    page_align(rc, addr, len, &start, &end);
+    pthread_mutex_lock(&rc->lock);
+
+    // Memory that was never mapped by the cache has no region
+    for (i = region_lookup(rc, start);
+         i < rc->nb_regions && rc->regions[i].start < end; i++)
+        if (rc->regions[i].refcnt > 0 && --rc->regions[i].refcnt == 0)
+            rc->stats.idle_bytes += REGION_LEN(&rc->regions[i]);
+
+    // Deferred unmaps are done all at once
+    if (rc->stats.idle_bytes > rc->max_idle_bytes) ret = flush_locked(rc, 0, 0);
+
+    pthread_mutex_unlock(&rc->lock);
+    return ret;
+}
+
+int ioat_regcache_flush(struct ioat_regcache *rc) {
+    int ret;
+
+    pthread_mutex_lock(&rc->lock);
+    ret = flush_locked(rc, 0, 0);
+    pthread_mutex_unlock(&rc->lock);
+    return ret;
+}
+
+int ioat_regcache_invalidate(struct ioat_regcache *rc, const void *addr,
+                             size_t len) {
+    uintptr_t start, end;
+    unsigned int i;
+    int ret = 0;
+
+    page_align(rc, addr, len, &start, &end);
+    pthread_mutex_lock(&rc->lock);
+
+    i = region_lookup(rc, start);
+    while (i < rc->nb_regions && rc->regions[i].start < end && ret == 0) {
+        if (rc->regions[i].refcnt > 0) {
+            ret = -EBUSY;
+            break;
+        }
+        ret = region_release(rc, i);
+    }
+
+    pthread_mutex_unlock(&rc->lock);
+    return ret;
+}
+
+void ioat_regcache_stats_get(struct ioat_regcache *rc,
+                             struct ioat_regcache_stats *stats) {
+    pthread_mutex_lock(&rc->lock);
+    *stats = rc->stats;
+    stats->nb_regions = rc->nb_regions;
+    pthread_mutex_unlock(&rc->lock);
+}
@@ -0,0 +1,62 @@
+// Registration cache of user memory for IOAT DMA.
+//
+// Making a buffer that does not come from DPDK DMA-able costs an
+// rte_extmem_register plus an rte_dev_dma_map, ie a VFIO ioctl which pins the
+// pages and programs the IOMMU. The cache keeps the page-aligned regions it
+// mapped in an interval table sorted by virtual address, so that:
+//  - a range covered by a mapped region is only a refcount increment,
+//  - a range overlapping or touching regions maps the missing pieces only,
+//    and idle neighbours are merged into one larger mapping,
+//  - a region whose refcount drops to zero stays mapped, and idle regions are
+//    unmapped in a batch once they add up to more than max_idle_bytes.
+// Memory already owned by DPDK, eg hugepages, is mapped by the EAL and is
+// left alone.
+//
+// As the pages of a mapping stay pinned, memory must not be returned to the
+// OS, eg by free() of a large malloc() block, while an idle mapping still
+// covers it: call ioat_regcache_invalidate() or ioat_regcache_flush() first.
+//
+// \ref https://www.kernel.org/doc/html/latest/driver-api/vfio.html
+
+#ifndef IOAT_REGCACHE_H
+#define IOAT_REGCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rte_dev.h"
+
+struct ioat_regcache;
+
+struct ioat_regcache_stats {
+    uint64_t hits;    // map calls served by existing regions
+    uint64_t misses;  // map calls which mapped new pieces
+    uint64_t maps, unmaps;  // rte_dev_dma_map and rte_dev_dma_unmap calls
+    unsigned int nb_regions;
+    size_t mapped_bytes;
+    size_t idle_bytes;  // mapped with a zero refcount, ie pending unmap
+};
+
+// The device only selects the VFIO container, which is shared by all the
+// devices of the default container, so one cache serves all the channels.
+struct ioat_regcache *ioat_regcache_create(struct rte_device *dev,
+                                           size_t max_idle_bytes);
+// Unmaps all the regions, whatever their refcount
+void ioat_regcache_destroy(struct ioat_regcache *rc);
+
+// Returns 0, or a negative errno, -EINVAL for a range that runs from DPDK
+// memory into user memory or back. Thread-safe, as all the functions below.
+int ioat_regcache_map(struct ioat_regcache *rc, const void *addr, size_t len);
+int ioat_regcache_unmap(struct ioat_regcache *rc, const void *addr,
+                        size_t len);
+
+// Unmap all the idle regions
+int ioat_regcache_flush(struct ioat_regcache *rc);
+// Unmap the idle regions overlapping a range, -EBUSY if one is still in use
+int ioat_regcache_invalidate(struct ioat_regcache *rc, const void *addr,
+                             size_t len);
+
+void ioat_regcache_stats_get(struct ioat_regcache *rc,
+                             struct ioat_regcache_stats *stats);
+
+#endif  // IOAT_REGCACHE_H
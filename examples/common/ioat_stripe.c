@@ -0,0 +1,165 @@
+// Striped copies across several IOAT channels, see ioat_stripe.h.
+
+#include "ioat_stripe.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "ioat_dev.h"
+#include "rte_malloc.h"
+#include "rte_rawdev.h"
+
+#define COMPLETION_BURST 64
+
+int ioat_stripe_init(struct ioat_stripe *st, const uint16_t *dev_ids,
+                     uint16_t nb_channels, uint32_t chunk_size,
+                     uint32_t max_jobs) {
+    uint32_t i;
+
+    memset(st, 0, sizeof(*st));
+    if (nb_channels == 0 || nb_channels > IOAT_STRIPE_MAX_CHANNELS ||
+        chunk_size == 0 || max_jobs == 0)
+        return -EINVAL;
+
+    for (i = 0; i < nb_channels; i++) {
+        struct rte_ioat_rawdev_config dev_conf = {.ring_size = 0};
+        struct rte_rawdev_info dev_info = {.dev_private = &dev_conf};
+
+        if (rte_rawdev_info_get(dev_ids[i], &dev_info, sizeof(dev_conf)) != 0 ||
+            !ioat_dev_driver_supported(dev_info.driver_name))
+            return -ENODEV;
+        // Chunks are matched to their copy by the handle
+        if (dev_conf.ring_size == 0 || dev_conf.hdls_disable) return -EINVAL;
+
+        st->dev_ids[i] = dev_ids[i];
+        st->capacity[i] = dev_conf.ring_size - 1;
+    }
+    st->nb_channels = nb_channels;
+    st->chunk_size = chunk_size;
+    st->max_jobs = max_jobs;
+
+    st->jobs = rte_zmalloc(NULL, sizeof(*st->jobs) * max_jobs, 0);
+    st->free_jobs = rte_malloc(NULL, sizeof(*st->free_jobs) * max_jobs, 0);
+    st->ready = rte_malloc(NULL, sizeof(*st->ready) * max_jobs, 0);
+    if (st->jobs == NULL || st->free_jobs == NULL || st->ready == NULL) {
+        ioat_stripe_free(st);
+        return -ENOMEM;
+    }
+    for (i = 0; i < max_jobs; i++) st->free_jobs[i] = max_jobs - 1 - i;
+    st->nb_free = max_jobs;
+
+    return 0;
+}
+
+void ioat_stripe_free(struct ioat_stripe *st) {
+    rte_free(st->jobs);
+    rte_free(st->free_jobs);
+    rte_free(st->ready);
+    st->jobs = NULL, st->free_jobs = NULL, st->ready = NULL;
+}
+
+int ioat_stripe_copy(struct ioat_stripe *st, rte_iova_t src, rte_iova_t dst,
+                     size_t length, uintptr_t cookie) {
+    const uint32_t nb_chunks = (length + st->chunk_size - 1) / st->chunk_size;
+    const uint16_t n = st->nb_channels;
+    struct ioat_stripe_job *job;
+    uint32_t i, slot;
+
+    if (length == 0) return -EINVAL;
+
+    // The first nb_chunks % n channels from next_channel take one extra chunk.
+    // A share larger than a whole ring would never fit, however long the
+    // caller waits.
+    for (i = 0; i < n; i++) {
+        const uint16_t ch = (st->next_channel + i) % n;
+        const uint32_t need = nb_chunks / n + (i < nb_chunks % n);
+
+        if (need > st->capacity[ch]) return -EINVAL;
+        if (st->inflight[ch] + need > st->capacity[ch]) return 0;
+    }
+    if (st->nb_free == 0) return 0;
+
+    slot = st->free_jobs[--st->nb_free];
+    job = &st->jobs[slot];
+    job->cookie = cookie;
+    job->remaining = nb_chunks;
+    job->orphan = false;
+
+    for (i = 0; i < nb_chunks; i++) {
+        const uint16_t ch = (st->next_channel + i) % n;
+        const size_t off = (size_t)i * st->chunk_size;
+        const size_t len = RTE_MIN((size_t)st->chunk_size, length - off);
+
+        // Cannot fail unless the channel is also used outside the stripe.
+        // Enqueued chunks cannot be taken back: the job is left to reap them
+        // and is then freed without being reported.
+        if (ioat_dev_enqueue_copy(st->dev_ids[ch], src + off, dst + off, len,
+                                  slot, 0) != 1) {
+            st->next_channel = (st->next_channel + i) % n;
+            job->remaining = i;
+            job->orphan = true;
+            if (i == 0) st->free_jobs[st->nb_free++] = slot;
+            return -ENOSPC;
+        }
+        st->inflight[ch]++;
+        st->chunks[ch]++;
+        st->dirty |= 1U << ch;
+    }
+    st->next_channel = (st->next_channel + nb_chunks) % n;
+
+    return 1;
+}
+
+void ioat_stripe_perform_ops(struct ioat_stripe *st) {
+    while (st->dirty != 0) {
+        const uint16_t ch = rte_bsf32(st->dirty);
+
+        ioat_dev_perform_ops(st->dev_ids[ch]);
+        st->dirty &= ~(1U << ch);
+    }
+}
+
+int ioat_stripe_completed(struct ioat_stripe *st, uintptr_t *cookies,
+                          unsigned int max_copies) {
+    uintptr_t src_hdls[COMPLETION_BURST], dst_hdls[COMPLETION_BURST];
+    unsigned int nb_done = 0;
+    uint32_t tail;
+    uint16_t ch;
+    int i, ret;
+
+    for (ch = 0; ch < st->nb_channels; ch++) {
+        if (st->inflight[ch] == 0) continue;
+        do {
+            ret = ioat_dev_completed_ops(st->dev_ids[ch], COMPLETION_BURST,
+                                         src_hdls, dst_hdls);
+            if (ret < 0) return -1;
+
+            st->inflight[ch] -= ret;
+            for (i = 0; i < ret; i++) {
+                struct ioat_stripe_job *job = &st->jobs[src_hdls[i]];
+
+                if (--job->remaining != 0) continue;
+                if (job->orphan) {
+                    st->free_jobs[st->nb_free++] = src_hdls[i];
+                    continue;
+                }
+                tail = st->ready_head + st->nb_ready++;
+                if (tail >= st->max_jobs) tail -= st->max_jobs;
+                st->ready[tail] = src_hdls[i];
+            }
+        } while (ret == COMPLETION_BURST);
+    }
+
+    // The slot is freed only now, so that completed but unreported copies
+    // count against max_jobs like the ones in flight
+    while (nb_done < max_copies && st->nb_ready != 0) {
+        const uint32_t slot = st->ready[st->ready_head];
+
+        cookies[nb_done++] = st->jobs[slot].cookie;
+        st->free_jobs[st->nb_free++] = slot;
+        if (++st->ready_head == st->max_jobs) st->ready_head = 0;
+        st->nb_ready--;
+    }
+
+    return nb_done;
+}
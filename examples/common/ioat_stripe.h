@@ -0,0 +1,72 @@
+// Striped copies across several IOAT channels.
+//
+// One copy is cut into chunks of chunk_size bytes which are spread round
+// robin over the channels, so a large copy is served by all the engines at
+// once. The copy is reported complete, by its cookie, only when all of its
+// chunks are. The channels must be configured with handles enabled, started,
+// and used only through the stripe, whose accounting of the ring space is
+// what guarantees that either all the chunks of a copy are enqueued or none.
+
+#ifndef IOAT_STRIPE_H
+#define IOAT_STRIPE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rte_common.h"
+#include "rte_memory.h"
+
+#define IOAT_STRIPE_MAX_CHANNELS 16
+
+struct ioat_stripe_job {
+    uintptr_t cookie;
+    uint32_t remaining;  // chunks not completed yet
+    bool orphan;         // enqueue failed half way, never reported
+};
+
+struct ioat_stripe {
+    uint16_t nb_channels;
+    uint16_t dev_ids[IOAT_STRIPE_MAX_CHANNELS];
+    unsigned short capacity[IOAT_STRIPE_MAX_CHANNELS];  // ring_size - 1
+    unsigned short inflight[IOAT_STRIPE_MAX_CHANNELS];
+    uint64_t chunks[IOAT_STRIPE_MAX_CHANNELS];  // chunks ever enqueued
+    uint32_t dirty;         // channels with chunks not kicked yet
+    uint16_t next_channel;  // channel of the first chunk of the next copy
+    uint32_t chunk_size;
+
+    uint32_t max_jobs;
+    struct ioat_stripe_job *jobs;
+    uint32_t *free_jobs;  // stack of free slots of jobs
+    uint32_t nb_free;
+    // Slots of completed copies not reported yet. A slot is freed only once
+    // its cookie is reported, so ready never holds more than max_jobs.
+    uint32_t *ready;
+    uint32_t ready_head, nb_ready;
+};
+
+// Returns 0, or a negative errno if a channel is not usable for striping
+int ioat_stripe_init(struct ioat_stripe *st, const uint16_t *dev_ids,
+                     uint16_t nb_channels, uint32_t chunk_size,
+                     uint32_t max_jobs);
+void ioat_stripe_free(struct ioat_stripe *st);
+
+// Enqueue all the chunks of one copy. Returns 1 if enqueued, 0 if the rings
+// or the job table are full, in which case nothing is enqueued. Returns
+// -EINVAL, enqueuing nothing, if length is 0 or a channel's share of the
+// chunks exceeds its whole ring, as no amount of waiting makes room. Returns
+// -ENOSPC if a ring refused a chunk despite the accounting, which only
+// happens when the channel is also used outside the stripe: the chunks
+// already enqueued still run, but the copy is never reported.
+int ioat_stripe_copy(struct ioat_stripe *st, rte_iova_t src, rte_iova_t dst,
+                     size_t length, uintptr_t cookie);
+
+// Kick the doorbell of every channel with chunks enqueued since last time
+void ioat_stripe_perform_ops(struct ioat_stripe *st);
+
+// Reap the chunks of all the channels and return up to max_copies cookies of
+// fully completed copies, or -1 with rte_errno set on a channel error.
+int ioat_stripe_completed(struct ioat_stripe *st, uintptr_t *cookies,
+                          unsigned int max_copies);
+
+#endif  // IOAT_STRIPE_H
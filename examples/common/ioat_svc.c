@@ -0,0 +1,54 @@
+// Client side of the copy service, see ioat_svc.h.
+
+#include "ioat_svc.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rte_memzone.h"
+
+int ioat_svc_attach(struct ioat_svc_conn *conn, const char *name,
+                    unsigned int weight) {
+    const struct rte_memzone *mz = rte_memzone_lookup(IOAT_SVC_MZ_NAME);
+    struct ioat_svc_shared *shared;
+    struct ioat_svc_client *c;
+    unsigned int i;
+
+    if (mz == NULL) return -ENOENT;
+    shared = mz->addr;
+    conn->pool = rte_mempool_lookup(IOAT_SVC_POOL_NAME);
+    if (conn->pool == NULL || !__atomic_load_n(&shared->running,
+                                               __ATOMIC_ACQUIRE))
+        return -ENOENT;
+
+    // A slot is claimed first, so that the service only sees it once set up
+    for (i = 0; i < IOAT_SVC_MAX_CLIENTS; i++) {
+        uint32_t state = IOAT_SVC_FREE;
+
+        c = &shared->clients[i];
+        if (__atomic_compare_exchange_n(&c->state, &state, IOAT_SVC_CLAIMED,
+                                        false, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+            break;
+    }
+    if (i == IOAT_SVC_MAX_CLIENTS) return -EBUSY;
+
+    c->pid = getpid();
+    c->weight = RTE_MIN(RTE_MAX(weight, 1U), (unsigned int)IOAT_SVC_MAX_WEIGHT);
+    snprintf(c->name, sizeof(c->name), "%s", name);
+    memset(&c->stats, 0, sizeof(c->stats));
+    __atomic_store_n(&c->state, IOAT_SVC_ATTACHED, __ATOMIC_RELEASE);
+
+    conn->shared = shared;
+    conn->client = c;
+    conn->idx = i;
+    return 0;
+}
+
+void ioat_svc_detach(struct ioat_svc_conn *conn) {
+    __atomic_store_n(&conn->client->state, IOAT_SVC_DETACHING,
+                     __ATOMIC_RELEASE);
+    conn->client = NULL;
+}
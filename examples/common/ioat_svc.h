@@ -0,0 +1,127 @@
+// Copy service shared by the DPDK processes of a host.
+//
+// The primary process, ioat_service, owns the IOAT channels. Secondary
+// processes attach to it as clients, each with a submission and a completion
+// ring, and send it copy jobs: the service takes the jobs of all its clients
+// round robin, by client weight, batches them onto its channels and returns
+// them, completed, on the completion ring of their client. Jobs come from a
+// mempool shared by all the processes, the buffers they copy from hugepage
+// memory (rte_malloc, memzones), whose IOVAs the channels of the primary can
+// reach.
+//
+// A client owns the jobs it takes from the mempool until it frees them, and
+// keeps at most IOAT_SVC_RING_SIZE - 1 of them in flight, so that its
+// completion ring never overflows.
+
+#ifndef IOAT_SVC_H
+#define IOAT_SVC_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "rte_common.h"
+#include "rte_memory.h"
+#include "rte_mempool.h"
+#include "rte_ring.h"
+
+#define IOAT_SVC_MZ_NAME "ioat_svc"
+#define IOAT_SVC_POOL_NAME "ioat_svc_jobs"
+#define IOAT_SVC_MAX_CLIENTS 16
+#define IOAT_SVC_RING_SIZE 1024
+#define IOAT_SVC_NAME_LEN 32
+#define IOAT_SVC_MAX_WEIGHT 64
+
+enum ioat_svc_client_state {
+    IOAT_SVC_FREE,
+    IOAT_SVC_CLAIMED,    // being set up by a client attaching
+    IOAT_SVC_ATTACHED,   // served
+    IOAT_SVC_DETACHING,  // left, freed by the service once drained
+};
+
+struct ioat_svc_job {
+    rte_iova_t src;
+    rte_iova_t dst;
+    uint32_t len;
+    int32_t status;    // 0 once copied, -errno if the service rejected it
+    uint64_t cookie;   // for the client
+    uint16_t client;   // set by the service
+};
+
+// Counters of a client, written by the service only
+struct ioat_svc_client_stats {
+    uint64_t jobs;       // taken from the submission ring
+    uint64_t completed;  // copied and returned
+    uint64_t rejected;   // returned without being copied
+    uint64_t bytes;
+    uint64_t dropped;    // lost to a full completion ring
+    uint64_t inflight;   // on the channels
+};
+
+struct ioat_svc_client {
+    uint32_t state;
+    pid_t pid;
+    uint32_t weight;  // bursts of jobs taken per round, up to the max
+    char name[IOAT_SVC_NAME_LEN];
+    struct rte_ring *sq;  // jobs submitted, client to service
+    struct rte_ring *cq;  // jobs completed, service to client
+    struct ioat_svc_client_stats stats __rte_cache_aligned;
+} __rte_cache_aligned;
+
+// In the IOAT_SVC_MZ_NAME memzone, written by the service but for the client
+// slots being attached
+struct ioat_svc_shared {
+    uint32_t running;  // cleared when the service stops
+    uint32_t max_len;  // longest job accepted
+    uint16_t nb_channels;
+    struct ioat_svc_client clients[IOAT_SVC_MAX_CLIENTS];
+};
+
+// Process-local handle of an attached client
+struct ioat_svc_conn {
+    struct ioat_svc_shared *shared;
+    struct ioat_svc_client *client;
+    struct rte_mempool *pool;
+    unsigned int idx;
+};
+
+// Attach to the running service under name, served with weight. Returns 0,
+// -ENOENT if no service runs, or -EBUSY if all its client slots are taken.
+int ioat_svc_attach(struct ioat_svc_conn *conn, const char *name,
+                    unsigned int weight);
+// Leave the service, which frees the jobs still in the rings, those being
+// copied once they complete. Jobs held by the client must be freed first.
+void ioat_svc_detach(struct ioat_svc_conn *conn);
+
+static inline int ioat_svc_running(const struct ioat_svc_conn *conn) {
+    return __atomic_load_n(&conn->shared->running, __ATOMIC_ACQUIRE);
+}
+
+static inline int ioat_svc_job_alloc(struct ioat_svc_conn *conn,
+                                     struct ioat_svc_job **jobs,
+                                     unsigned int n) {
+    return rte_mempool_get_bulk(conn->pool, (void **)jobs, n);
+}
+
+static inline void ioat_svc_job_free(struct ioat_svc_conn *conn,
+                                     struct ioat_svc_job **jobs,
+                                     unsigned int n) {
+    rte_mempool_put_bulk(conn->pool, (void **)jobs, n);
+}
+
+// Returns the number of jobs submitted, the first ones of jobs
+static inline unsigned int ioat_svc_submit(struct ioat_svc_conn *conn,
+                                           struct ioat_svc_job **jobs,
+                                           unsigned int n) {
+    return rte_ring_sp_enqueue_burst(conn->client->sq, (void **)jobs, n,
+                                     NULL);
+}
+
+// Returns the number of completed jobs, in any order
+static inline unsigned int ioat_svc_poll(struct ioat_svc_conn *conn,
+                                         struct ioat_svc_job **jobs,
+                                         unsigned int max) {
+    return rte_ring_sc_dequeue_burst(conn->client->cq, (void **)jobs, max,
+                                     NULL);
+}
+
+#endif  // IOAT_SVC_H
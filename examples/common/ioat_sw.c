@@ -0,0 +1,397 @@
+// Software copy engine registered as the rawdev_ioat_sw vdev, see ioat_sw.h.
+//
+// \ref https://doc.dpdk.org/guides-20.11/prog_guide/rawdev.html
+// \ref https://doc.dpdk.org/guides-20.11/rawdevs/ioat.html
+
+#define _GNU_SOURCE
+#include "ioat_sw.h"
+
+#include <inttypes.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rte_bus_vdev.h"
+#include "rte_cycles.h"
+#include "rte_kvargs.h"
+#include "rte_lcore.h"
+#include "rte_malloc.h"
+#include "rte_memcpy.h"
+#include "rte_memory.h"
+#include "rte_pause.h"
+#include "rte_rawdev_pmd.h"
+
+#define IOAT_SW_MIN_RING_SIZE 64
+#define IOAT_SW_MAX_RING_SIZE 4096
+
+struct ioat_sw_rawdev *ioat_sw_devs[RTE_RAWDEV_MAX_DEVS];
+
+static const char *const xstat_names[] = {
+    "failed_enqueues", "successful_enqueues", "copies_started",
+    "copies_completed"};
+
+static const char *const valid_args[] = {IOAT_SW_ARG_LATENCY,
+                                         IOAT_SW_ARG_BANDWIDTH,
+                                         IOAT_SW_ARG_CORE, NULL};
+
+static void *iova_to_va(rte_iova_t iova) {
+    if (rte_eal_iova_mode() == RTE_IOVA_VA) return (void *)(uintptr_t)iova;
+    return rte_mem_iova2virt(iova);
+}
+
+static int execute_desc(const struct ioat_sw_desc *desc) {
+    void *dst = iova_to_va(desc->dst);
+    uint32_t i;
+
+    if (dst == NULL) return -EFAULT;
+
+    if (desc->op == IOAT_SW_OP_FILL) {
+        // The 8-byte pattern repeats over dst, as the hardware does
+        for (i = 0; i + 8 <= desc->len; i += 8)
+            memcpy((uint8_t *)dst + i, &desc->src, 8);
+        memcpy((uint8_t *)dst + i, &desc->src, desc->len - i);
+        return 0;
+    }
+
+    void *src = iova_to_va(desc->src);
+    if (src == NULL) return -EFAULT;
+    rte_memcpy(dst, src, desc->len);
+    return 0;
+}
+
+// The worker plays the hardware. The latency/bandwidth model only delays
+// when a completion becomes visible; the copies are pipelined meanwhile, so
+// the queue depth the application keeps still decides the throughput.
+static void *ioat_sw_worker(void *arg) {
+    struct ioat_sw_rawdev *sw = arg;
+    const unsigned short mask = sw->ring_size - 1;
+    unsigned short published = sw->completed;
+    uint64_t busy_until = 0;
+
+    while (sw->running) {
+        const unsigned short doorbell =
+            __atomic_load_n(&sw->doorbell, __ATOMIC_ACQUIRE);
+        uint64_t now = rte_rdtsc();
+
+        // Execute newly kicked descriptors
+        while (sw->hw_read != doorbell && sw->error == 0) {
+            const struct ioat_sw_desc *desc = &sw->desc_ring[sw->hw_read & mask];
+            int ret = execute_desc(desc);
+
+            if (ret < 0) {
+                sw->error = -ret;
+                break;
+            }
+            busy_until = RTE_MAX(busy_until, now) +
+                         (uint64_t)(desc->len * sw->cycles_per_byte);
+            sw->finish_tsc[sw->hw_read & mask] =
+                RTE_MAX(busy_until, now + sw->latency_cycles);
+            sw->hw_read++;
+        }
+
+        // Publish completions in order once they are due
+        now = rte_rdtsc();
+        while (published != sw->hw_read &&
+               sw->finish_tsc[published & mask] <= now)
+            published++;
+        if (published != sw->completed)
+            __atomic_store_n(&sw->completed, published, __ATOMIC_RELEASE);
+        else
+            rte_pause();
+    }
+
+    return NULL;
+}
+
+static int ioat_sw_dev_info_get(struct rte_rawdev *dev, rte_rawdev_obj_t dev_info,
+                                size_t dev_info_size) {
+    struct rte_ioat_rawdev_config *cfg = dev_info;
+    struct ioat_sw_rawdev *sw = dev->dev_private;
+
+    if (dev_info_size != sizeof(*cfg)) return -EINVAL;
+
+    cfg->ring_size = sw->ring_size;
+    cfg->hdls_disable = sw->hdls_disable;
+    return 0;
+}
+
+static int ioat_sw_dev_configure(const struct rte_rawdev *dev,
+                                 rte_rawdev_obj_t config, size_t config_size) {
+    const struct rte_ioat_rawdev_config *params = config;
+    struct ioat_sw_rawdev *sw = dev->dev_private;
+    unsigned short ring_size;
+
+    if (config_size != sizeof(*params)) return -EINVAL;
+
+    // Same limits as the IOAT rawdev
+    ring_size = params->ring_size;
+    if (ring_size < IOAT_SW_MIN_RING_SIZE ||
+        ring_size > IOAT_SW_MAX_RING_SIZE || !rte_is_power_of_2(ring_size))
+        return -EINVAL;
+
+    rte_free(sw->desc_ring);
+    rte_free(sw->hdls);
+    rte_free(sw->finish_tsc);
+    sw->desc_ring = rte_zmalloc_socket(NULL, sizeof(*sw->desc_ring) * ring_size,
+                                       0, dev->socket_id);
+    sw->hdls = rte_zmalloc_socket(NULL, sizeof(*sw->hdls) * ring_size, 0,
+                                  dev->socket_id);
+    sw->finish_tsc = rte_zmalloc_socket(
+        NULL, sizeof(*sw->finish_tsc) * ring_size, 0, dev->socket_id);
+    if (sw->desc_ring == NULL || sw->hdls == NULL || sw->finish_tsc == NULL) {
+        rte_free(sw->desc_ring);
+        rte_free(sw->hdls);
+        rte_free(sw->finish_tsc);
+        sw->desc_ring = NULL, sw->hdls = NULL, sw->finish_tsc = NULL;
+        sw->ring_size = 0;
+        return -ENOMEM;
+    }
+
+    sw->ring_size = ring_size;
+    sw->hdls_disable = params->hdls_disable;
+    sw->next_write = sw->next_read = sw->last_doorbell = 0;
+    sw->doorbell = sw->completed = sw->hw_read = 0;
+    sw->error = 0;
+    return 0;
+}
+
+static int ioat_sw_dev_start(struct rte_rawdev *dev) {
+    struct ioat_sw_rawdev *sw = dev->dev_private;
+    char name[16];  // the limit of pthread names
+    int ret;
+
+    if (sw->ring_size == 0 || sw->desc_ring == NULL) return -EBUSY;
+
+    snprintf(name, sizeof(name), "ioat-sw-%u", sw->dev_id);
+    sw->running = true;
+    ret = rte_ctrl_thread_create(&sw->worker, name, NULL, ioat_sw_worker, sw);
+    if (ret != 0) {
+        sw->running = false;
+        return -ret;
+    }
+
+    if (sw->core >= 0) {
+        cpu_set_t cpuset;
+
+        CPU_ZERO(&cpuset);
+        CPU_SET(sw->core, &cpuset);
+        ret = pthread_setaffinity_np(sw->worker, sizeof(cpuset), &cpuset);
+        if (ret != 0)
+            printf("Failed to pin %s to core %d: %s\n", name, sw->core,
+                   strerror(ret));
+    }
+    return 0;
+}
+
+static void ioat_sw_dev_stop(struct rte_rawdev *dev) {
+    struct ioat_sw_rawdev *sw = dev->dev_private;
+
+    if (!sw->running) return;
+    sw->running = false;
+    pthread_join(sw->worker, NULL);
+}
+
+static int ioat_sw_dev_close(struct rte_rawdev *dev) {
+    struct ioat_sw_rawdev *sw = dev->dev_private;
+
+    ioat_sw_dev_stop(dev);
+    rte_free(sw->desc_ring);
+    rte_free(sw->hdls);
+    rte_free(sw->finish_tsc);
+    sw->desc_ring = NULL, sw->hdls = NULL, sw->finish_tsc = NULL;
+    sw->ring_size = 0;
+    return 0;
+}
+
+static int ioat_sw_xstats_get(const struct rte_rawdev *dev,
+                              const unsigned int ids[], uint64_t values[],
+                              unsigned int n) {
+    const struct ioat_sw_rawdev *sw = dev->dev_private;
+    const uint64_t *stats = (const uint64_t *)&sw->xstats;
+    unsigned int i;
+
+    for (i = 0; i < n; i++)
+        values[i] = ids[i] < RTE_DIM(xstat_names) ? stats[ids[i]] : 0;
+    return n;
+}
+
+static int ioat_sw_xstats_get_names(const struct rte_rawdev *dev,
+                                    struct rte_rawdev_xstats_name *names,
+                                    unsigned int size) {
+    unsigned int i;
+
+    RTE_SET_USED(dev);
+    if (size < RTE_DIM(xstat_names)) return RTE_DIM(xstat_names);
+
+    for (i = 0; i < RTE_DIM(xstat_names); i++)
+        snprintf(names[i].name, sizeof(names[i].name), "%s", xstat_names[i]);
+    return RTE_DIM(xstat_names);
+}
+
+static int ioat_sw_xstats_reset(struct rte_rawdev *dev, const uint32_t *ids,
+                                uint32_t nb_ids) {
+    struct ioat_sw_rawdev *sw = dev->dev_private;
+    uint64_t *stats = (uint64_t *)&sw->xstats;
+    unsigned int i;
+
+    if (ids == NULL) {
+        memset(&sw->xstats, 0, sizeof(sw->xstats));
+        return 0;
+    }
+    for (i = 0; i < nb_ids; i++)
+        if (ids[i] < RTE_DIM(xstat_names)) stats[ids[i]] = 0;
+    return 0;
+}
+
+// Copy and fill a few buffers through the public API, on a channel the test
+// starts and stops itself, configuring it if the application has not. A
+// started channel, or one still holding operations of the application, is
+// left alone with -EBUSY: the test would reap completions that are not its
+// own.
+static int ioat_sw_selftest(uint16_t dev_id) {
+    struct ioat_sw_rawdev *sw = ioat_sw_devs[dev_id];
+    const unsigned int length = 1024;
+    const uint64_t pattern = 0xfedcba9876543210;
+    uint8_t *src = NULL, *dst = NULL;
+    uintptr_t hdls[2][2];
+    unsigned int i, done = 0;
+    uint64_t deadline;
+    int ret = -1;
+
+    if (sw->running || sw->next_write != sw->next_read) return -EBUSY;
+    if (sw->ring_size == 0) {
+        struct rte_ioat_rawdev_config cfg = {.ring_size = 64};
+        struct rte_rawdev_info info = {.dev_private = &cfg};
+        if (rte_rawdev_configure(dev_id, &info, sizeof(cfg)) != 0) return -1;
+    }
+    if (rte_rawdev_start(dev_id) != 0) return -1;
+
+    src = rte_malloc(NULL, length, 0);
+    dst = rte_zmalloc(NULL, length * 2, 0);
+    if (src == NULL || dst == NULL) goto end;
+    for (i = 0; i < length; i++) src[i] = rand() & 0xFF;
+
+    if (ioat_sw_enqueue_copy(sw, rte_malloc_virt2iova(src),
+                             rte_malloc_virt2iova(dst), length, 1, 2) != 1 ||
+        ioat_sw_enqueue_fill(sw, pattern, rte_malloc_virt2iova(dst + length),
+                             length - 3, 3) != 1)
+        goto end;
+    ioat_sw_perform_ops(sw);
+
+    deadline = rte_rdtsc() + rte_get_tsc_hz();
+    while (done < 2 && rte_rdtsc() < deadline) {
+        int n = ioat_sw_completed_ops(sw, 2 - done, &hdls[0][done],
+                                      &hdls[1][done]);
+        if (n < 0) goto end;
+        done += n;
+    }
+    if (done != 2 || (!sw->hdls_disable && (hdls[1][0] != 2 || hdls[1][1] != 3)))
+        goto end;
+
+    if (memcmp(src, dst, length) != 0) goto end;
+    for (i = 0; i < length - 3; i++)
+        if (dst[length + i] != ((const uint8_t *)&pattern)[i % 8]) goto end;
+    ret = 0;
+
+end:
+    rte_free(src);
+    rte_free(dst);
+    rte_rawdev_stop(dev_id);
+    return ret;
+}
+
+static const struct rte_rawdev_ops ioat_sw_rawdev_ops = {
+    .dev_info_get = ioat_sw_dev_info_get,
+    .dev_configure = ioat_sw_dev_configure,
+    .dev_start = ioat_sw_dev_start,
+    .dev_stop = ioat_sw_dev_stop,
+    .dev_close = ioat_sw_dev_close,
+    .xstats_get = ioat_sw_xstats_get,
+    .xstats_get_names = ioat_sw_xstats_get_names,
+    .xstats_reset = ioat_sw_xstats_reset,
+    .dev_selftest = ioat_sw_selftest,
+};
+
+static int parse_u64_arg(const char *key, const char *value, void *opaque) {
+    char *end = NULL;
+
+    *(uint64_t *)opaque = strtoull(value, &end, 0);
+    if (value[0] == '\0' || *end != '\0') {
+        printf("Invalid %s=%s for %s\n", key, value,
+               IOAT_SW_PMD_RAWDEV_NAME_STR);
+        return -1;
+    }
+    return 0;
+}
+
+static int ioat_sw_probe(struct rte_vdev_device *vdev) {
+    const char *name = rte_vdev_device_name(vdev);
+    uint64_t latency_ns = 0, bw_mbps = 0, core = UINT64_MAX;
+    struct rte_kvargs *kvlist = NULL;
+    struct rte_rawdev *rawdev;
+    struct ioat_sw_rawdev *sw;
+    const char *args = rte_vdev_device_args(vdev);
+
+    if (args != NULL && args[0] != '\0') {
+        kvlist = rte_kvargs_parse(args, valid_args);
+        if (kvlist == NULL ||
+            rte_kvargs_process(kvlist, IOAT_SW_ARG_LATENCY, parse_u64_arg,
+                               &latency_ns) < 0 ||
+            rte_kvargs_process(kvlist, IOAT_SW_ARG_BANDWIDTH, parse_u64_arg,
+                               &bw_mbps) < 0 ||
+            rte_kvargs_process(kvlist, IOAT_SW_ARG_CORE, parse_u64_arg,
+                               &core) < 0) {
+            rte_kvargs_free(kvlist);
+            return -EINVAL;
+        }
+        rte_kvargs_free(kvlist);
+    }
+
+    rawdev = rte_rawdev_pmd_allocate(name, sizeof(*sw), rte_socket_id());
+    if (rawdev == NULL) {
+        printf("Failed to allocate rawdev %s\n", name);
+        return -ENOMEM;
+    }
+    if (rawdev->dev_id >= RTE_RAWDEV_MAX_DEVS) {
+        rte_rawdev_pmd_release(rawdev);
+        return -ENOSPC;
+    }
+
+    rawdev->dev_ops = &ioat_sw_rawdev_ops;
+    rawdev->device = &vdev->device;
+    rawdev->driver_name = IOAT_SW_PMD_RAWDEV_NAME_STR;
+
+    sw = rawdev->dev_private;
+    sw->dev_id = rawdev->dev_id;
+    sw->core = core == UINT64_MAX ? -1 : (int)core;
+    sw->latency_cycles = latency_ns * rte_get_tsc_hz() / 1000000000;
+    sw->cycles_per_byte =
+        bw_mbps == 0 ? 0 : (double)rte_get_tsc_hz() / (bw_mbps * 1000000);
+    ioat_sw_devs[rawdev->dev_id] = sw;
+
+    printf("Software IOAT channel %s: rawdev %u, latency %" PRIu64
+           " ns, bandwidth %s%" PRIu64 " MB/s\n",
+           name, rawdev->dev_id, latency_ns, bw_mbps ? "" : "unlimited ",
+           bw_mbps);
+    return 0;
+}
+
+static int ioat_sw_remove(struct rte_vdev_device *vdev) {
+    struct rte_rawdev *rawdev =
+        rte_rawdev_pmd_get_named_dev(rte_vdev_device_name(vdev));
+
+    if (rawdev == NULL) return -ENODEV;
+
+    ioat_sw_dev_close(rawdev);
+    ioat_sw_devs[rawdev->dev_id] = NULL;
+    return rte_rawdev_pmd_release(rawdev);
+}
+
+static struct rte_vdev_driver ioat_sw_pmd_drv = {.probe = ioat_sw_probe,
+                                                 .remove = ioat_sw_remove};
+
+RTE_PMD_REGISTER_VDEV(rawdev_ioat_sw, ioat_sw_pmd_drv);
+RTE_PMD_REGISTER_PARAM_STRING(rawdev_ioat_sw, IOAT_SW_ARG_LATENCY
+                              "=<ns> " IOAT_SW_ARG_BANDWIDTH
+                              "=<MB/s> " IOAT_SW_ARG_CORE "=<cpu>");
@@ -0,0 +1,169 @@
+// Software copy engine behind the rte_ioat_* semantics.
+//
+// Each rawdev_ioat_sw vdev is one channel: the application side owns a
+// descriptor ring exactly like the IOAT rawdev (power-of-two ring size
+// between 64 and 4096, one slot always left empty, optional handles), while
+// a worker thread plays the hardware: it only sees descriptors published by
+// the doorbell, executes them in order and advances a completion index.
+//
+// \ref https://doc.dpdk.org/guides-20.11/rawdevs/ioat.html
+
+#ifndef IOAT_SW_H
+#define IOAT_SW_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rte_branch_prediction.h"
+#include "rte_common.h"
+#include "rte_errno.h"
+#include "rte_ioat_rawdev.h"
+#include "rte_rawdev.h"
+
+#define IOAT_SW_PMD_RAWDEV_NAME_STR "rawdev_ioat_sw"
+
+// devargs, eg --vdev=rawdev_ioat_sw0,latency_ns=500,bw_mbps=5000,core=3
+#define IOAT_SW_ARG_LATENCY "latency_ns"  // doorbell-to-completion delay
+#define IOAT_SW_ARG_BANDWIDTH "bw_mbps"   // throughput cap in MB/s
+#define IOAT_SW_ARG_CORE "core"           // cpu the worker is pinned to
+
+enum ioat_sw_op { IOAT_SW_OP_COPY, IOAT_SW_OP_FILL };
+
+struct ioat_sw_desc {
+    uint64_t src;  // source IOVA, or the pattern of a fill
+    rte_iova_t dst;
+    uint32_t len;
+    uint32_t op;
+};
+
+struct ioat_sw_hdls {
+    uintptr_t src, dst;
+};
+
+// Same counters, in the same order, as the IOAT rawdev xstats
+struct ioat_sw_xstats {
+    uint64_t enqueue_failed;
+    uint64_t enqueued;
+    uint64_t started;
+    uint64_t completed;
+};
+
+struct ioat_sw_rawdev {
+    // Application side, not MT-safe, as for rte_ioat_*
+    struct ioat_sw_desc *desc_ring;
+    struct ioat_sw_hdls *hdls;
+    unsigned short ring_size;
+    bool hdls_disable;
+    unsigned short next_write;
+    unsigned short next_read;
+    unsigned short last_doorbell;
+    struct ioat_sw_xstats xstats;
+
+    // Written by the application, read by the worker
+    unsigned short doorbell __rte_cache_aligned;
+
+    // Written by the worker, read by the application
+    unsigned short completed __rte_cache_aligned;
+    volatile int error;  // rte_errno to report, eg an untranslatable IOVA
+
+    // Worker side
+    uint16_t dev_id __rte_cache_aligned;
+    pthread_t worker;
+    volatile bool running;
+    int core;
+    unsigned short hw_read;  // next descriptor to execute
+    uint64_t *finish_tsc;    // per slot time the completion becomes visible
+    uint64_t latency_cycles;
+    double cycles_per_byte;
+};
+
+// Per rawdev id, NULL unless the rawdev is a software channel
+extern struct ioat_sw_rawdev *ioat_sw_devs[RTE_RAWDEV_MAX_DEVS];
+
+static inline int ioat_sw_enqueue(struct ioat_sw_rawdev *sw, uint32_t op,
+                                  uint64_t src, rte_iova_t dst,
+                                  unsigned int length, uintptr_t src_hdl,
+                                  uintptr_t dst_hdl) {
+    const unsigned short mask = sw->ring_size - 1;
+    const unsigned short write = sw->next_write;
+    const unsigned short space = mask + sw->next_read - write;
+    struct ioat_sw_desc *desc;
+
+    if (space == 0) {
+        sw->xstats.enqueue_failed++;
+        return 0;
+    }
+
+    desc = &sw->desc_ring[write & mask];
+    desc->src = src;
+    desc->dst = dst;
+    desc->len = length;
+    desc->op = op;
+    if (!sw->hdls_disable) {
+        sw->hdls[write & mask].src = src_hdl;
+        sw->hdls[write & mask].dst = dst_hdl;
+    }
+
+    sw->next_write = write + 1;
+    sw->xstats.enqueued++;
+    return 1;
+}
+
+static inline int ioat_sw_enqueue_copy(struct ioat_sw_rawdev *sw,
+                                       phys_addr_t src, phys_addr_t dst,
+                                       unsigned int length, uintptr_t src_hdl,
+                                       uintptr_t dst_hdl) {
+    return ioat_sw_enqueue(sw, IOAT_SW_OP_COPY, src, dst, length, src_hdl,
+                           dst_hdl);
+}
+
+static inline int ioat_sw_enqueue_fill(struct ioat_sw_rawdev *sw,
+                                       uint64_t pattern, phys_addr_t dst,
+                                       unsigned int length, uintptr_t dst_hdl) {
+    return ioat_sw_enqueue(sw, IOAT_SW_OP_FILL, pattern, dst, length, 0,
+                           dst_hdl);
+}
+
+// The worker executes descriptors strictly in order, so every descriptor is
+// already fenced against the previous ones.
+static inline int ioat_sw_fence(struct ioat_sw_rawdev *sw) {
+    RTE_SET_USED(sw);
+    return 0;
+}
+
+// Ring the doorbell: publish all the descriptors enqueued so far
+static inline void ioat_sw_perform_ops(struct ioat_sw_rawdev *sw) {
+    sw->xstats.started += (unsigned short)(sw->next_write - sw->last_doorbell);
+    sw->last_doorbell = sw->next_write;
+    __atomic_store_n(&sw->doorbell, sw->next_write, __ATOMIC_RELEASE);
+}
+
+static inline int ioat_sw_completed_ops(struct ioat_sw_rawdev *sw,
+                                        uint8_t max_copies, uintptr_t *src_hdls,
+                                        uintptr_t *dst_hdls) {
+    const unsigned short mask = sw->ring_size - 1;
+    const unsigned short read = sw->next_read;
+    unsigned short count, i;
+
+    if (unlikely(sw->error != 0)) {
+        rte_errno = sw->error;
+        return -1;
+    }
+
+    count = __atomic_load_n(&sw->completed, __ATOMIC_ACQUIRE) - read;
+    // As the hardware, report everything completed when handles are off
+    if (!sw->hdls_disable) {
+        if (count > max_copies) count = max_copies;
+        for (i = 0; i < count; i++) {
+            src_hdls[i] = sw->hdls[(read + i) & mask].src;
+            dst_hdls[i] = sw->hdls[(read + i) & mask].dst;
+        }
+    }
+
+    sw->next_read = read + count;
+    sw->xstats.completed += count;
+    return count;
+}
+
+#endif  // IOAT_SW_H
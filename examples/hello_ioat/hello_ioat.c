@@ -4,14 +4,18 @@
 // \ref https://www.kernel.org/doc/html/latest/driver-api/vfio.html
 
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <malloc.h>
-#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "ioat_arena.h"
+#include "ioat_dev.h"
+#include "ioat_regcache.h"
 #include "rte_dev.h"
 #include "rte_ethdev.h"  // Not include this header will cause BUGs
 #include "rte_ioat_rawdev.h"
@@ -22,6 +26,13 @@
 #define MB(x) ((x) << 20)
 #define GB(x) ((x) << 30)
 
+// Idle mappings kept around before they are unmapped in a batch
+#define IOAT_REGCACHE_IDLE_BYTES MB(64UL)
+
+// Registrations are kept in a cache, so that mapping the same or an adjacent
+// buffer again does not go down to VFIO, see ioat_regcache.h
+static struct ioat_regcache *regcache;
+
 int ioat_dma_map(struct rte_device *ioat_dev, const void *addr, size_t len);
 int ioat_dma_unmap(struct rte_device *ioat_dev, const void *addr, size_t len);
 
@@ -44,7 +55,7 @@ int main(int argc, char *argv[]) {
     while (dev_id < num_rawdev) {
         struct rte_rawdev_info dev_info = {.dev_private = NULL};
         if (rte_rawdev_info_get(dev_id, &dev_info, 0) == 0 &&
-            strcmp(dev_info.driver_name, IOAT_PMD_RAWDEV_NAME_STR) == 0 &&
+            ioat_dev_driver_supported(dev_info.driver_name) &&
             rte_rawdev_selftest(dev_id) == 0) {
             printf(
                 "First functional IOAT device found: ioat_dev_name = %s, "
@@ -92,13 +103,13 @@ int main(int argc, char *argv[]) {
     }
 
     // Submit a data copy request
-    ret = rte_ioat_enqueue_copy(dev_id, (uintptr_t)src, (uintptr_t)dst,
+    ret = ioat_dev_enqueue_copy(dev_id, (uintptr_t)src, (uintptr_t)dst,
                                 buf_size, (uintptr_t)src, (uintptr_t)dst);
     assert(ret == 1);
     printf("Copy request submitted\n");
 
     // Kick the doorbell
-    rte_ioat_perform_ops(dev_id);
+    ioat_dev_perform_ops(dev_id);
     printf("Doorbell kicked\n");
 
     // Poll for the completion
@@ -106,7 +117,7 @@ int main(int argc, char *argv[]) {
     uint8_t *src_handle[1], *dst_handle[1];
     printf("Polling for the completion\n");
     do {
-        ret = rte_ioat_completed_ops(dev_id, 1, (void *)&src_handle[0],
+        ret = ioat_dev_completed_ops(dev_id, 1, (void *)&src_handle[0],
                                      (void *)&dst_handle[0]);
         if (ret < 0) {
             printf("Poll for completion failed: %s\n", rte_strerror(rte_errno));
@@ -128,6 +139,55 @@ int main(int argc, char *argv[]) {
     ret = ioat_dma_unmap(ioat_dev, dst, buf_size);
     assert(ret == 0);
 
+    // Mapping the same buffers again is served by the cache
+    ret = ioat_dma_map(ioat_dev, src, buf_size);
+    assert(ret == 0);
+    ret = ioat_dma_unmap(ioat_dev, src, buf_size);
+    assert(ret == 0);
+
+    struct ioat_regcache_stats stats;
+    ioat_regcache_stats_get(regcache, &stats);
+    printf("Registration cache: hits = %" PRIu64 ", misses = %" PRIu64
+           ", maps = %" PRIu64 ", unmaps = %" PRIu64 ", regions = %u\n",
+           stats.hits, stats.misses, stats.maps, stats.unmaps,
+           stats.nb_regions);
+    ioat_regcache_destroy(regcache);
+    regcache = NULL;
+
+    // Same copy with buffers from a DMA arena: hugepages already mapped by the
+    // EAL and pre-faulted, on the node of the device, so nothing to register
+    struct ioat_arena *arena =
+        ioat_arena_create("hello_arena", ioat_dev->numa_node, KB(64));
+    assert(arena != NULL);
+    rte_iova_t src_iova, dst_iova;
+    src = ioat_arena_alloc(arena, buf_size, &src_iova);
+    dst = ioat_arena_alloc(arena, buf_size, &dst_iova);
+    assert(src != NULL && dst != NULL);
+
+    for (size_t i = 0; i < buf_size; i++) {
+        src[i] = rand() % 255;
+    }
+
+    ret = ioat_dev_enqueue_copy(dev_id, src_iova, dst_iova, buf_size,
+                                (uintptr_t)src, (uintptr_t)dst);
+    assert(ret == 1);
+    ioat_dev_perform_ops(dev_id);
+    ne = 0;
+    do {
+        ret = ioat_dev_completed_ops(dev_id, 1, (void *)&src_handle[0],
+                                     (void *)&dst_handle[0]);
+        assert(ret >= 0);
+        ne += ret;
+    } while (ne < total_ops);
+    assert(src_handle[0] == src && dst_handle[0] == dst);
+
+    (memcmp(src, dst, buf_size) != 0) ? printf("Arena copy failed!\n")
+                                      : printf("Arena copy works!\n");
+
+    ioat_arena_free(src);
+    ioat_arena_free(dst);
+    ioat_arena_destroy(arena);
+
     // Shutdown the device
     rte_rawdev_stop(dev_id);
 
@@ -137,54 +197,20 @@ int main(int argc, char *argv[]) {
 int ioat_dma_map(struct rte_device *ioat_dev, const void *addr, size_t len) {
     int ret;
 
-    size_t page_size = getpagesize(), page_shift = log2(page_size),
-           page_mask = (1UL << page_shift) - 1;
-    printf("page_size = %lu, page_shift = %lu, page_mask = 0x%lx\n", page_size,
-           page_shift, page_mask);
-    assert(page_size == KB(4) && page_shift == 12);
-
-    size_t num_pages = (((uintptr_t)addr + len - 1) >> page_shift) -
-                       ((uintptr_t)addr >> page_shift) + 1;
-
-    uintptr_t aligned_addr = ((uintptr_t)addr) & ~page_mask;
-
-    printf("addr = %p, aligned_addr = %p, num_pages = %lu\n", addr,
-           (void *)aligned_addr, num_pages);
-
-    struct rte_memseg_list *msl =
-        rte_mem_virt2memseg_list((void *)aligned_addr);
-    if (msl != NULL) {
-        if (msl->base_va == (void *)aligned_addr &&
-            msl->len == num_pages * page_size) {
-            printf("Memory was registered\n");
-            return 0;
-        }
-        printf("Memory is overlapped with previously registered memory!\n");
-        assert(false);
-    }
-
-    // Register memories into DPDK otherwise DPDK rejects for dma
-    // mapping. The question is why should we first register these
-    // memories into DPDK?
-    ret = rte_extmem_register((void *)aligned_addr, page_size * num_pages, NULL,
-                              num_pages, page_size);
-    if (ret < 0) {
-        printf("Failed to register memory to DPDK: %s\n",
-               rte_strerror(rte_errno));
-        return ret;
+    if (regcache == NULL) {
+        regcache = ioat_regcache_create(ioat_dev, IOAT_REGCACHE_IDLE_BYTES);
+        if (regcache == NULL) return -ENOMEM;
     }
 
     // This will request the kernel module vfio_pci to register memories to
-    // IOMMU. For each request, vfio_pci will first pin all the memories, the
-    // get the mappings from the page table, and finally write them into the
-    // IOMMU. This process can be traced with perf, ie perf trace --no-syscall
-    // -e iommu:* -- progname args
-    ret = rte_dev_dma_map(ioat_dev, (void *)aligned_addr, aligned_addr,
-                          page_size * num_pages);
+    // IOMMU on a cache miss. For each request, vfio_pci will first pin all the
+    // memories, the get the mappings from the page table, and finally write
+    // them into the IOMMU. This process can be traced with perf, ie perf trace
+    // --no-syscall -e iommu:* -- progname args
+    ret = ioat_regcache_map(regcache, addr, len);
     if (ret < 0) {
-        printf("Failed to register memory to IOMMU: %s\n",
-               rte_strerror(rte_errno));
-        return -1;
+        printf("Failed to register memory to IOMMU: %s\n", rte_strerror(-ret));
+        return ret;
     }
 
     return 0;
@@ -193,43 +219,19 @@ int ioat_dma_map(struct rte_device *ioat_dev, const void *addr, size_t len) {
 int ioat_dma_unmap(struct rte_device *ioat_dev, const void *addr, size_t len) {
     int ret;
 
-    size_t page_size = getpagesize(), page_shift = log2(page_size),
-           page_mask = (1UL << page_shift) - 1;
-    printf("page_size = %lu, page_shift = %lu, page_mask = 0x%lx\n", page_size,
-           page_shift, page_mask);
-    assert(page_size == KB(4) && page_shift == 12);
-
-    size_t num_pages = (((uintptr_t)addr + len - 1) >> page_shift) -
-                       ((uintptr_t)addr >> page_shift) + 1;
-
-    uintptr_t aligned_addr = ((uintptr_t)addr) & ~page_mask;
-
-    printf("addr = %p, aligned_addr = %p, num_pages = %lu\n", addr,
-           (void *)aligned_addr, num_pages);
-
-    struct rte_memseg_list *msl =
-        rte_mem_virt2memseg_list((void *)aligned_addr);
-    if (msl == NULL) {
+    RTE_SET_USED(ioat_dev);
+    if (regcache == NULL) {
         printf("Memory was not registered\n");
         return 0;
     }
 
-    // Dereg the memories from IOMMU
-    ret = rte_dev_dma_unmap(ioat_dev, (void *)aligned_addr, aligned_addr,
-                            page_size * num_pages);
+    // The mapping stays until idle mappings exceed IOAT_REGCACHE_IDLE_BYTES
+    ret = ioat_regcache_unmap(regcache, addr, len);
     if (ret < 0) {
         printf("Failed to deregister memory from IOMMU: %s\n",
-               rte_strerror(rte_errno));
-        return -1;
-    }
-
-    // Dereg the memories from DPDK
-    ret = rte_extmem_unregister((void *)aligned_addr, page_size * num_pages);
-    if (ret < 0) {
-        printf("Failed to deregister memory from DPDK: %s\n",
-               rte_strerror(rte_errno));
+               rte_strerror(-ret));
         return ret;
     }
 
     return 0;
-}
\ No newline at end of file
+}
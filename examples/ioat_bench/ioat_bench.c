@@ -0,0 +1,885 @@
+// \ref https://doc.dpdk.org/guides-20.11/rawdevs/ioat.html
+// \ref https://doc.dpdk.org/api-20.11/rte__ioat__rawdev__fns_8h.html
+
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ioat_copy.h"
+#include "ioat_dev.h"
+#include "ioat_placement.h"
+#include "ioat_stripe.h"
+#include "rte_cycles.h"
+#include "rte_ethdev.h"  // Not include this header will cause BUGs
+#include "rte_ioat_rawdev.h"
+#include "rte_malloc.h"
+#include "rte_memzone.h"
+#include "rte_rawdev.h"
+
+#define KB(x) ((x) << 10)
+#define MB(x) ((x) << 20)
+#define GB(x) ((x) << 30)
+
+#define MAX_SWEEP_POINTS 32
+// Upper bound of copies in flight, ie the largest ring size IOAT supports
+#define MAX_INFLIGHT_OPS 4096
+#define MAX_LAT_SAMPLES (1U << 20)
+#define COMPLETION_BURST 64
+// Bytes of src and dst each that the copies of a hot point cycle through, so
+// that they stay in the L2 cache
+#define HOT_WSS KB(256UL)
+// The IOAT path among the kernels compared with -K
+#define KERNEL_IOAT IOAT_COPY_NB_KERNELS
+
+struct align_pair {
+    unsigned int src, dst;
+};
+
+struct bench_point {
+    size_t size;
+    unsigned int batch;
+    unsigned int ring_size;
+    struct align_pair align;
+    unsigned int nb_channels;  // 0 unless striped over several channels
+    bool hdls_disable;
+    size_t wss;           // bytes of src and dst each the copies cycle through
+    bool hot;             // wss is the cache-resident one of the kernel sweep
+    unsigned int kernel;  // CPU copy kernel, or KERNEL_IOAT
+};
+
+struct bench_result {
+    uint64_t nb_ops, nb_bytes, cycles;
+    uint64_t p50, p99, p999;  // in ns
+};
+
+struct bench_config {
+    int dev_id;
+    size_t sizes[MAX_SWEEP_POINTS];
+    unsigned int nb_sizes;
+    size_t batches[MAX_SWEEP_POINTS];
+    unsigned int nb_batches;
+    size_t rings[MAX_SWEEP_POINTS];
+    unsigned int nb_rings;
+    struct align_pair aligns[MAX_SWEEP_POINTS];
+    unsigned int nb_aligns;
+    size_t channels[MAX_SWEEP_POINTS];  // channel counts of the striped sweep
+    unsigned int nb_channels;
+    size_t chunk_size;      // bytes of a copy given to one channel at a time
+    bool hdls_modes[2];     // sweep with handles enabled, disabled
+    bool hdls_column;
+    size_t max_xfer;        // larger copies are split into several descriptors
+    size_t wss;             // working set size of each of src and dst
+    unsigned int duration;  // measuring time of each point in ms
+    bool csv;
+    // Compare these kernels, in hot and/or cold caches, instead of sweeping
+    bool kernel_mode;
+    bool kernels[KERNEL_IOAT + 1];
+    bool caches[2];  // hot, cold
+};
+
+static struct bench_config cfg = {
+    .dev_id = -1,
+    .chunk_size = KB(64UL),
+    .max_xfer = MB(1UL),
+    .wss = MB(128UL),
+    .duration = 200,
+};
+
+// Functional channels, the striped sweep uses the first N of them
+static uint16_t bench_devs[IOAT_STRIPE_MAX_CHANNELS];
+static unsigned int nb_bench_devs;
+
+// Placement map saved by ioat_devices, which orders the functional channels
+static struct ioat_placement placement;
+static bool placement_loaded;
+
+// Buffers shared by all the sweep points
+static uint8_t *src_buf, *dst_buf;
+static rte_iova_t src_iova, dst_iova;
+
+// Per-op doorbell timestamps, indexed by op sequence number
+static uint64_t op_tsc[MAX_INFLIGHT_OPS];
+static uint64_t *lat_samples;
+
+static void usage(const char *prgname) {
+    printf(
+        "%s [EAL options] -- [options]\n"
+        "  -d DEV_ID: rawdev id of the IOAT channel, ignored with -n (default: "
+        "first functional one)\n"
+        "  -P MAP: pick the channels from a placement map saved by "
+        "ioat_devices -o, local ones first and the fastest first\n"
+        "  -s SIZES: copy sizes, eg 64,4K,1M (default: 64B to 64MB, x4)\n"
+        "  -b BATCHES: copies per rte_ioat_perform_ops (default: 1,8,32,128)\n"
+        "  -r RINGS: ring sizes, power of two in [64, 4096] (default: "
+        "64,256,1024,4096)\n"
+        "  -a ALIGNS: src:dst byte offsets (default: 0:0,1:3)\n"
+        "  -x MAX_XFER: max bytes per descriptor (default: 1M)\n"
+        "  -w WSS: working set size of src and dst each (default: 128M)\n"
+        "  -t MS: measuring time per point in ms (default: 200)\n"
+        "  -n CHANNELS: stripe each copy over N channels instead, eg "
+        "1,2,4,8,16\n"
+        "  -k CHUNK: bytes per channel of a striped copy (default: 64K)\n"
+        "  -H HANDLES: on,off to compare the channel configured with and "
+        "without handles (default: on)\n"
+        "  -K KERNELS: compare CPU copy kernels and IOAT instead, among "
+        "rte,avx2,avx512,nt,ioat or all; IOAT copies use the first -b and -r "
+        "values (default: 32 and 4096)\n"
+        "  -c CACHES: hot,cold to run the -K copies within 256K, which stays "
+        "in cache, and/or over the whole working set (default: hot,cold)\n"
+        "  --csv: print results as CSV\n",
+        prgname);
+}
+
+static int parse_size(const char *str, size_t *size) {
+    char *end = NULL;
+    unsigned long long v = strtoull(str, &end, 0);
+
+    if (end == str) return -1;
+    switch (*end) {
+        case 'k':
+        case 'K':
+            v = KB(v), end++;
+            break;
+        case 'm':
+        case 'M':
+            v = MB(v), end++;
+            break;
+        case 'g':
+        case 'G':
+            v = GB(v), end++;
+            break;
+    }
+    if (*end != '\0' && *end != ',' && *end != ':') return -1;
+    *size = v;
+    return end - str;
+}
+
+static int parse_size_list(const char *str, size_t *list, unsigned int *n) {
+    unsigned int i = 0;
+    int len;
+
+    while (*str != '\0') {
+        if (i == MAX_SWEEP_POINTS) return -1;
+        len = parse_size(str, &list[i++]);
+        if (len < 0) return -1;
+        str += len;
+        if (*str == ',') str++;
+    }
+    *n = i;
+    return i > 0 ? 0 : -1;
+}
+
+static int parse_align_list(const char *str, struct align_pair *list,
+                            unsigned int *n) {
+    unsigned int i = 0;
+    unsigned int src, dst;
+    int len;
+
+    while (*str != '\0') {
+        if (i == MAX_SWEEP_POINTS) return -1;
+        if (sscanf(str, "%u:%u%n", &src, &dst, &len) != 2) return -1;
+        if (src >= KB(4U) || dst >= KB(4U)) return -1;
+        list[i].src = src;
+        list[i++].dst = dst;
+        str += len;
+        if (*str == ',') str++;
+    }
+    *n = i;
+    return i > 0 ? 0 : -1;
+}
+
+static int parse_hdls_modes(char *str) {
+    char *save = NULL, *tok;
+
+    cfg.hdls_modes[0] = cfg.hdls_modes[1] = false;
+    for (tok = strtok_r(str, ",", &save); tok != NULL;
+         tok = strtok_r(NULL, ",", &save)) {
+        if (strcmp(tok, "on") == 0)
+            cfg.hdls_modes[0] = true;
+        else if (strcmp(tok, "off") == 0)
+            cfg.hdls_modes[1] = true;
+        else
+            return -1;
+    }
+    cfg.hdls_column = true;
+    return cfg.hdls_modes[0] || cfg.hdls_modes[1] ? 0 : -1;
+}
+
+static int parse_kernels(char *str) {
+    char *save = NULL, *tok;
+    unsigned int k;
+
+    for (tok = strtok_r(str, ",", &save); tok != NULL;
+         tok = strtok_r(NULL, ",", &save)) {
+        if (strcmp(tok, "all") == 0) {
+            for (k = 0; k <= KERNEL_IOAT; k++) cfg.kernels[k] = true;
+            continue;
+        }
+        k = strcmp(tok, "ioat") == 0 ? KERNEL_IOAT
+                                     : ioat_copy_kernel_parse(tok);
+        if (k == KERNEL_IOAT && strcmp(tok, "ioat") != 0) return -1;
+        cfg.kernels[k] = true;
+    }
+    cfg.kernel_mode = true;
+    return 0;
+}
+
+static int parse_caches(char *str) {
+    char *save = NULL, *tok;
+
+    cfg.caches[0] = cfg.caches[1] = false;
+    for (tok = strtok_r(str, ",", &save); tok != NULL;
+         tok = strtok_r(NULL, ",", &save)) {
+        if (strcmp(tok, "hot") == 0)
+            cfg.caches[0] = true;
+        else if (strcmp(tok, "cold") == 0)
+            cfg.caches[1] = true;
+        else
+            return -1;
+    }
+    return cfg.caches[0] || cfg.caches[1] ? 0 : -1;
+}
+
+static int parse_args(int argc, char **argv) {
+    static const struct option lgopts[] = {{"csv", no_argument, NULL, 'C'},
+                                           {NULL, 0, 0, 0}};
+    const char *prgname = argv[0];
+    unsigned int i;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "d:P:s:b:r:a:x:w:t:n:k:H:K:c:h",
+                              lgopts, NULL)) != EOF) {
+        int ret = 0;
+
+        switch (opt) {
+            case 'd':
+                cfg.dev_id = atoi(optarg);
+                break;
+            case 'P':
+                ret = ioat_placement_load(optarg, &placement) > 0 ? 0 : -1;
+                placement_loaded = ret == 0;
+                break;
+            case 's':
+                ret = parse_size_list(optarg, cfg.sizes, &cfg.nb_sizes);
+                break;
+            case 'b':
+                ret = parse_size_list(optarg, cfg.batches, &cfg.nb_batches);
+                for (i = 0; ret == 0 && i < cfg.nb_batches; i++)
+                    if (cfg.batches[i] == 0) ret = -1;
+                break;
+            case 'r':
+                ret = parse_size_list(optarg, cfg.rings, &cfg.nb_rings);
+                for (i = 0; ret == 0 && i < cfg.nb_rings; i++)
+                    if (cfg.rings[i] < 64 || cfg.rings[i] > 4096 ||
+                        !rte_is_power_of_2(cfg.rings[i]))
+                        ret = -1;
+                break;
+            case 'a':
+                ret = parse_align_list(optarg, cfg.aligns, &cfg.nb_aligns);
+                break;
+            case 'x':
+                ret = parse_size(optarg, &cfg.max_xfer) < 0 ||
+                              cfg.max_xfer == 0 || cfg.max_xfer > UINT32_MAX
+                          ? -1
+                          : 0;
+                break;
+            case 'w':
+                ret = parse_size(optarg, &cfg.wss) < 0 ? -1 : 0;
+                break;
+            case 't':
+                cfg.duration = atoi(optarg);
+                break;
+            case 'n':
+                ret = parse_size_list(optarg, cfg.channels, &cfg.nb_channels);
+                for (i = 0; ret == 0 && i < cfg.nb_channels; i++)
+                    if (cfg.channels[i] == 0 ||
+                        cfg.channels[i] > IOAT_STRIPE_MAX_CHANNELS)
+                        ret = -1;
+                break;
+            case 'k':
+                ret = parse_size(optarg, &cfg.chunk_size) < 0 ||
+                              cfg.chunk_size == 0 ||
+                              cfg.chunk_size > UINT32_MAX
+                          ? -1
+                          : 0;
+                break;
+            case 'H':
+                ret = parse_hdls_modes(optarg);
+                break;
+            case 'K':
+                ret = parse_kernels(optarg);
+                break;
+            case 'c':
+                ret = parse_caches(optarg);
+                break;
+            case 'C':
+                cfg.csv = true;
+                break;
+            case 'h':
+                usage(prgname);
+                exit(EXIT_SUCCESS);
+            default:
+                ret = -1;
+        }
+        if (ret < 0) {
+            printf("Invalid argument: -%c %s\n", opt, optarg ? optarg : "");
+            usage(prgname);
+            return -1;
+        }
+    }
+
+    if (!cfg.hdls_column) cfg.hdls_modes[0] = true;
+    if (!cfg.caches[0] && !cfg.caches[1]) cfg.caches[0] = cfg.caches[1] = true;
+    // The IOAT copies of the kernel comparison take a single configuration
+    if (cfg.kernel_mode && (cfg.nb_channels > 0 || cfg.hdls_column)) {
+        printf("Kernel comparison (-K) runs one channel with handles\n");
+        return -1;
+    }
+    if (cfg.kernel_mode && cfg.nb_batches == 0)
+        cfg.batches[cfg.nb_batches++] = 32;
+    if (cfg.kernel_mode && cfg.nb_rings == 0)
+        cfg.rings[cfg.nb_rings++] = 4096;
+    // Striped copies are matched to their chunks by the handles
+    if (cfg.nb_channels > 0 && cfg.hdls_modes[1]) {
+        printf("Striping (-n) needs handles\n");
+        return -1;
+    }
+
+    if (cfg.nb_sizes == 0)
+        for (size_t size = 64; size <= MB(64UL); size <<= 2)
+            cfg.sizes[cfg.nb_sizes++] = size;
+    if (cfg.nb_batches == 0) {
+        static const size_t batches[] = {1, 8, 32, 128};
+        for (i = 0; i < RTE_DIM(batches); i++)
+            cfg.batches[cfg.nb_batches++] = batches[i];
+    }
+    if (cfg.nb_rings == 0)
+        for (size_t ring = 64; ring <= 4096; ring <<= 2)
+            cfg.rings[cfg.nb_rings++] = ring;
+    if (cfg.nb_aligns == 0) {
+        cfg.aligns[cfg.nb_aligns++] = (struct align_pair){0, 0};
+        cfg.aligns[cfg.nb_aligns++] = (struct align_pair){1, 3};
+    }
+
+    for (i = 0; i < cfg.nb_sizes; i++) {
+        if (cfg.sizes[i] + KB(4UL) > cfg.wss) {
+            printf("Copy size %zu does not fit into the working set %zu\n",
+                   cfg.sizes[i], cfg.wss);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Filter out up to max functional IOAT devices, see hello_ioat. With a
+// placement map, those which passed its self test, in the order of the map.
+static unsigned int find_ioat_devs(uint16_t *dev_ids, unsigned int max) {
+    int num_rawdev = rte_rawdev_count();
+    unsigned int n = 0;
+    int dev_id;
+
+    if (placement_loaded)
+        return ioat_placement_order(&placement, rte_socket_id(), dev_ids, max);
+    for (dev_id = 0; dev_id < num_rawdev && n < max; dev_id++) {
+        struct rte_rawdev_info dev_info = {.dev_private = NULL};
+        if (rte_rawdev_info_get(dev_id, &dev_info, 0) == 0 &&
+            ioat_dev_driver_supported(dev_info.driver_name) &&
+            rte_rawdev_selftest(dev_id) == 0)
+            dev_ids[n++] = dev_id;
+    }
+    return n;
+}
+
+static void configure_ring(int dev_id, unsigned short ring_size,
+                           bool hdls_disable) {
+    struct rte_ioat_rawdev_config ioat_dev_conf = {
+        .ring_size = ring_size, .hdls_disable = hdls_disable};
+    struct rte_rawdev_info dev_info = {.dev_private = &ioat_dev_conf};
+
+    // The ring can only be resized while the device is stopped
+    rte_rawdev_stop(dev_id);
+    if (rte_rawdev_configure(dev_id, &dev_info, sizeof(ioat_dev_conf)) != 0)
+        rte_exit(EXIT_FAILURE, "Error with rte_rawdev_configure()\n");
+    if (rte_rawdev_start(dev_id) != 0)
+        rte_exit(EXIT_FAILURE, "Error with rte_rawdev_start()\n");
+}
+
+static uint8_t *alloc_buf(const char *name, int socket_id, rte_iova_t *iova) {
+    // IOVA-contiguous so that a single descriptor may span several pages
+    const struct rte_memzone *mz = rte_memzone_reserve_aligned(
+        name, cfg.wss, socket_id, RTE_MEMZONE_IOVA_CONTIG, KB(4));
+    if (mz == NULL)
+        rte_exit(EXIT_FAILURE,
+                 "Cannot reserve %zu bytes of IOVA-contiguous memory: %s\n",
+                 cfg.wss, rte_strerror(rte_errno));
+    *iova = mz->iova;
+    return mz->addr;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, uint64_t n, double p) {
+    uint64_t idx = (uint64_t)(p * n);
+    if (n == 0) return 0;
+    return sorted[idx < n ? idx : n - 1];
+}
+
+static void finish_point(const struct bench_point *pt,
+                         struct bench_result *res, uint64_t start,
+                         uint64_t nb_done, uint64_t nb_samples) {
+    const uint64_t tsc_hz = rte_get_tsc_hz();
+
+    memset(res, 0, sizeof(*res));
+    res->cycles = rte_rdtsc() - start;
+    res->nb_ops = nb_done;
+    res->nb_bytes = nb_done * pt->size;
+
+    qsort(lat_samples, nb_samples, sizeof(*lat_samples), cmp_u64);
+    res->p50 = percentile(lat_samples, nb_samples, 0.5) * 1000000000 / tsc_hz;
+    res->p99 = percentile(lat_samples, nb_samples, 0.99) * 1000000000 / tsc_hz;
+    res->p999 =
+        percentile(lat_samples, nb_samples, 0.999) * 1000000000 / tsc_hz;
+
+    // Sanity check the first slot, which every point writes at least once
+    if (nb_done > 0 && memcmp(src_buf + pt->align.src, dst_buf + pt->align.dst,
+                              pt->size) != 0)
+        rte_exit(EXIT_FAILURE, "Copy of %zu bytes failed!\n", pt->size);
+}
+
+// Completion state of the copies of one point
+struct reap_state {
+    uint64_t nb_done;     // copies completed
+    uint64_t descs_done;  // descriptors completed
+    uint64_t nb_samples;
+    unsigned int inflight_descs;
+};
+
+// Reap completions. Only the last descriptor of a copy carries a non-zero
+// dst handle. Without handles only the number of completed descriptors is
+// known, but as they complete in order so do the copies.
+static void reap(const struct bench_point *pt, unsigned int descs_per_op,
+                 struct reap_state *st) {
+    uintptr_t src_hdls[COMPLETION_BURST], dst_hdls[COMPLETION_BURST];
+    unsigned int i;
+    int ret;
+
+    ret = ioat_dev_completed_ops(cfg.dev_id, COMPLETION_BURST, src_hdls,
+                                 dst_hdls);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "Poll for completion failed: %s\n",
+                 rte_strerror(rte_errno));
+    st->inflight_descs -= ret;
+    st->descs_done += ret;
+
+    const uint64_t now = rte_rdtsc();
+    if (pt->hdls_disable) {
+        const uint64_t nb_done = st->descs_done / descs_per_op;
+
+        for (; st->nb_done < nb_done; st->nb_done++)
+            if (st->nb_samples < MAX_LAT_SAMPLES)
+                lat_samples[st->nb_samples++] =
+                    now - op_tsc[st->nb_done % MAX_INFLIGHT_OPS];
+        return;
+    }
+
+    for (i = 0; i < (unsigned int)ret; i++) {
+        if (dst_hdls[i] == 0) continue;
+        if (st->nb_samples < MAX_LAT_SAMPLES)
+            lat_samples[st->nb_samples++] =
+                now - op_tsc[src_hdls[i] % MAX_INFLIGHT_OPS];
+        st->nb_done++;
+    }
+}
+
+static void run_point(const struct bench_point *pt, struct bench_result *res) {
+    const size_t stride = RTE_ALIGN_CEIL(pt->size + KB(4UL), KB(4UL));
+    const unsigned int nb_slots = RTE_MAX(pt->wss / stride, 1UL);
+    const unsigned int descs_per_op =
+        (pt->size + cfg.max_xfer - 1) / cfg.max_xfer;
+    const unsigned int ring_cap = pt->ring_size - 1;
+    const uint64_t tsc_hz = rte_get_tsc_hz();
+    // Copies are numbered in submission order: those below nb_started have
+    // their first descriptor enqueued, those below nb_stamped have been
+    // kicked by a doorbell.
+    uint64_t nb_started = 0, nb_stamped = 0;
+    struct reap_state st = {0};
+    unsigned int next_desc = 0;
+    uint64_t start, deadline;
+
+    start = rte_rdtsc();
+    deadline = start + tsc_hz * cfg.duration / 1000;
+
+    while (rte_rdtsc() < deadline || next_desc != 0) {
+        unsigned int batch_ops = 0, nb_enq = 0;
+
+        // Enqueue one batch of copies as far as the ring has room. A copy
+        // larger than max_xfer may be spread over several doorbells.
+        while (st.inflight_descs < ring_cap) {
+            const uint64_t op = next_desc == 0 ? nb_started : nb_started - 1;
+            const unsigned int slot = op % nb_slots;
+            const size_t off = (size_t)next_desc * cfg.max_xfer;
+            const size_t len = RTE_MIN(cfg.max_xfer, pt->size - off);
+            const bool last = (next_desc == descs_per_op - 1);
+
+            if (next_desc == 0 && (batch_ops == pt->batch ||
+                                   op - st.nb_done == MAX_INFLIGHT_OPS))
+                break;
+
+            if (ioat_dev_enqueue_copy(
+                    cfg.dev_id,
+                    src_iova + (size_t)slot * stride + pt->align.src + off,
+                    dst_iova + (size_t)slot * stride + pt->align.dst + off, len,
+                    op, last) != 1)
+                break;
+            st.inflight_descs++;
+            nb_enq++;
+            if (next_desc == 0) {
+                nb_started++;
+                batch_ops++;
+            }
+            next_desc = last ? 0 : next_desc + 1;
+        }
+
+        if (nb_enq > 0) {
+            ioat_dev_perform_ops(cfg.dev_id);
+            // Latency is measured from the doorbell of the first descriptor
+            const uint64_t now = rte_rdtsc();
+            for (; nb_stamped < nb_started; nb_stamped++)
+                op_tsc[nb_stamped % MAX_INFLIGHT_OPS] = now;
+        }
+
+        reap(pt, descs_per_op, &st);
+    }
+
+    // Drain the copies still in flight
+    while (st.nb_done < nb_started) reap(pt, descs_per_op, &st);
+
+    finish_point(pt, res, start, st.nb_done, st.nb_samples);
+}
+
+// Reap completed striped copies, which carry their sequence as the cookie
+static unsigned int stripe_reap(struct ioat_stripe *st, uint64_t *nb_samples) {
+    uintptr_t cookies[COMPLETION_BURST];
+    int i, ret;
+
+    ret = ioat_stripe_completed(st, cookies, COMPLETION_BURST);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "Poll for completion failed: %s\n",
+                 rte_strerror(rte_errno));
+
+    const uint64_t now = rte_rdtsc();
+    for (i = 0; i < ret && *nb_samples < MAX_LAT_SAMPLES; i++)
+        lat_samples[(*nb_samples)++] =
+            now - op_tsc[cookies[i] % MAX_INFLIGHT_OPS];
+    return ret;
+}
+
+// Same as run_point but every copy is cut into chunk_size pieces spread over
+// the first nb_channels channels, and only completes when all pieces do.
+static void run_stripe_point(const struct bench_point *pt,
+                             struct bench_result *res) {
+    const size_t stride = RTE_ALIGN_CEIL(pt->size + KB(4UL), KB(4UL));
+    const unsigned int nb_slots = RTE_MAX(pt->wss / stride, 1UL);
+    const uint64_t tsc_hz = rte_get_tsc_hz();
+    uint64_t nb_started = 0, nb_done = 0, nb_samples = 0;
+    struct ioat_stripe st;
+    uint64_t start, deadline;
+    int ret;
+
+    ret = ioat_stripe_init(&st, bench_devs, pt->nb_channels, cfg.chunk_size,
+                           MAX_INFLIGHT_OPS);
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "Cannot stripe over %u channels: %s\n",
+                 pt->nb_channels, rte_strerror(-ret));
+
+    start = rte_rdtsc();
+    deadline = start + tsc_hz * cfg.duration / 1000;
+
+    while (rte_rdtsc() < deadline) {
+        unsigned int batch_ops = 0;
+
+        while (batch_ops < pt->batch) {
+            const unsigned int slot = nb_started % nb_slots;
+
+            ret = ioat_stripe_copy(
+                &st, src_iova + (size_t)slot * stride + pt->align.src,
+                dst_iova + (size_t)slot * stride + pt->align.dst, pt->size,
+                nb_started);
+            if (ret < 0)
+                rte_exit(EXIT_FAILURE, "Striped copy failed: %s\n",
+                         rte_strerror(-ret));
+            if (ret == 0) break;
+            nb_started++;
+            batch_ops++;
+        }
+
+        if (batch_ops > 0) {
+            ioat_stripe_perform_ops(&st);
+            const uint64_t now = rte_rdtsc();
+            for (uint64_t op = nb_started - batch_ops; op < nb_started; op++)
+                op_tsc[op % MAX_INFLIGHT_OPS] = now;
+        }
+
+        nb_done += stripe_reap(&st, &nb_samples);
+    }
+
+    while (nb_done < nb_started) nb_done += stripe_reap(&st, &nb_samples);
+
+    finish_point(pt, res, start, nb_done, nb_samples);
+    ioat_stripe_free(&st);
+}
+
+// Copy one slot after the other with a CPU kernel, timing each copy. The
+// latency of the streaming kernel includes its fence.
+static void run_cpu_point(const struct bench_point *pt,
+                          struct bench_result *res) {
+    const size_t stride = RTE_ALIGN_CEIL(pt->size + KB(4UL), KB(4UL));
+    const unsigned int nb_slots = RTE_MAX(pt->wss / stride, 1UL);
+    const ioat_copy_fn copy = ioat_copy_kernel_fn(pt->kernel);
+    const uint64_t tsc_hz = rte_get_tsc_hz();
+    uint64_t nb_done = 0, nb_samples = 0;
+    uint64_t start, deadline, now;
+
+    start = rte_rdtsc();
+    deadline = start + tsc_hz * cfg.duration / 1000;
+
+    for (now = start; now < deadline; nb_done++) {
+        const size_t off = (size_t)(nb_done % nb_slots) * stride;
+        const uint64_t copy_start = now;
+
+        copy(dst_buf + off + pt->align.dst, src_buf + off + pt->align.src,
+             pt->size);
+        now = rte_rdtsc();
+        if (nb_samples < MAX_LAT_SAMPLES)
+            lat_samples[nb_samples++] = now - copy_start;
+    }
+
+    finish_point(pt, res, start, nb_done, nb_samples);
+}
+
+// Whether every channel has room for its share of the chunks of one copy
+static bool stripe_fits(const struct bench_point *pt) {
+    const size_t nb_chunks = (pt->size + cfg.chunk_size - 1) / cfg.chunk_size;
+    return (nb_chunks + pt->nb_channels - 1) / pt->nb_channels <
+           pt->ring_size;
+}
+
+static const char *kernel_name(unsigned int kernel) {
+    return kernel == KERNEL_IOAT ? "ioat" : ioat_copy_kernel_name(kernel);
+}
+
+static void print_header(void) {
+    const bool striped = cfg.nb_channels > 0;
+
+    if (cfg.csv) {
+        printf(
+            "%s%s%ssize,batch,ring_size,src_align,dst_align,gbps,mops,"
+            "p50_ns,p99_ns,p999_ns\n",
+            cfg.kernel_mode ? "kernel,cache," : "", striped ? "channels," : "",
+            cfg.hdls_column ? "handles," : "");
+        return;
+    }
+    if (cfg.kernel_mode) printf("%6s %5s ", "kernel", "cache");
+    if (striped) printf("%8s ", "channels");
+    if (cfg.hdls_column) printf("%7s ", "handles");
+    printf("%10s %6s %6s %6s %10s %10s %10s %10s %10s\n", "size", "batch",
+           "ring", "align", "GB/s", "Mops/s", "p50(ns)", "p99(ns)",
+           "p999(ns)");
+}
+
+static void print_result(const struct bench_point *pt,
+                         const struct bench_result *res) {
+    const double secs = (double)res->cycles / rte_get_tsc_hz();
+    const double gbps = res->nb_bytes / secs / 1e9;
+    const double mops = res->nb_ops / secs / 1e6;
+    char align[16];
+
+    const char *cache = pt->hot ? "hot" : "cold";
+
+    if (cfg.csv) {
+        if (cfg.kernel_mode) printf("%s,%s,", kernel_name(pt->kernel), cache);
+        if (pt->nb_channels > 0) printf("%u,", pt->nb_channels);
+        if (cfg.hdls_column) printf("%s,", pt->hdls_disable ? "off" : "on");
+        printf("%zu,%u,%u,%u,%u,%.3f,%.3f,%" PRIu64 ",%" PRIu64 ",%" PRIu64
+               "\n",
+               pt->size, pt->batch, pt->ring_size, pt->align.src, pt->align.dst,
+               gbps, mops, res->p50, res->p99, res->p999);
+    } else {
+        snprintf(align, sizeof(align), "%u:%u", pt->align.src, pt->align.dst);
+        if (cfg.kernel_mode)
+            printf("%6s %5s ", kernel_name(pt->kernel), cache);
+        if (pt->nb_channels > 0) printf("%8u ", pt->nb_channels);
+        if (cfg.hdls_column) printf("%7s ", pt->hdls_disable ? "off" : "on");
+        printf("%10zu %6u %6u %6s %10.3f %10.3f %10" PRIu64 " %10" PRIu64
+               " %10" PRIu64 "\n",
+               pt->size, pt->batch, pt->ring_size, align, gbps, mops, res->p50,
+               res->p99, res->p999);
+    }
+    fflush(stdout);
+}
+
+// Run all the points of one ring configuration
+static void sweep(unsigned int ring_size, bool hdls_disable) {
+    unsigned int n, s, b, a;
+
+    // A single pass over cfg.dev_id alone unless striping
+    for (n = 0; n < RTE_MAX(cfg.nb_channels, 1U); n++) {
+        const unsigned int nb_channels =
+            cfg.nb_channels > 0 ? cfg.channels[n] : 0;
+
+        if (nb_channels > nb_bench_devs) continue;
+        for (s = 0; s < cfg.nb_sizes; s++)
+            for (b = 0; b < cfg.nb_batches; b++)
+                for (a = 0; a < cfg.nb_aligns; a++) {
+                    const struct bench_point pt = {
+                        .size = cfg.sizes[s],
+                        .batch = cfg.batches[b],
+                        .ring_size = ring_size,
+                        .align = cfg.aligns[a],
+                        .nb_channels = nb_channels,
+                        .hdls_disable = hdls_disable,
+                        .wss = cfg.wss,
+                        .kernel = KERNEL_IOAT,
+                    };
+                    struct bench_result res;
+
+                    if (nb_channels == 0) {
+                        run_point(&pt, &res);
+                    } else if (stripe_fits(&pt)) {
+                        run_stripe_point(&pt, &res);
+                    } else {
+                        fprintf(stderr,
+                                "Skipping %zu bytes over %u channels: more "
+                                "chunks than ring slots\n",
+                                pt.size, nb_channels);
+                        continue;
+                    }
+                    print_result(&pt, &res);
+                }
+    }
+}
+
+// Compare the CPU copy kernels with each other and with IOAT copies, one
+// copy at a time for the CPU and in batches for IOAT. CPU copies report a
+// batch of 1 and no ring.
+static void kernel_sweep(void) {
+    unsigned int s, c, a, k;
+
+    for (s = 0; s < cfg.nb_sizes; s++)
+        for (c = 0; c < RTE_DIM(cfg.caches); c++) {
+            if (!cfg.caches[c]) continue;
+            for (a = 0; a < cfg.nb_aligns; a++)
+                for (k = 0; k <= KERNEL_IOAT; k++) {
+                    const bool ioat = k == KERNEL_IOAT;
+                    const struct bench_point pt = {
+                        .size = cfg.sizes[s],
+                        .batch = ioat ? cfg.batches[0] : 1,
+                        .ring_size = ioat ? cfg.rings[0] : 0,
+                        .align = cfg.aligns[a],
+                        .wss = c == 0 ? RTE_MIN(HOT_WSS, cfg.wss) : cfg.wss,
+                        .hot = c == 0,
+                        .kernel = k,
+                    };
+                    struct bench_result res;
+
+                    if (!cfg.kernels[k]) continue;
+                    if (ioat)
+                        run_point(&pt, &res);
+                    else
+                        run_cpu_point(&pt, &res);
+                    print_result(&pt, &res);
+                }
+        }
+}
+
+int main(int argc, char *argv[]) {
+    struct rte_rawdev_info dev_info = {.dev_private = NULL};
+    unsigned int max_channels = 1;
+    unsigned int r, h, n, k;
+    int socket_id;
+    int ret;
+
+    // Init the EAL
+    ret = rte_eal_init(argc, argv);
+    if (ret < 0) rte_exit(EXIT_FAILURE, "Invalid EAL arguments\n");
+    argc -= ret;
+    argv += ret;
+
+    if (parse_args(argc, argv) < 0)
+        rte_exit(EXIT_FAILURE, "Invalid ioat_bench arguments\n");
+
+    if (cfg.nb_channels > 0) {
+        for (n = 0; n < cfg.nb_channels; n++)
+            max_channels = RTE_MAX(max_channels, (unsigned int)cfg.channels[n]);
+        nb_bench_devs = find_ioat_devs(bench_devs, max_channels);
+        if (nb_bench_devs < max_channels)
+            fprintf(stderr,
+                    "Only %u functional IOAT channels, skipping larger "
+                    "channel counts\n",
+                    nb_bench_devs);
+        if (nb_bench_devs > 0) cfg.dev_id = bench_devs[0];
+    } else if (cfg.dev_id < 0 && find_ioat_devs(bench_devs, 1) == 1) {
+        cfg.dev_id = bench_devs[0];
+    }
+    if (cfg.dev_id < 0 ||
+        rte_rawdev_info_get(cfg.dev_id, &dev_info, 0) != 0) {
+        // The CPU kernels may still be compared with each other
+        if (!cfg.kernel_mode)
+            rte_exit(EXIT_FAILURE, "IOAT device not found!\n");
+        fprintf(stderr, "IOAT device not found, comparing CPU kernels only\n");
+        cfg.dev_id = -1;
+        cfg.kernels[KERNEL_IOAT] = false;
+        socket_id = rte_socket_id();
+    } else {
+        fprintf(stderr,
+                "Benchmarking IOAT device: ioat_dev_name = %s, numa_node = "
+                "%d\n",
+                dev_info.device->name, dev_info.device->numa_node);
+        socket_id = dev_info.socket_id;
+    }
+    for (k = 0; k < KERNEL_IOAT; k++) {
+        if (!cfg.kernels[k] || ioat_copy_kernel_supported(k)) continue;
+        fprintf(stderr, "CPU does not support the %s kernel, skipping it\n",
+                ioat_copy_kernel_name(k));
+        cfg.kernels[k] = false;
+    }
+
+    // Buffers live on the NUMA node of the device
+    src_buf = alloc_buf("bench_src", socket_id, &src_iova);
+    dst_buf = alloc_buf("bench_dst", socket_id, &dst_iova);
+    for (size_t i = 0; i < cfg.wss; i++) src_buf[i] = rand() % 255;
+    memset(dst_buf, 0, cfg.wss);
+
+    lat_samples = rte_malloc("lat_samples",
+                             sizeof(*lat_samples) * MAX_LAT_SAMPLES, 0);
+    if (lat_samples == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate latency samples\n");
+
+    print_header();
+    if (cfg.kernel_mode) {
+        if (cfg.dev_id >= 0) configure_ring(cfg.dev_id, cfg.rings[0], false);
+        kernel_sweep();
+    }
+    for (r = 0; r < cfg.nb_rings && !cfg.kernel_mode; r++)
+        for (h = 0; h < RTE_DIM(cfg.hdls_modes); h++) {
+            if (!cfg.hdls_modes[h]) continue;
+            configure_ring(cfg.dev_id, cfg.rings[r], h == 1);
+            for (n = 1; n < nb_bench_devs; n++)
+                configure_ring(bench_devs[n], cfg.rings[r], h == 1);
+            sweep(cfg.rings[r], h == 1);
+        }
+
+    // Shutdown the devices
+    if (cfg.dev_id >= 0) rte_rawdev_stop(cfg.dev_id);
+    for (n = 1; n < nb_bench_devs; n++) rte_rawdev_stop(bench_devs[n]);
+    rte_free(lat_samples);
+
+    return 0;
+}
@@ -1,17 +1,233 @@
 // \ref https://doc.dpdk.org/guides-20.11/rawdevs/ioat.html
 // \ref
 // https://software.intel.com/content/www/us/en/develop/articles/memory-in-dpdk-part-2-deep-dive-into-iova.html
+//
+// Inventory of the IOAT channels of the host: for each one, its device, NUMA
+// node, IOMMU group, accepted ring sizes, whether fills work, its self test,
+// and the bandwidth and latency of a short copy probe. With -o, the inventory
+// is saved as a placement map (see ioat_placement.h), from which ioat_fwd and
+// ioat_bench pick their channels.
 
-#include <assert.h>
+#include <errno.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "ioat_dev.h"
+#include "ioat_placement.h"
+#include "rte_cycles.h"
 #include "rte_ethdev.h"  // Not include this header will cause BUGs
 #include "rte_ioat_rawdev.h"
+#include "rte_memzone.h"
 #include "rte_rawdev.h"
 
-int main(int argc, char* argv[]) {
+#define PROBE_RING_SIZE 512
+#define PROBE_BATCH 32
+#define PROBE_COPY_SIZE (64 * 1024)
+#define PROBE_WSS (4 * 1024 * 1024)
+#define PROBE_DURATION_MS 100
+#define PROBE_LAT_ROUNDS 101
+#define PROBE_FILL_SIZE 4096
+#define PROBE_FILL_PATTERN 0x0123456789abcdefULL
+#define PROBE_TIMEOUT_MS 1000
+
+static const char *map_file;
+static bool quick;
+
+static void usage(const char *prgname) {
+    printf(
+        "%s [EAL options] -- [-o FILE] [-q]\n"
+        "  -o FILE: save the inventory as a placement map for ioat_fwd "
+        "--placement and ioat_bench -P\n"
+        "  -q: skip the self tests and the fill, bandwidth and latency "
+        "probes\n",
+        prgname);
+}
+
+static int parse_args(int argc, char **argv) {
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:qh")) != -1) {
+        switch (opt) {
+            case 'o':
+                map_file = optarg;
+                break;
+            case 'q':
+                quick = true;
+                break;
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+    return 0;
+}
+
+// The IOMMU group of a PCI device, -1 if it has none (no IOMMU, or not PCI)
+static int iommu_group(const char *pci_name) {
+    char path[PATH_MAX], link[PATH_MAX];
+    ssize_t len;
+
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%s/iommu_group",
+             pci_name);
+    len = readlink(path, link, sizeof(link) - 1);
+    if (len < 0) return -1;
+    link[len] = '\0';
+    return atoi(basename(link));
+}
+
+// The smallest and largest ring sizes the channel accepts, among the powers
+// of two up to 64K. Leaves the channel configured with the last one accepted.
+static void probe_ring_limits(int dev_id, unsigned int *min,
+                              unsigned int *max) {
+    struct rte_ioat_rawdev_config p;
+    struct rte_rawdev_info info = {.dev_private = &p};
+    unsigned int size;
+
+    *min = *max = 0;
+    for (size = 1; size <= UINT16_MAX; size <<= 1) {
+        p.ring_size = size;
+        p.hdls_disable = false;
+        if (rte_rawdev_configure(dev_id, &info, sizeof(p)) != 0) continue;
+        if (*min == 0) *min = size;
+        *max = size;
+    }
+}
+
+static int configure(int dev_id, unsigned short ring_size) {
+    struct rte_ioat_rawdev_config p = {.ring_size = ring_size};
+    struct rte_rawdev_info info = {.dev_private = &p};
+
+    if (rte_rawdev_configure(dev_id, &info, sizeof(p)) != 0) return -1;
+    return rte_rawdev_start(dev_id);
+}
+
+// Wait for n ops, for at most PROBE_TIMEOUT_MS
+static int wait_completed(int dev_id, unsigned int n) {
+    const uint64_t end =
+        rte_rdtsc() + rte_get_tsc_hz() * PROBE_TIMEOUT_MS / 1000;
+    uintptr_t hdls[2][PROBE_BATCH];
+    unsigned int nb_done = 0;
+    int ret;
+
+    while (nb_done < n) {
+        ret = ioat_dev_completed_ops(dev_id, PROBE_BATCH, hdls[0], hdls[1]);
+        if (ret < 0) return ret;
+        nb_done += ret;
+        if (nb_done < n && rte_rdtsc() > end) return -ETIMEDOUT;
+    }
+    return 0;
+}
+
+// Copy bandwidth in GB/s, with batches of PROBE_BATCH copies of
+// PROBE_COPY_SIZE bytes kept in flight for PROBE_DURATION_MS
+static double probe_bandwidth(int dev_id, rte_iova_t src, rte_iova_t dst) {
+    const unsigned int nb_slots = PROBE_WSS / PROBE_COPY_SIZE;
+    const uint64_t tsc_hz = rte_get_tsc_hz();
+    uintptr_t hdls[2][PROBE_BATCH];
+    uint64_t nb_started = 0, nb_done = 0, start, end;
+    unsigned int b;
+    int ret;
+
+    start = rte_rdtsc();
+    end = start + tsc_hz * PROBE_DURATION_MS / 1000;
+    while (rte_rdtsc() < end) {
+        for (b = 0; b < PROBE_BATCH &&
+                    nb_started - nb_done < PROBE_RING_SIZE - 1;
+             b++, nb_started++) {
+            const size_t off = (nb_started % nb_slots) * PROBE_COPY_SIZE;
+
+            if (ioat_dev_enqueue_copy(dev_id, src + off, dst + off,
+                                      PROBE_COPY_SIZE, 0, 0) != 1)
+                break;
+        }
+        if (b > 0) ioat_dev_perform_ops(dev_id);
+
+        ret = ioat_dev_completed_ops(dev_id, PROBE_BATCH, hdls[0], hdls[1]);
+        if (ret < 0) return 0;
+        nb_done += ret;
+    }
+    if (wait_completed(dev_id, nb_started - nb_done) < 0) return 0;
+    return (double)nb_started * PROBE_COPY_SIZE /
+           ((double)(rte_rdtsc() - start) / tsc_hz) / 1e9;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Median latency in ns of single 64-byte copies, from doorbell to completion
+static double probe_latency(int dev_id, rte_iova_t src, rte_iova_t dst) {
+    uint64_t lat[PROBE_LAT_ROUNDS], t0;
+    unsigned int r;
+
+    for (r = 0; r < PROBE_LAT_ROUNDS; r++) {
+        if (ioat_dev_enqueue_copy(dev_id, src, dst, 64, 0, 0) != 1) return 0;
+        t0 = rte_rdtsc();
+        ioat_dev_perform_ops(dev_id);
+        if (wait_completed(dev_id, 1) < 0) return 0;
+        lat[r] = rte_rdtsc() - t0;
+    }
+    qsort(lat, PROBE_LAT_ROUNDS, sizeof(lat[0]), cmp_u64);
+    return lat[PROBE_LAT_ROUNDS / 2] * 1e9 / rte_get_tsc_hz();
+}
+
+// Whether a fill completes and writes its pattern. Run last: a channel
+// without fill support may halt on the descriptor.
+static bool probe_fill(int dev_id, uint64_t *dst, rte_iova_t dst_iova) {
+    unsigned int i;
+
+    memset(dst, 0, PROBE_FILL_SIZE);
+    if (ioat_dev_enqueue_fill(dev_id, PROBE_FILL_PATTERN, dst_iova,
+                              PROBE_FILL_SIZE, 0) != 1)
+        return false;
+    ioat_dev_perform_ops(dev_id);
+    if (wait_completed(dev_id, 1) < 0) return false;
+    for (i = 0; i < PROBE_FILL_SIZE / sizeof(*dst); i++)
+        if (dst[i] != PROBE_FILL_PATTERN) return false;
+    return true;
+}
+
+// Fill, bandwidth and latency probes, with buffers on the channel's socket
+static int probe(int dev_id, int socket_id, struct ioat_placement_channel *c) {
+    const struct rte_memzone *src_mz, *dst_mz;
+    int ret = -1;
+
+    src_mz = rte_memzone_reserve_aligned("probe_src", PROBE_WSS, socket_id,
+                                         RTE_MEMZONE_IOVA_CONTIG, 4096);
+    dst_mz = rte_memzone_reserve_aligned("probe_dst", PROBE_WSS, socket_id,
+                                         RTE_MEMZONE_IOVA_CONTIG, 4096);
+    if (src_mz == NULL || dst_mz == NULL) {
+        printf("  Cannot reserve the probe buffers on socket %d\n",
+               socket_id);
+        goto out;
+    }
+    memset(src_mz->addr, 0xa5, PROBE_WSS);
+    if (configure(dev_id, PROBE_RING_SIZE) != 0) {
+        printf("  Cannot start the channel\n");
+        goto out;
+    }
+
+    c->copy_gbps = probe_bandwidth(dev_id, src_mz->iova, dst_mz->iova);
+    c->lat_ns = probe_latency(dev_id, src_mz->iova, dst_mz->iova);
+    c->fill = probe_fill(dev_id, dst_mz->addr, dst_mz->iova);
+    rte_rawdev_stop(dev_id);
+    ret = 0;
+
+out:
+    rte_memzone_free(src_mz);
+    rte_memzone_free(dst_mz);
+    return ret;
+}
+
+int main(int argc, char *argv[]) {
+    static struct ioat_placement map;
     int ret;
 
     // Init the EAL
@@ -19,27 +235,86 @@ int main(int argc, char* argv[]) {
     if (ret < 0) rte_exit(EXIT_FAILURE, "Invalid EAL arguments\n");
     argc -= ret;
     argv += ret;
+    if (parse_args(argc, argv) < 0)
+        rte_exit(EXIT_FAILURE, "Invalid arguments\n");
 
     // Count all the raw devices
     int num_rawdev = rte_rawdev_count();
     printf("Found %d raw devices\n", num_rawdev);
 
-    // Test all the found IOAT devices
+    // Inventory all the IOAT channels, skipping the other rawdevs
     int dev_id;
     for (dev_id = 0; dev_id < num_rawdev; dev_id++) {
         struct rte_rawdev_info dev_info = {.dev_private = NULL};
-        if (rte_rawdev_info_get(dev_id, &dev_info, 0) == 0 &&
-            strcmp(dev_info.driver_name, IOAT_PMD_RAWDEV_NAME_STR) == 0) {
+        if (rte_rawdev_info_get(dev_id, &dev_info, 0) != 0) continue;
+        if (!ioat_dev_driver_supported(dev_info.driver_name)) {
+            printf("Skipping rawdev %d (%s): driver %s\n", dev_id,
+                   dev_info.device->name, dev_info.driver_name);
+            continue;
+        }
+        if (map.nb_channels == IOAT_PLACEMENT_MAX_CHANNELS) {
+            printf("Skipping rawdev %d: more than %d channels\n", dev_id,
+                   IOAT_PLACEMENT_MAX_CHANNELS);
+            continue;
         }
-        printf("IOAT device found: ioat_dev_name = %s, numa_node = %d\n",
-               dev_info.device->name, dev_info.device->numa_node);
 
-        if (rte_rawdev_selftest(dev_id) == 0) {
-            printf("Self test passed!\n");
-        } else {
-            printf("Self test failed!\n");
+        struct ioat_placement_channel *c = &map.channels[map.nb_channels++];
+        const bool sw = ioat_sw_devs[dev_id] != NULL;
+
+        snprintf(c->name, sizeof(c->name), "%s", dev_info.device->name);
+        snprintf(c->bus, sizeof(c->bus), "%s", sw ? "vdev" : "pci");
+        c->numa_node = dev_info.device->numa_node;
+        c->iommu_group = sw ? -1 : iommu_group(c->name);
+        printf("IOAT device found: ioat_dev_name = %s, numa_node = %d, "
+               "iommu_group = %d\n",
+               c->name, c->numa_node, c->iommu_group);
+
+        probe_ring_limits(dev_id, &c->ring_min, &c->ring_max);
+        printf("  Ring sizes: %u to %u\n", c->ring_min, c->ring_max);
+        if (quick) continue;
+
+        c->selftest = rte_rawdev_selftest(dev_id) == 0;
+        printf("  Self test %s\n", c->selftest ? "passed" : "failed");
+        if (!c->selftest) continue;
+        if (probe(dev_id, c->numa_node < 0 ? SOCKET_ID_ANY : c->numa_node,
+                  c) == 0)
+            printf("  Copies of %u KB: %.3f GB/s, 64 B latency: %.0f ns, "
+                   "fill %s\n",
+                   PROBE_COPY_SIZE / 1024, c->copy_gbps, c->lat_ns,
+                   c->fill ? "supported" : "not supported");
+    }
+
+    if (map.nb_channels > 0) {
+        unsigned int i;
+
+        printf("\n%-16s %-4s %4s %6s %11s %4s %8s %8s %8s\n", "channel",
+               "bus", "numa", "iommu", "ring", "fill", "selftest", "GB/s",
+               "lat(ns)");
+        for (i = 0; i < map.nb_channels; i++) {
+            const struct ioat_placement_channel *c = &map.channels[i];
+            char ring[16];
+
+            snprintf(ring, sizeof(ring), "%u-%u", c->ring_min, c->ring_max);
+            printf("%-16s %-4s %4d %6d %11s %4s %8s %8.3f %8.0f\n", c->name,
+                   c->bus, c->numa_node, c->iommu_group, ring,
+                   quick ? "-" : c->fill ? "yes" : "no",
+                   quick ? "-" : c->selftest ? "passed" : "failed",
+                   c->copy_gbps, c->lat_ns);
         }
     }
 
+    if (map_file != NULL) {
+        if (quick)
+            printf("\nWarning: -q leaves every channel of %s untested, "
+                   "so none will be picked\n",
+                   map_file);
+        ret = ioat_placement_save(map_file, &map);
+        if (ret < 0)
+            rte_exit(EXIT_FAILURE, "Cannot write %s: %s\n", map_file,
+                     strerror(-ret));
+        printf("\nPlacement map of %u channels saved to %s\n",
+               map.nb_channels, map_file);
+    }
+
     return 0;
-}
\ No newline at end of file
+}
@@ -2,16 +2,26 @@
  * Copyright(c) 2019 Intel Corporation
  */
 
+#include <ctype.h>
 #include <getopt.h>
+#include <rte_cpuflags.h>
 #include <rte_ethdev.h>
 #include <rte_ioat_rawdev.h>
 #include <rte_malloc.h>
+#include <rte_power_intrinsics.h>
 #include <rte_rawdev.h>
+#include <rte_telemetry.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "ioat_copy.h"
+#include "ioat_dev.h"
+#include "ioat_hist.h"
+#include "ioat_placement.h"
+
 /* size of ring used for software copying between rx and tx. */
 #define RTE_LOGTYPE_IOAT RTE_LOGTYPE_USER1
 #define MAX_PKT_BURST 32
@@ -23,6 +33,24 @@
 #define CMD_LINE_OPT_NB_QUEUE "nb-queue"
 #define CMD_LINE_OPT_COPY_TYPE "copy-type"
 #define CMD_LINE_OPT_RING_SIZE "ring-size"
+#define CMD_LINE_OPT_COPY_THRESHOLD "copy-threshold"
+#define CMD_LINE_OPT_NO_HANDLES "no-handles"
+#define CMD_LINE_OPT_RUN_TO_COMPLETION "run-to-completion"
+#define CMD_LINE_OPT_NUMA_STRICT "numa-strict"
+#define CMD_LINE_OPT_STAGING_SIZE "staging-size"
+#define CMD_LINE_OPT_HEADER_SPLIT "header-split"
+#define CMD_LINE_OPT_LATENCY "latency"
+#define CMD_LINE_OPT_STATS_INTERVAL "stats-interval"
+#define CMD_LINE_OPT_STATS_FORMAT "stats-format"
+#define CMD_LINE_OPT_HEADLESS "headless"
+#define CMD_LINE_OPT_DOORBELL_BATCH "doorbell-batch"
+#define CMD_LINE_OPT_DOORBELL_DEADLINE "doorbell-deadline"
+#define CMD_LINE_OPT_IDLE_BACKOFF "idle-backoff"
+#define CMD_LINE_OPT_NT_THRESHOLD "nt-threshold"
+#define CMD_LINE_OPT_QUEUE_WEIGHTS "queue-weights"
+#define CMD_LINE_OPT_TX_BUDGET "tx-budget"
+#define CMD_LINE_OPT_MAX_PKT_LEN "max-pkt-len"
+#define CMD_LINE_OPT_PLACEMENT "placement"
 
 /* configurable number of RX/TX ring descriptors */
 #define RX_DEFAULT_RINGSIZE 1024
@@ -31,30 +59,221 @@
 /* max number of RX queues per port */
 #define MAX_RX_QUEUES_COUNT 8
 
+/* staging queue indexes are 16-bit and free running */
+#define MAX_STAGING_SIZE 32768
+
+/* max number of (port, RX queue) pairs served by one worker */
+#define MAX_WORKER_QUEUES (RTE_MAX_ETHPORTS * MAX_RX_QUEUES_COUNT)
+
+/* max number of segments of a received packet, the longest jumbo frame in
+ * default size mbufs
+ */
+#define MAX_PKT_SEGS \
+    ((RTE_ETHER_MAX_JUMBO_FRAME_LEN + RTE_MBUF_DEFAULT_DATAROOM - 1) / \
+     RTE_MBUF_DEFAULT_DATAROOM)
+
+/* Mbufs in flight on an IOAT rawdev configured without handles, in the order
+ * of their descriptors: the n completions reported by the rawdev are the n
+ * oldest entries. The descriptors of the segments of chained packets but the
+ * last have entries without mbufs. Written by the RX side at head, read by
+ * the TX side at tail, both indexes free running like those of the rawdev
+ * ring.
+ */
+struct ioat_mbuf_ring {
+    unsigned short head;
+    unsigned short tail;
+    unsigned short mask;
+    struct rte_mbuf **srcs;
+    struct rte_mbuf **dsts;
+} __rte_cache_aligned;
+
+/* Received packets waiting for room in the IOAT rawdev ring, or for mbufs to
+ * copy to, oldest first. Only used by the RX side of the queue.
+ */
+struct ioat_staging {
+    unsigned short head;
+    unsigned short tail;
+    unsigned short mask;
+    unsigned short size; /* 0 if staging is disabled */
+    unsigned short max_occupancy;
+    struct rte_mbuf **pkts;
+} __rte_cache_aligned;
+
+/* Doorbell coalescing of an IOAT rawdev: copies enqueued since the last
+ * doorbell are only submitted once there are threshold of them, or once the
+ * oldest has waited for the deadline. The threshold follows the number of
+ * copies enqueued per deadline window, so that the doorbell is only held
+ * back when more copies are expected to share it before the deadline. Only
+ * used by the RX side of the queue.
+ */
+struct ioat_doorbell {
+    uint16_t pending;       /* copies enqueued, not submitted yet */
+    uint16_t threshold;
+    uint32_t ewma;          /* copies per window, in 1/16ths */
+    uint32_t window_count;  /* copies enqueued in the current window */
+    uint64_t window_start;
+    uint64_t first_tsc;     /* TSC of the oldest pending copy */
+} __rte_cache_aligned;
+
 struct rxtx_port_config {
     /* common config */
     uint16_t rxtx_port;
     uint16_t nb_queues;
-    /* for software copy mode */
-    struct rte_ring *rx_to_tx_ring;
+    /* NUMA node of the port, and the mbuf pool of that node */
+    int socket_id;
+    struct rte_mempool *pktmbuf_pool;
+    /* worker serving each RX queue */
+    uint16_t worker_ids[MAX_RX_QUEUES_COUNT];
+    /* one TX queue per worker transmitting on the port, by RX queue */
+    uint16_t nb_tx_queues;
+    uint16_t tx_queue_ids[MAX_RX_QUEUES_COUNT];
+    /* for software and hybrid copy modes */
+    struct rte_ring *rx_to_tx_rings[MAX_RX_QUEUES_COUNT];
     /* for IOAT rawdev copy mode */
     uint16_t ioat_ids[MAX_RX_QUEUES_COUNT];
+    /* for IOAT rawdev copy mode without handles */
+    struct ioat_mbuf_ring mbuf_rings[MAX_RX_QUEUES_COUNT];
+    /* for IOAT rawdev and hybrid copy modes */
+    struct ioat_staging stagings[MAX_RX_QUEUES_COUNT];
+    struct ioat_doorbell doorbells[MAX_RX_QUEUES_COUNT];
+};
+
+/* Counters of one RX queue and its IOAT channel. The RX and the TX lcores of
+ * the queue each have their copy, where they only update their own fields,
+ * and the stats reader adds them up.
+ */
+struct ioat_queue_statistics {
+    uint64_t rx;
+    uint64_t tx;
+    uint64_t tx_dropped;
+    uint64_t copy_dropped;
+    uint64_t copy_sw;
+    uint64_t copy_hw;      /* copies enqueued to the IOAT channel */
+    uint64_t copy_hw_done; /* copies completed by the IOAT channel */
+    uint64_t staged;
+    uint64_t staging_overflow;
+    uint64_t doorbells;
+    uint64_t doorbell_deadlines; /* doorbells rung by the deadline */
+    uint64_t doorbell_wait;      /* TSC cycles the oldest copies waited */
+    uint64_t tx_polls;      /* polls for completed copies */
+    uint64_t tx_full_polls; /* polls that got all they asked for */
+    uint64_t tx_starved;    /* TX rounds whose budget ran out before it */
+};
+
+/* Names of the counters of struct ioat_queue_statistics, in order, as they
+ * are exported in JSON, CSV and telemetry
+ */
+static const char *const queue_stats_names[] = {
+    "rx", "tx", "tx_dropped", "copy_dropped", "copy_sw", "copy_hw",
+    "copy_hw_done", "staged", "staging_overflow", "doorbells",
+    "doorbell_deadlines", "doorbell_wait_cycles", "tx_polls", "tx_full_polls",
+    "tx_starved"};
+
+/* Latency stages of a packet, all measured when it is sent */
+enum latency_stage {
+    LATENCY_RX_TO_COPY,   /* RX to the copy being enqueued, or done by CPU */
+    LATENCY_COPY,         /* IOAT copy enqueued to seen completed */
+    LATENCY_COPY_TO_TX,   /* copy completed to TX */
+    LATENCY_RX_TO_TX,     /* end to end */
+    LATENCY_NB_STAGES
+};
+
+static const char *const latency_stage_names[LATENCY_NB_STAGES] = {
+    "rx_to_copy", "copy", "copy_to_tx", "rx_to_tx"};
+
+/* Latency percentiles reported for each stage, along with the max */
+static const double latency_percentiles[] = {0.5, 0.99, 0.999};
+static const char *const latency_percentile_names[] = {"p50", "p99", "p999"};
+
+/* Timestamps of a packet, in an mbuf dynamic field. An IOAT copy of a whole
+ * packet copies them along with the rest of the mbuf.
+ */
+struct latency_ts {
+    uint64_t rx;   /* TSC at RX */
+    uint32_t copy; /* TSC cycles from RX to its copy */
+};
+
+/* States of a worker lcore, from busy to more and more idle ones, which it
+ * backs off through as its polls keep coming back empty
+ */
+enum idle_state {
+    IDLE_BUSY,   /* the last poll found work */
+    IDLE_SPIN,   /* empty polls, at full speed */
+    IDLE_PAUSE,  /* empty polls, with a pause instruction in between */
+    IDLE_TPAUSE, /* empty polls, with a timed pause in a light C-state */
+    IDLE_SLEEP,  /* empty polls, with a sleep in between */
+    IDLE_NB_STATES
+};
+
+static const char *const idle_state_names[IDLE_NB_STATES] = {
+    "busy", "spin", "pause", "tpause", "sleep"};
+
+/* Time an lcore spent in each state, in TSC cycles */
+struct ioat_idle_statistics {
+    uint64_t cycles[IDLE_NB_STATES];
+};
+
+/* Idle time after which an lcore backs off to each state, and how long it
+ * waits in the waiting ones
+ */
+#define IDLE_PAUSE_US 10
+#define IDLE_TPAUSE_US 100
+#define IDLE_SLEEP_US 1000
+#define IDLE_TPAUSE_LEN_US 10
+#define IDLE_SLEEP_LEN_US 50
+
+/* Idle backoff of one lcore */
+struct idle_backoff {
+    uint64_t last_busy_tsc;
+    uint64_t prev_tsc;
+    struct ioat_idle_statistics *stats;
+};
+
+/* Weighted deficit round robin over the completions of the queues of a TX
+ * lcore. Each round, a queue may drain its weight in bursts of completions
+ * more, as long as the budget of the round lasts. The queues the budget does
+ * not reach count the round as starved, and start the next one.
+ */
+struct tx_sched {
+    uint16_t first; /* queue polled first in the next round */
+    int32_t quantum[MAX_WORKER_QUEUES];
+    int32_t deficit[MAX_WORKER_QUEUES];
+};
+
+/* One RX queue of a port, with its rawdev and ring */
+struct worker_queue {
+    struct rxtx_port_config *port;
+    uint16_t queue_id;
+};
+
+/* A worker is either a pair of RX and TX lcores, or a single lcore doing
+ * both, which owns its queues, rawdevs and rings: no other worker uses them.
+ */
+struct worker_config {
+    uint32_t rx_lcore;
+    uint32_t tx_lcore; /* same as rx_lcore for run-to-completion */
+    uint16_t nb_queues;
+    struct worker_queue queues[MAX_WORKER_QUEUES];
+    /* counters of each queue, allocated on the node of each lcore, in cache
+     * lines no other lcore writes to
+     */
+    struct ioat_queue_statistics *rx_stats;
+    struct ioat_queue_statistics *tx_stats; /* rx_stats if run-to-completion */
+    /* latencies of the packets sent by the TX lcore, on its node */
+    struct ioat_hist *latency;
+    /* time of each lcore in each idle state, on its node */
+    struct ioat_idle_statistics *rx_idle;
+    struct ioat_idle_statistics *tx_idle; /* rx_idle if run-to-completion */
 };
 
 struct rxtx_transmission_config {
     struct rxtx_port_config ports[RTE_MAX_ETHPORTS];
     uint16_t nb_ports;
     uint16_t nb_lcores;
+    struct worker_config workers[RTE_MAX_LCORE];
+    uint16_t nb_workers;
 };
 
-/* per-port statistics struct */
-struct ioat_port_statistics {
-    uint64_t rx[RTE_MAX_ETHPORTS];
-    uint64_t tx[RTE_MAX_ETHPORTS];
-    uint64_t tx_dropped[RTE_MAX_ETHPORTS];
-    uint64_t copy_dropped[RTE_MAX_ETHPORTS];
-};
-struct ioat_port_statistics port_statistics;
 
 struct total_statistics {
     uint64_t total_packets_dropped;
@@ -62,6 +281,9 @@ struct total_statistics {
     uint64_t total_packets_rx;
     uint64_t total_successful_enqueues;
     uint64_t total_failed_enqueues;
+    uint64_t total_sw_copies;
+    uint64_t total_hw_copies;
+    uint64_t total_doorbells;
 };
 
 typedef enum copy_mode_t {
@@ -69,10 +291,28 @@ typedef enum copy_mode_t {
     COPY_MODE_SW_NUM,
 #define COPY_MODE_IOAT "hw"
     COPY_MODE_IOAT_NUM,
+/* CPU copy up to copy_threshold bytes, IOAT copy beyond */
+#define COPY_MODE_HYBRID "hybrid"
+/* hybrid with copy_threshold calibrated at startup */
+#define COPY_MODE_AUTO "auto"
+    COPY_MODE_HYBRID_NUM,
     COPY_MODE_INVALID_NUM,
     COPY_MODE_SIZE_NUM = COPY_MODE_INVALID_NUM
 } copy_mode_t;
 
+typedef enum stats_format_t {
+/* statistics screen */
+#define STATS_FORMAT_TEXT "text"
+    STATS_FORMAT_TEXT_NUM,
+/* one JSON object per line */
+#define STATS_FORMAT_JSON "json"
+    STATS_FORMAT_JSON_NUM,
+/* one CSV row per RX queue, after a header line */
+#define STATS_FORMAT_CSV "csv"
+    STATS_FORMAT_CSV_NUM,
+    STATS_FORMAT_INVALID_NUM
+} stats_format_t;
+
 /* mask of enabled ports */
 static uint32_t ioat_enabled_port_mask;
 
@@ -85,11 +325,95 @@ static int mac_updating = 1;
 /* hardare copy mode enabled by default. */
 static copy_mode_t copy_mode = COPY_MODE_IOAT_NUM;
 
+/* hybrid copy mode: packets up to this length are copied by the CPU */
+static uint32_t copy_threshold = 256;
+static bool calibrate_threshold;
+
+/* CPU copies of this many bytes and more bypass the caches with streaming
+ * stores, 0 to keep them all in cache
+ */
+static uint32_t nt_threshold = 1024;
+
+/* track IOAT copies in mbuf rings instead of rawdev handles */
+static int hdls_disable;
+
+/* workers do both RX and TX rather than running as RX/TX lcore pairs */
+static int run_to_completion;
+
+/* fail rather than warn when a rawdev or lcore is not local to its port */
+static int numa_strict;
+
+/* Report a rawdev or lcore on another NUMA node than the port it serves */
+#define NUMA_MISMATCH(...)                                    \
+    do {                                                      \
+        if (numa_strict) rte_exit(EXIT_FAILURE, __VA_ARGS__); \
+        RTE_LOG(WARNING, IOAT, __VA_ARGS__);                  \
+    } while (0)
+
+/* A resource with no NUMA affinity, eg a software rawdev, is local to all */
+static bool socket_local(int socket_id, int port_socket_id) {
+    return socket_id < 0 || socket_id == port_socket_id;
+}
+
 /* size of IOAT rawdev ring for hardware copy mode or
  * rte_ring for software copy mode
  */
 static unsigned short ring_size = 2048;
 
+/* packets kept per RX queue while its IOAT rawdev ring is full */
+static unsigned short staging_size = 1024;
+
+/* doorbell coalescing: most copies per doorbell, 1 to ring it for every
+ * burst, and longest wait of a copy for its doorbell
+ */
+static uint16_t doorbell_batch = MAX_PKT_BURST;
+static unsigned int doorbell_deadline_us = 5;
+static uint64_t doorbell_deadline_tsc;
+
+/* completion polling: bursts each RX queue may drain per TX round, by queue
+ * id, and most completions drained per round by a TX lcore, 0 for no limit
+ */
+#define MAX_QUEUE_WEIGHT 64
+static uint8_t queue_weights[MAX_RX_QUEUES_COUNT] = {
+    [0 ... MAX_RX_QUEUES_COUNT - 1] = 1};
+static bool queue_weights_set;
+static unsigned int tx_budget;
+
+/* header split: bytes of data copied, the rest is referenced, 0 if disabled */
+static uint16_t header_split_len;
+
+/* longest frame received, CRC included. Frames longer than an mbuf are
+ * received as chains of up to max_pkt_segs mbufs, and copied segment by
+ * segment.
+ */
+static uint32_t max_pkt_len = RTE_ETHER_MAX_LEN;
+static uint16_t max_pkt_segs = 1;
+
+/* placement map saved by ioat_devices, empty if not given */
+static struct ioat_placement placement;
+static const char *placement_file;
+
+/* timestamp packets and keep histograms of their latencies */
+static int latency_enabled;
+static int latency_ts_offset = -1;
+#define LATENCY_TS(m) \
+    RTE_MBUF_DYNFIELD(m, latency_ts_offset, struct latency_ts *)
+
+/* statistics output, every stats_interval_ms, in text without refreshing
+ * the screen if headless
+ */
+static unsigned int stats_interval_ms = 1000;
+static stats_format_t stats_format = STATS_FORMAT_TEXT_NUM;
+static int headless;
+
+/* back off through pause, timed pause and sleep when polls come back empty,
+ * timed pauses only if the CPU has WAITPKG
+ */
+static int idle_backoff_enabled;
+static bool idle_has_tpause;
+static uint64_t idle_pause_tsc, idle_tpause_tsc, idle_sleep_tsc,
+    idle_tpause_len_tsc;
+
 /* global transmission config */
 struct rxtx_transmission_config cfg;
 
@@ -102,31 +426,147 @@ static volatile bool force_quit;
 /* ethernet addresses of ports */
 static struct rte_ether_addr ioat_ports_eth_addr[RTE_MAX_ETHPORTS];
 
-static struct rte_eth_dev_tx_buffer *tx_buffer[RTE_MAX_ETHPORTS];
-struct rte_mempool *ioat_pktmbuf_pool;
+/* one mbuf pool per NUMA node with enabled ports */
+struct rte_mempool *ioat_pktmbuf_pools[RTE_MAX_NUMA_NODES];
+
+/* Counters have a single writer, which stores them atomically so that the
+ * stats reader never sees a torn value.
+ */
+static inline void stats_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+/* Add up the counters of every queue of a port, as kept by its RX and TX
+ * lcores. Safe from any thread.
+ */
+static void stats_snapshot_port(
+    const struct rxtx_port_config *port,
+    struct ioat_queue_statistics snap[MAX_RX_QUEUES_COUNT]) {
+    const unsigned int nb_counters =
+        sizeof(struct ioat_queue_statistics) / sizeof(uint64_t);
+    uint16_t w, i;
+    unsigned int c;
+
+    RTE_BUILD_BUG_ON(RTE_DIM(queue_stats_names) != nb_counters);
+
+    memset(snap, 0, sizeof(snap[0]) * MAX_RX_QUEUES_COUNT);
+    for (w = 0; w < cfg.nb_workers; w++) {
+        const struct worker_config *worker = &cfg.workers[w];
+
+        for (i = 0; i < worker->nb_queues; i++) {
+            if (worker->queues[i].port != port) continue;
+
+            uint64_t *dst = (uint64_t *)&snap[worker->queues[i].queue_id];
+            const uint64_t *rx = (const uint64_t *)&worker->rx_stats[i];
+            const uint64_t *tx = (const uint64_t *)&worker->tx_stats[i];
+
+            for (c = 0; c < nb_counters; c++) {
+                dst[c] = __atomic_load_n(&rx[c], __ATOMIC_RELAXED);
+                if (tx != rx)
+                    dst[c] += __atomic_load_n(&tx[c], __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+/* Add up the counters of the queues of a port. */
+static void stats_port_total(const struct ioat_queue_statistics *queues,
+                             uint16_t nb_queues,
+                             struct ioat_queue_statistics *total) {
+    const unsigned int nb_counters =
+        sizeof(struct ioat_queue_statistics) / sizeof(uint64_t);
+    uint16_t j;
+    unsigned int c;
+
+    memset(total, 0, sizeof(*total));
+    for (j = 0; j < nb_queues; j++)
+        for (c = 0; c < nb_counters; c++)
+            ((uint64_t *)total)[c] += ((const uint64_t *)&queues[j])[c];
+}
+
+/* Print out the staging statistics of the RX queues of one port. */
+static void print_staging_stats(const struct rxtx_port_config *port,
+                                const struct ioat_queue_statistics *total) {
+    unsigned int occupancy = 0, max_occupancy = 0;
+    uint16_t j;
+
+    for (j = 0; j < port->nb_queues; j++) {
+        const struct ioat_staging *staging = &port->stagings[j];
+
+        occupancy += (unsigned short)(staging->head - staging->tail);
+        max_occupancy = RTE_MAX(max_occupancy, staging->max_occupancy);
+    }
+
+    printf(
+        "\nPackets staged: %32u"
+        "\nPackets staged, queue peak: %20u"
+        "\nPackets dropped on staging: %20" PRIu64,
+        occupancy, max_occupancy, total->staging_overflow);
+}
 
 /* Print out statistics for one port. */
-static void print_port_stats(uint16_t port_id) {
+static void print_port_stats(uint16_t port_id,
+                             const struct ioat_queue_statistics *total) {
     printf(
         "\nStatistics for port %u ------------------------------"
         "\nPackets sent: %34" PRIu64 "\nPackets received: %30" PRIu64
         "\nPackets dropped on tx: %25" PRIu64
-        "\nPackets dropped on copy: %23" PRIu64,
-        port_id, port_statistics.tx[port_id], port_statistics.rx[port_id],
-        port_statistics.tx_dropped[port_id],
-        port_statistics.copy_dropped[port_id]);
+        "\nPackets dropped on copy: %23" PRIu64
+        "\nPackets copied by CPU: %25" PRIu64
+        "\nPackets copied by IOAT: %24" PRIu64,
+        port_id, total->tx, total->rx, total->tx_dropped, total->copy_dropped,
+        total->copy_sw, total->copy_hw);
+}
+
+/* Print out the packets of each RX queue of one port. */
+static void print_queue_stats(const struct rxtx_port_config *port,
+                              const struct ioat_queue_statistics *queues) {
+    uint16_t j;
+
+    for (j = 0; j < port->nb_queues; j++)
+        printf("\n\t queue %u: rx %" PRIu64 ", tx %" PRIu64
+               ", dropped %" PRIu64 ", full polls %.0f%%, starved %" PRIu64,
+               j, queues[j].rx, queues[j].tx,
+               queues[j].tx_dropped + queues[j].copy_dropped,
+               queues[j].tx_polls > 0
+                   ? 100.0 * queues[j].tx_full_polls / queues[j].tx_polls
+                   : 0,
+               queues[j].tx_starved);
 }
 
 /* Print out statistics for one IOAT rawdev device. */
 static void print_rawdev_stats(uint32_t dev_id, uint64_t *xstats,
                                unsigned int *ids_xstats, uint16_t nb_xstats,
-                               struct rte_rawdev_xstats_name *names_xstats) {
+                               struct rte_rawdev_xstats_name *names_xstats,
+                               const struct ioat_queue_statistics *queue) {
     uint16_t i;
 
     printf("\nIOAT channel %u", dev_id);
     for (i = 0; i < nb_xstats; i++)
         printf("\n\t %s: %*" PRIu64, names_xstats[ids_xstats[i]].name,
                (int)(37 - strlen(names_xstats[ids_xstats[i]].name)), xstats[i]);
+    printf("\n\t packets copied: %*" PRIu64 "\n\t packets in flight: %*" PRIu64
+           "\n\t packets staged: %*" PRIu64,
+           (int)(37 - strlen("packets copied")), queue->copy_hw_done,
+           (int)(37 - strlen("packets in flight")),
+           /* read after copy_hw, which may be behind */
+           queue->copy_hw > queue->copy_hw_done
+               ? queue->copy_hw - queue->copy_hw_done
+               : 0,
+           (int)(37 - strlen("packets staged")), queue->staged);
+    /* MMIO writes saved by coalescing, against the latency it adds */
+    printf("\n\t doorbells: %*" PRIu64 "\n\t doorbells by deadline: %*" PRIu64
+           "\n\t copies per doorbell: %*.1f"
+           "\n\t doorbell wait, avg [ns]: %*.0f",
+           (int)(37 - strlen("doorbells")), queue->doorbells,
+           (int)(37 - strlen("doorbells by deadline")),
+           queue->doorbell_deadlines,
+           (int)(37 - strlen("copies per doorbell")),
+           queue->doorbells > 0 ? (double)queue->copy_hw / queue->doorbells : 0,
+           (int)(37 - strlen("doorbell wait, avg [ns]")),
+           queue->doorbells > 0 ? queue->doorbell_wait * 1E9 /
+                                      rte_get_tsc_hz() / queue->doorbells
+                                : 0);
 }
 
 static void print_total_stats(struct total_statistics *ts) {
@@ -139,24 +579,282 @@ static void print_total_stats(struct total_statistics *ts) {
         "\nTotal packets dropped: %19" PRIu64 " [pps]",
         ts->total_packets_tx, ts->total_packets_rx, ts->total_packets_dropped);
 
-    if (copy_mode == COPY_MODE_IOAT_NUM) {
+    if (copy_mode == COPY_MODE_HYBRID_NUM) {
+        printf("\nTotal CPU copies: %22" PRIu64
+               " [pps]"
+               "\nTotal IOAT copies: %21" PRIu64 " [pps]",
+               ts->total_sw_copies, ts->total_hw_copies);
+    }
+
+    if (copy_mode != COPY_MODE_SW_NUM) {
         printf("\nTotal IOAT successful enqueues: %8" PRIu64
                " [enq/s]"
-               "\nTotal IOAT failed enqueues: %12" PRIu64 " [enq/s]",
-               ts->total_successful_enqueues, ts->total_failed_enqueues);
+               "\nTotal IOAT failed enqueues: %12" PRIu64
+               " [enq/s]"
+               "\nTotal IOAT doorbells: %18" PRIu64 " [MMIO/s]",
+               ts->total_successful_enqueues, ts->total_failed_enqueues,
+               ts->total_doorbells);
     }
 
     printf("\n====================================================\n");
 }
 
-/* Print out statistics on packets dropped. */
+/* Percentiles and max of the latency of each stage in ns, over the packets
+ * sent since startup. Safe from any thread.
+ */
+static void latency_snapshot(
+    double ns[LATENCY_NB_STAGES][RTE_DIM(latency_percentiles) + 1]) {
+    const double ns_per_cycle = 1E9 / rte_get_tsc_hz();
+    struct ioat_hist merged;
+    unsigned int s, p;
+    uint16_t w;
+
+    for (s = 0; s < LATENCY_NB_STAGES; s++) {
+        memset(&merged, 0, sizeof(merged));
+        for (w = 0; w < cfg.nb_workers; w++)
+            ioat_hist_merge(&merged, &cfg.workers[w].latency[s]);
+
+        for (p = 0; p < RTE_DIM(latency_percentiles); p++)
+            ns[s][p] = ioat_hist_percentile(&merged, latency_percentiles[p]) *
+                       ns_per_cycle;
+        ns[s][p] = merged.max * ns_per_cycle;
+    }
+}
+
+/* Idle statistics of the worker lcore of the given index, counting RX and TX
+ * lcores apart unless run-to-completion. Returns NULL past the last one.
+ */
+static const struct ioat_idle_statistics *idle_stats_lcore(unsigned int idx,
+                                                           uint32_t *lcore_id) {
+    const unsigned int per_worker = run_to_completion ? 1 : 2;
+    const struct worker_config *worker;
+
+    if (idx >= (unsigned int)cfg.nb_workers * per_worker) return NULL;
+    worker = &cfg.workers[idx / per_worker];
+    if (idx % per_worker == 0) {
+        *lcore_id = worker->rx_lcore;
+        return worker->rx_idle;
+    }
+    *lcore_id = worker->tx_lcore;
+    return worker->tx_idle;
+}
+
+static void idle_snapshot(const struct ioat_idle_statistics *stats,
+                          uint64_t cycles[IDLE_NB_STATES]) {
+    unsigned int s;
+
+    for (s = 0; s < IDLE_NB_STATES; s++)
+        cycles[s] = __atomic_load_n(&stats->cycles[s], __ATOMIC_RELAXED);
+}
+
+/* Print the share of time each worker lcore spent in each idle state since
+ * the previous call.
+ */
+static void print_idle_stats(void) {
+    static uint64_t prev[RTE_MAX_LCORE][IDLE_NB_STATES];
+    const struct ioat_idle_statistics *stats;
+    uint64_t cycles[IDLE_NB_STATES], total;
+    uint32_t lcore_id;
+    unsigned int idx, s;
+
+    printf("\nLcore time [%%] ----");
+    for (s = 0; s < IDLE_NB_STATES; s++) printf(" %7s", idle_state_names[s]);
+    for (idx = 0; (stats = idle_stats_lcore(idx, &lcore_id)) != NULL; idx++) {
+        idle_snapshot(stats, cycles);
+        total = 0;
+        for (s = 0; s < IDLE_NB_STATES; s++) {
+            cycles[s] -= prev[lcore_id][s];
+            prev[lcore_id][s] += cycles[s];
+            total += cycles[s];
+        }
+        printf("\nlcore %-13u", lcore_id);
+        for (s = 0; s < IDLE_NB_STATES; s++)
+            printf(" %7.1f", total > 0 ? 100.0 * cycles[s] / total : 0);
+    }
+}
+
+/* Print the percentiles of the latency of each stage. */
+static void print_latency_stats(void) {
+    double ns[LATENCY_NB_STAGES][RTE_DIM(latency_percentiles) + 1];
+    unsigned int s, p;
+
+    latency_snapshot(ns);
+    printf("\nLatency [ns] -----");
+    for (p = 0; p < RTE_DIM(latency_percentile_names); p++)
+        printf(" %10s", latency_percentile_names[p]);
+    printf(" %10s", "max");
+    for (s = 0; s < LATENCY_NB_STAGES; s++) {
+        if (s == LATENCY_COPY && copy_mode == COPY_MODE_SW_NUM) continue;
+        printf("\n%-18s", latency_stage_names[s]);
+        for (p = 0; p <= RTE_DIM(latency_percentiles); p++)
+            printf(" %10.0f", ns[s][p]);
+    }
+}
+
+/* Print the counters of a port or queue as JSON members. */
+static void print_counters_json(const struct ioat_queue_statistics *stats) {
+    const uint64_t *counters = (const uint64_t *)stats;
+    unsigned int c;
+
+    for (c = 0; c < RTE_DIM(queue_stats_names); c++)
+        printf("%s\"%s\":%" PRIu64, c > 0 ? "," : "", queue_stats_names[c],
+               counters[c]);
+}
+
+/* Print one line of JSON with the counters of every port, RX queue and IOAT
+ * channel since startup, and the latencies if enabled.
+ */
+static void print_json_stats(unsigned int *ids_xstats) {
+    double ns[LATENCY_NB_STAGES][RTE_DIM(latency_percentiles) + 1];
+    struct ioat_queue_statistics queues[MAX_RX_QUEUES_COUNT], total;
+    uint64_t xstats[2];
+    struct timespec now;
+    unsigned int s, p;
+    uint16_t i, j;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    printf("{\"time\":%ld.%03ld,\"ports\":[", (long)now.tv_sec,
+           now.tv_nsec / 1000000);
+    for (i = 0; i < cfg.nb_ports; i++) {
+        const struct rxtx_port_config *port = &cfg.ports[i];
+
+        stats_snapshot_port(port, queues);
+        stats_port_total(queues, port->nb_queues, &total);
+        printf("%s{\"port\":%u,", i > 0 ? "," : "", port->rxtx_port);
+        print_counters_json(&total);
+        printf(",\"queues\":[");
+        for (j = 0; j < port->nb_queues; j++) {
+            printf("%s{\"queue\":%u,", j > 0 ? "," : "", j);
+            print_counters_json(&queues[j]);
+            if (copy_mode != COPY_MODE_SW_NUM) {
+                rte_rawdev_xstats_get(port->ioat_ids[j], ids_xstats, xstats,
+                                      2);
+                printf(",\"channel\":{\"dev_id\":%u,"
+                       "\"failed_enqueues\":%" PRIu64
+                       ",\"successful_enqueues\":%" PRIu64 "}",
+                       port->ioat_ids[j], xstats[0], xstats[1]);
+            }
+            printf("}");
+        }
+        printf("]}");
+    }
+    printf("]");
+
+    if (latency_enabled) {
+        latency_snapshot(ns);
+        printf(",\"latency_ns\":{");
+        for (s = 0; s < LATENCY_NB_STAGES; s++) {
+            printf("%s\"%s\":{", s > 0 ? "," : "", latency_stage_names[s]);
+            for (p = 0; p < RTE_DIM(latency_percentiles); p++)
+                printf("\"%s\":%.0f,", latency_percentile_names[p], ns[s][p]);
+            printf("\"max\":%.0f}", ns[s][p]);
+        }
+        printf("}");
+    }
+
+    if (idle_backoff_enabled) {
+        const struct ioat_idle_statistics *stats;
+        uint64_t cycles[IDLE_NB_STATES];
+        uint32_t lcore_id;
+        unsigned int idx;
+
+        printf(",\"lcores\":[");
+        for (idx = 0; (stats = idle_stats_lcore(idx, &lcore_id)) != NULL;
+             idx++) {
+            idle_snapshot(stats, cycles);
+            printf("%s{\"lcore\":%u", idx > 0 ? "," : "", lcore_id);
+            for (s = 0; s < IDLE_NB_STATES; s++)
+                printf(",\"%s_cycles\":%" PRIu64, idle_state_names[s],
+                       cycles[s]);
+            printf("}");
+        }
+        printf("]");
+    }
+    printf("}\n");
+}
+
+/* Print one CSV row per RX queue with its counters since startup and those of
+ * its IOAT channel, after a header line the first time.
+ */
+static void print_csv_stats(unsigned int *ids_xstats) {
+    static bool header_printed;
+    struct ioat_queue_statistics queues[MAX_RX_QUEUES_COUNT];
+    uint64_t xstats[2];
+    struct timespec now;
+    unsigned int c;
+    uint16_t i, j;
+
+    if (!header_printed) {
+        printf("time,port,queue");
+        for (c = 0; c < RTE_DIM(queue_stats_names); c++)
+            printf(",%s", queue_stats_names[c]);
+        printf(",dev_id,failed_enqueues,successful_enqueues\n");
+        header_printed = true;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (i = 0; i < cfg.nb_ports; i++) {
+        const struct rxtx_port_config *port = &cfg.ports[i];
+
+        stats_snapshot_port(port, queues);
+        for (j = 0; j < port->nb_queues; j++) {
+            const uint64_t *counters = (const uint64_t *)&queues[j];
+
+            printf("%ld.%03ld,%u,%u", (long)now.tv_sec, now.tv_nsec / 1000000,
+                   port->rxtx_port, j);
+            for (c = 0; c < RTE_DIM(queue_stats_names); c++)
+                printf(",%" PRIu64, counters[c]);
+            if (copy_mode != COPY_MODE_SW_NUM) {
+                rte_rawdev_xstats_get(port->ioat_ids[j], ids_xstats, xstats,
+                                      2);
+                printf(",%u,%" PRIu64 ",%" PRIu64 "\n", port->ioat_ids[j],
+                       xstats[0], xstats[1]);
+            } else {
+                printf(",,,\n");
+            }
+        }
+    }
+}
+
+/* Print the rawdev and lcores of each RX queue, with their NUMA node. */
+static void print_topology(void) {
+    uint32_t i, j;
+
+    printf("\nTopology (resource@socket) ----------------------------");
+    for (i = 0; i < cfg.nb_ports; i++) {
+        const struct rxtx_port_config *port = &cfg.ports[i];
+
+        printf("\nPort %u@%d:", port->rxtx_port, port->socket_id);
+        for (j = 0; j < port->nb_queues; j++) {
+            const struct worker_config *worker =
+                &cfg.workers[port->worker_ids[j]];
+
+            printf(" q%u", j);
+            if (copy_mode != COPY_MODE_SW_NUM)
+                printf(" rawdev %u@%d", port->ioat_ids[j],
+                       rte_rawdev_socket_id(port->ioat_ids[j]));
+            printf(" lcore %u@%u", worker->rx_lcore,
+                   rte_lcore_to_socket_id(worker->rx_lcore));
+            if (!run_to_completion)
+                printf("/%u@%u", worker->tx_lcore,
+                       rte_lcore_to_socket_id(worker->tx_lcore));
+            if (j + 1 < port->nb_queues) printf(",");
+        }
+    }
+    printf("\n");
+}
+
 static void print_stats(char *prgname) {
-    struct total_statistics ts, delta_ts;
+    struct ioat_queue_statistics queue_stats[MAX_RX_QUEUES_COUNT];
+    const struct timespec interval = {
+        .tv_sec = stats_interval_ms / 1000,
+        .tv_nsec = (stats_interval_ms % 1000) * 1000000L};
+    struct total_statistics ts, delta_ts, rate_ts;
     uint32_t i, port_id, dev_id;
     struct rte_rawdev_xstats_name *names_xstats;
     uint64_t *xstats;
     unsigned int *ids_xstats, nb_xstats;
-    char status_string[255]; /* to print at the top of the output */
+    char status_string[512]; /* to print at the top of the output */
     int status_strlen;
     int ret;
 
@@ -167,11 +865,15 @@ static void print_stats(char *prgname) {
         snprintf(status_string, sizeof(status_string), "%s, ", prgname);
     status_strlen += snprintf(
         status_string + status_strlen, sizeof(status_string) - status_strlen,
-        "Worker Threads = %d, ", rte_lcore_count() > 2 ? 2 : 1);
+        "Workers = %u %s, ", cfg.nb_workers,
+        run_to_completion ? "run-to-completion" : "RX/TX pairs");
     status_strlen +=
         snprintf(status_string + status_strlen,
                  sizeof(status_string) - status_strlen, "Copy Mode = %s,\n",
-                 copy_mode == COPY_MODE_SW_NUM ? COPY_MODE_SW : COPY_MODE_IOAT);
+                 copy_mode == COPY_MODE_SW_NUM
+                     ? COPY_MODE_SW
+                     : copy_mode == COPY_MODE_IOAT_NUM ? COPY_MODE_IOAT
+                                                       : COPY_MODE_HYBRID);
     status_strlen += snprintf(
         status_string + status_strlen, sizeof(status_string) - status_strlen,
         "Updating MAC = %s, ", mac_updating ? "enabled" : "disabled");
@@ -180,70 +882,156 @@ static void print_stats(char *prgname) {
                               "Rx Queues = %d, ", nb_queues);
     status_strlen += snprintf(status_string + status_strlen,
                               sizeof(status_string) - status_strlen,
-                              "Ring Size = %d", ring_size);
-
-    /* Allocate memory for xstats names and values */
-    ret = rte_rawdev_xstats_names_get(cfg.ports[0].ioat_ids[0], NULL, 0);
-    if (ret < 0) return;
-    nb_xstats = (unsigned int)ret;
-
-    names_xstats = malloc(sizeof(*names_xstats) * nb_xstats);
-    if (names_xstats == NULL) {
-        rte_exit(EXIT_FAILURE, "Error allocating xstat names memory\n");
+                              "Ring Size = %d, Staging Size = %u", ring_size,
+                              staging_size);
+    if (header_split_len > 0)
+        status_strlen += snprintf(status_string + status_strlen,
+                                  sizeof(status_string) - status_strlen,
+                                  ", Header Split = %u", header_split_len);
+    if (max_pkt_len > RTE_ETHER_MAX_LEN)
+        status_strlen += snprintf(status_string + status_strlen,
+                                  sizeof(status_string) - status_strlen,
+                                  ", Max Packet Length = %u (%u segments)",
+                                  max_pkt_len, max_pkt_segs);
+    if (copy_mode == COPY_MODE_HYBRID_NUM)
+        status_strlen += snprintf(status_string + status_strlen,
+                                  sizeof(status_string) - status_strlen,
+                                  ", Copy Threshold = %u%s", copy_threshold,
+                                  calibrate_threshold ? " (calibrated)" : "");
+    if (copy_mode != COPY_MODE_SW_NUM)
+        status_strlen += snprintf(
+            status_string + status_strlen,
+            sizeof(status_string) - status_strlen, ", Handles = %s",
+            hdls_disable ? "disabled (mbuf ring)" : "enabled");
+    if (idle_backoff_enabled)
+        status_strlen += snprintf(status_string + status_strlen,
+                                  sizeof(status_string) - status_strlen,
+                                  ", Idle Backoff = pause%s/sleep",
+                                  idle_has_tpause ? "/tpause" : "");
+    if (copy_mode != COPY_MODE_SW_NUM && doorbell_batch > 1)
+        status_strlen += snprintf(
+            status_string + status_strlen,
+            sizeof(status_string) - status_strlen,
+            ", Doorbell = up to %u copies or %u us", doorbell_batch,
+            doorbell_deadline_us);
+    if (copy_mode != COPY_MODE_IOAT_NUM &&
+        ioat_copy_dispatch.stream_min != SIZE_MAX)
+        status_strlen += snprintf(status_string + status_strlen,
+                                  sizeof(status_string) - status_strlen,
+                                  ", Streaming Copies = from %u bytes",
+                                  nt_threshold);
+    if (queue_weights_set) {
+        status_strlen += snprintf(status_string + status_strlen,
+                                  sizeof(status_string) - status_strlen,
+                                  ", Queue Weights = ");
+        for (i = 0; i < nb_queues; i++)
+            status_strlen += snprintf(status_string + status_strlen,
+                                      sizeof(status_string) - status_strlen,
+                                      "%s%u", i > 0 ? "," : "",
+                                      queue_weights[i]);
     }
-    rte_rawdev_xstats_names_get(cfg.ports[0].ioat_ids[0], names_xstats,
-                                nb_xstats);
+    if (tx_budget > 0)
+        status_strlen += snprintf(status_string + status_strlen,
+                                  sizeof(status_string) - status_strlen,
+                                  ", TX Budget = %u", tx_budget);
+    if (latency_enabled)
+        status_strlen += snprintf(status_string + status_strlen,
+                                  sizeof(status_string) - status_strlen,
+                                  ", Latency = enabled");
+
+    /* Allocate memory for xstats names and values. Software copies have no
+     * IOAT channel, whose stats are then left out.
+     */
+    names_xstats = NULL;
+    xstats = NULL;
+    ids_xstats = NULL;
+    if (copy_mode != COPY_MODE_SW_NUM) {
+        ret = rte_rawdev_xstats_names_get(cfg.ports[0].ioat_ids[0], NULL, 0);
+        if (ret < 0)
+            rte_exit(EXIT_FAILURE, "Error getting the number of xstats\n");
+        nb_xstats = (unsigned int)ret;
 
-    ids_xstats = malloc(sizeof(*ids_xstats) * 2);
-    if (ids_xstats == NULL) {
-        rte_exit(EXIT_FAILURE, "Error allocating xstat ids_xstats memory\n");
-    }
+        names_xstats = malloc(sizeof(*names_xstats) * nb_xstats);
+        if (names_xstats == NULL) {
+            rte_exit(EXIT_FAILURE, "Error allocating xstat names memory\n");
+        }
+        rte_rawdev_xstats_names_get(cfg.ports[0].ioat_ids[0], names_xstats,
+                                    nb_xstats);
 
-    xstats = malloc(sizeof(*xstats) * 2);
-    if (xstats == NULL) {
-        rte_exit(EXIT_FAILURE, "Error allocating xstat memory\n");
-    }
+        ids_xstats = malloc(sizeof(*ids_xstats) * 2);
+        if (ids_xstats == NULL) {
+            rte_exit(EXIT_FAILURE,
+                     "Error allocating xstat ids_xstats memory\n");
+        }
 
-    /* Get failed/successful enqueues stats index */
-    ids_xstats[0] = ids_xstats[1] = nb_xstats;
-    for (i = 0; i < nb_xstats; i++) {
-        if (!strcmp(names_xstats[i].name, "failed_enqueues"))
-            ids_xstats[0] = i;
-        else if (!strcmp(names_xstats[i].name, "successful_enqueues"))
-            ids_xstats[1] = i;
-        if (ids_xstats[0] < nb_xstats && ids_xstats[1] < nb_xstats) break;
-    }
-    if (ids_xstats[0] == nb_xstats || ids_xstats[1] == nb_xstats) {
-        rte_exit(EXIT_FAILURE,
-                 "Error getting failed/successful enqueues stats index\n");
+        xstats = malloc(sizeof(*xstats) * 2);
+        if (xstats == NULL) {
+            rte_exit(EXIT_FAILURE, "Error allocating xstat memory\n");
+        }
+
+        /* Get failed/successful enqueues stats index */
+        ids_xstats[0] = ids_xstats[1] = nb_xstats;
+        for (i = 0; i < nb_xstats; i++) {
+            if (!strcmp(names_xstats[i].name, "failed_enqueues"))
+                ids_xstats[0] = i;
+            else if (!strcmp(names_xstats[i].name, "successful_enqueues"))
+                ids_xstats[1] = i;
+            if (ids_xstats[0] < nb_xstats && ids_xstats[1] < nb_xstats) break;
+        }
+        if (ids_xstats[0] == nb_xstats || ids_xstats[1] == nb_xstats) {
+            rte_exit(EXIT_FAILURE,
+                     "Error getting failed/successful enqueues stats index\n");
+        }
     }
 
     memset(&ts, 0, sizeof(struct total_statistics));
 
     while (!force_quit) {
-        /* Sleep for 1 second each round - init sleep allows reading
+        /* Sleep for the interval each round - init sleep allows reading
          * messages from app startup.
          */
-        sleep(1);
+        nanosleep(&interval, NULL);
+
+        /* Counters are only read here, the workers never wait for them */
+        if (stats_format != STATS_FORMAT_TEXT_NUM) {
+            if (stats_format == STATS_FORMAT_JSON_NUM)
+                print_json_stats(ids_xstats);
+            else
+                print_csv_stats(ids_xstats);
+            fflush(stdout);
+            continue;
+        }
 
         /* Clear screen and move to top left */
-        printf("%s%s", clr, topLeft);
+        if (!headless) printf("%s%s", clr, topLeft);
 
         memset(&delta_ts, 0, sizeof(struct total_statistics));
 
         printf("%s\n", status_string);
+        print_topology();
 
         for (i = 0; i < cfg.nb_ports; i++) {
+            struct ioat_queue_statistics port_total;
+
             port_id = cfg.ports[i].rxtx_port;
-            print_port_stats(port_id);
+            stats_snapshot_port(&cfg.ports[i], queue_stats);
+            stats_port_total(queue_stats, cfg.ports[i].nb_queues,
+                             &port_total);
+            print_port_stats(port_id, &port_total);
+            if (copy_mode != COPY_MODE_SW_NUM && staging_size > 0)
+                print_staging_stats(&cfg.ports[i], &port_total);
+            if (cfg.ports[i].nb_queues > 1)
+                print_queue_stats(&cfg.ports[i], queue_stats);
 
             delta_ts.total_packets_dropped +=
-                port_statistics.tx_dropped[port_id] +
-                port_statistics.copy_dropped[port_id];
-            delta_ts.total_packets_tx += port_statistics.tx[port_id];
-            delta_ts.total_packets_rx += port_statistics.rx[port_id];
-
-            if (copy_mode == COPY_MODE_IOAT_NUM) {
+                port_total.tx_dropped + port_total.copy_dropped;
+            delta_ts.total_packets_tx += port_total.tx;
+            delta_ts.total_packets_rx += port_total.rx;
+            delta_ts.total_sw_copies += port_total.copy_sw;
+            delta_ts.total_hw_copies += port_total.copy_hw;
+            delta_ts.total_doorbells += port_total.doorbells;
+
+            if (copy_mode != COPY_MODE_SW_NUM) {
                 uint32_t j;
 
                 for (j = 0; j < cfg.ports[i].nb_queues; j++) {
@@ -251,10 +1039,10 @@ static void print_stats(char *prgname) {
                     rte_rawdev_xstats_get(dev_id, ids_xstats, xstats, 2);
 
                     print_rawdev_stats(dev_id, xstats, ids_xstats, 2,
-                                       names_xstats);
+                                       names_xstats, &queue_stats[j]);
 
-                    delta_ts.total_failed_enqueues += xstats[ids_xstats[0]];
-                    delta_ts.total_successful_enqueues += xstats[ids_xstats[1]];
+                    delta_ts.total_failed_enqueues += xstats[0];
+                    delta_ts.total_successful_enqueues += xstats[1];
                 }
             }
         }
@@ -264,9 +1052,20 @@ static void print_stats(char *prgname) {
         delta_ts.total_packets_dropped -= ts.total_packets_dropped;
         delta_ts.total_failed_enqueues -= ts.total_failed_enqueues;
         delta_ts.total_successful_enqueues -= ts.total_successful_enqueues;
+        delta_ts.total_sw_copies -= ts.total_sw_copies;
+        delta_ts.total_hw_copies -= ts.total_hw_copies;
+        delta_ts.total_doorbells -= ts.total_doorbells;
+
+        if (latency_enabled) print_latency_stats();
+        if (idle_backoff_enabled) print_idle_stats();
+
+        /* The totals are per second, whatever the interval */
+        for (i = 0; i < sizeof(ts) / sizeof(uint64_t); i++)
+            ((uint64_t *)&rate_ts)[i] =
+                ((uint64_t *)&delta_ts)[i] * 1000 / stats_interval_ms;
 
         printf("\n");
-        print_total_stats(&delta_ts);
+        print_total_stats(&rate_ts);
 
         fflush(stdout);
 
@@ -275,6 +1074,9 @@ static void print_stats(char *prgname) {
         ts.total_packets_dropped += delta_ts.total_packets_dropped;
         ts.total_failed_enqueues += delta_ts.total_failed_enqueues;
         ts.total_successful_enqueues += delta_ts.total_successful_enqueues;
+        ts.total_sw_copies += delta_ts.total_sw_copies;
+        ts.total_hw_copies += delta_ts.total_hw_copies;
+        ts.total_doorbells += delta_ts.total_doorbells;
     }
 
     free(names_xstats);
@@ -282,6 +1084,185 @@ static void print_stats(char *prgname) {
     free(ids_xstats);
 }
 
+/* Port of the given id, from telemetry parameters "<port_id>[,...]" */
+static const struct rxtx_port_config *telemetry_port(const char *params,
+                                                     char **end) {
+    unsigned long port_id;
+    uint16_t i;
+
+    if (params == NULL || !isdigit(*params)) return NULL;
+    port_id = strtoul(params, end, 0);
+    for (i = 0; i < cfg.nb_ports; i++)
+        if (cfg.ports[i].rxtx_port == port_id) return &cfg.ports[i];
+    return NULL;
+}
+
+static int telemetry_ports(const char *cmd __rte_unused,
+                           const char *params __rte_unused,
+                           struct rte_tel_data *d) {
+    uint16_t i;
+
+    rte_tel_data_start_array(d, RTE_TEL_INT_VAL);
+    for (i = 0; i < cfg.nb_ports; i++)
+        rte_tel_data_add_array_int(d, cfg.ports[i].rxtx_port);
+    return 0;
+}
+
+static void telemetry_add_counters(struct rte_tel_data *d,
+                                   const struct ioat_queue_statistics *stats) {
+    const uint64_t *counters = (const uint64_t *)stats;
+    unsigned int c;
+
+    for (c = 0; c < RTE_DIM(queue_stats_names); c++)
+        rte_tel_data_add_dict_u64(d, queue_stats_names[c], counters[c]);
+}
+
+static int telemetry_port_stats(const char *cmd __rte_unused,
+                                const char *params, struct rte_tel_data *d) {
+    struct ioat_queue_statistics queues[MAX_RX_QUEUES_COUNT], total;
+    const struct rxtx_port_config *port;
+    char *end;
+
+    port = telemetry_port(params, &end);
+    if (port == NULL || *end != '\0') return -EINVAL;
+
+    stats_snapshot_port(port, queues);
+    stats_port_total(queues, port->nb_queues, &total);
+    rte_tel_data_start_dict(d);
+    rte_tel_data_add_dict_int(d, "socket_id", port->socket_id);
+    rte_tel_data_add_dict_int(d, "nb_queues", port->nb_queues);
+    telemetry_add_counters(d, &total);
+    return 0;
+}
+
+/* Counters of an RX queue, with all the xstats of its IOAT channel */
+static int telemetry_queue_stats(const char *cmd __rte_unused,
+                                 const char *params, struct rte_tel_data *d) {
+    struct ioat_queue_statistics queues[MAX_RX_QUEUES_COUNT];
+    const struct rxtx_port_config *port;
+    struct rte_rawdev_xstats_name *names;
+    unsigned int *ids;
+    unsigned long queue_id;
+    uint64_t *values;
+    char *end;
+    int i, nb_xstats;
+
+    port = telemetry_port(params, &end);
+    if (port == NULL || *end != ',' || !isdigit(end[1])) return -EINVAL;
+    queue_id = strtoul(end + 1, &end, 0);
+    if (*end != '\0' || queue_id >= port->nb_queues) return -EINVAL;
+
+    stats_snapshot_port(port, queues);
+    rte_tel_data_start_dict(d);
+    rte_tel_data_add_dict_int(d, "worker", port->worker_ids[queue_id]);
+    rte_tel_data_add_dict_int(d, "tx_queue", port->tx_queue_ids[queue_id]);
+    telemetry_add_counters(d, &queues[queue_id]);
+    if (copy_mode == COPY_MODE_SW_NUM) return 0;
+
+    const uint16_t dev_id = port->ioat_ids[queue_id];
+    const struct ioat_staging *staging = &port->stagings[queue_id];
+
+    rte_tel_data_add_dict_int(d, "dev_id", dev_id);
+    rte_tel_data_add_dict_int(d, "staging_occupancy",
+                              (unsigned short)(staging->head - staging->tail));
+    rte_tel_data_add_dict_int(d, "staging_max_occupancy",
+                              staging->max_occupancy);
+
+    nb_xstats = rte_rawdev_xstats_names_get(dev_id, NULL, 0);
+    if (nb_xstats <= 0) return 0;
+    names = malloc(sizeof(*names) * nb_xstats);
+    ids = malloc(sizeof(*ids) * nb_xstats);
+    values = malloc(sizeof(*values) * nb_xstats);
+    if (names != NULL && ids != NULL && values != NULL &&
+        rte_rawdev_xstats_names_get(dev_id, names, nb_xstats) == nb_xstats) {
+        for (i = 0; i < nb_xstats; i++) ids[i] = i;
+        if (rte_rawdev_xstats_get(dev_id, ids, values, nb_xstats) ==
+            nb_xstats)
+            for (i = 0; i < nb_xstats; i++)
+                rte_tel_data_add_dict_u64(d, names[i].name, values[i]);
+    }
+    free(names);
+    free(ids);
+    free(values);
+    return 0;
+}
+
+/* Latency percentiles and max in ns, as "<stage>_<percentile>" */
+static int telemetry_latency(const char *cmd __rte_unused,
+                             const char *params __rte_unused,
+                             struct rte_tel_data *d) {
+    double ns[LATENCY_NB_STAGES][RTE_DIM(latency_percentiles) + 1];
+    char name[64];
+    unsigned int s, p;
+
+    latency_snapshot(ns);
+    rte_tel_data_start_dict(d);
+    for (s = 0; s < LATENCY_NB_STAGES; s++) {
+        for (p = 0; p <= RTE_DIM(latency_percentiles); p++) {
+            snprintf(name, sizeof(name), "%s_%s", latency_stage_names[s],
+                     p < RTE_DIM(latency_percentiles)
+                         ? latency_percentile_names[p]
+                         : "max");
+            rte_tel_data_add_dict_u64(d, name, (uint64_t)ns[s][p]);
+        }
+    }
+    return 0;
+}
+
+/* Cycles a worker lcore spent in each idle state, as "<state>_cycles" */
+static int telemetry_idle(const char *cmd __rte_unused, const char *params,
+                          struct rte_tel_data *d) {
+    const struct ioat_idle_statistics *stats;
+    uint64_t cycles[IDLE_NB_STATES];
+    unsigned long lcore_param;
+    uint32_t lcore_id;
+    unsigned int idx, s;
+    char name[64];
+    char *end;
+
+    if (params == NULL || !isdigit(*params)) return -EINVAL;
+    lcore_param = strtoul(params, &end, 0);
+    if (*end != '\0') return -EINVAL;
+
+    for (idx = 0; (stats = idle_stats_lcore(idx, &lcore_id)) != NULL; idx++)
+        if (lcore_id == lcore_param) break;
+    if (stats == NULL) return -EINVAL;
+
+    idle_snapshot(stats, cycles);
+    rte_tel_data_start_dict(d);
+    for (s = 0; s < IDLE_NB_STATES; s++) {
+        snprintf(name, sizeof(name), "%s_cycles", idle_state_names[s]);
+        rte_tel_data_add_dict_u64(d, name, cycles[s]);
+    }
+    return 0;
+}
+
+/* Expose the counters through the DPDK telemetry socket, which are read on
+ * request only, like by the stats screen.
+ */
+static void register_telemetry(void) {
+    rte_telemetry_register_cmd(
+        "/ioat_fwd/ports", telemetry_ports,
+        "Returns the forwarding port ids. No parameters");
+    rte_telemetry_register_cmd(
+        "/ioat_fwd/port_stats", telemetry_port_stats,
+        "Returns the counters of a port. Parameters: int port_id");
+    rte_telemetry_register_cmd(
+        "/ioat_fwd/queue_stats", telemetry_queue_stats,
+        "Returns the counters of an RX queue and its IOAT channel. "
+        "Parameters: int port_id,int queue_id");
+    if (idle_backoff_enabled)
+        rte_telemetry_register_cmd(
+            "/ioat_fwd/idle", telemetry_idle,
+            "Returns the cycles a worker lcore spent in each idle state. "
+            "Parameters: int lcore_id");
+    if (latency_enabled)
+        rte_telemetry_register_cmd(
+            "/ioat_fwd/latency", telemetry_latency,
+            "Returns the latency percentiles of each stage in ns. No "
+            "parameters");
+}
+
 static void update_mac_addrs(struct rte_mbuf *m, uint32_t dest_portid) {
     struct rte_ether_hdr *eth;
     void *tmp;
@@ -298,195 +1279,984 @@ static void update_mac_addrs(struct rte_mbuf *m, uint32_t dest_portid) {
     rte_ether_addr_copy(&ioat_ports_eth_addr[dest_portid], &eth->s_addr);
 }
 
-static inline void pktmbuf_sw_copy(struct rte_mbuf *src, struct rte_mbuf *dst) {
-    /* Copy packet metadata */
+/* Free mbufs. With header split, packets may hold or be referenced by
+ * indirect mbufs, and with jumbo frames be chains, which only
+ * rte_pktmbuf_free takes care of.
+ */
+static inline void pktmbuf_free_bulk(struct rte_mempool *pool,
+                                     struct rte_mbuf **mbufs, uint32_t nb) {
+    if (header_split_len > 0 || max_pkt_segs > 1)
+        rte_pktmbuf_free_bulk(mbufs, nb);
+    else
+        rte_mempool_put_bulk(pool, (void *)mbufs, nb);
+}
+
+static inline uint64_t tsc_delta(uint64_t later, uint64_t earlier) {
+    /* TSCs of different cores may be a few cycles apart */
+    return later > earlier ? later - earlier : 0;
+}
+
+/* Timestamp received packets */
+static inline void latency_stamp_rx(struct rte_mbuf **pkts, uint32_t nb) {
+    const uint64_t now = rte_rdtsc();
+    uint32_t j;
+
+    for (j = 0; j < nb; j++) LATENCY_TS(pkts[j])->rx = now;
+}
+
+/* Timestamp packets about to be copied, before their copies take the
+ * timestamps along
+ */
+static inline void latency_stamp_copy(struct rte_mbuf **pkts, uint32_t nb) {
+    const uint64_t now = rte_rdtsc();
+    uint32_t j;
+
+    for (j = 0; j < nb; j++) {
+        struct latency_ts *ts = LATENCY_TS(pkts[j]);
+
+        ts->copy = RTE_MIN(tsc_delta(now, ts->rx), (uint64_t)UINT32_MAX);
+    }
+}
+
+/* Record the latencies of packets about to be sent. done_tsc is when their
+ * IOAT copies were seen completed, 0 for CPU copies.
+ */
+static void latency_record(struct ioat_hist *latency, struct rte_mbuf **mbufs,
+                           uint32_t nb, uint64_t done_tsc) {
+    const uint64_t now = rte_rdtsc();
+    uint32_t j;
+
+    for (j = 0; j < nb; j++) {
+        const struct latency_ts *ts = LATENCY_TS(mbufs[j]);
+        const uint64_t copy_tsc = ts->rx + ts->copy;
+
+        ioat_hist_record(&latency[LATENCY_RX_TO_COPY], ts->copy);
+        if (done_tsc != 0) {
+            ioat_hist_record(&latency[LATENCY_COPY],
+                             tsc_delta(done_tsc, copy_tsc));
+            ioat_hist_record(&latency[LATENCY_COPY_TO_TX],
+                             tsc_delta(now, done_tsc));
+        } else {
+            ioat_hist_record(&latency[LATENCY_COPY_TO_TX],
+                             tsc_delta(now, copy_tsc));
+        }
+        ioat_hist_record(&latency[LATENCY_RX_TO_TX], tsc_delta(now, ts->rx));
+    }
+}
+
+/* Copy the metadata of the first segment of src to dst */
+static inline void pktmbuf_copy_metadata(struct rte_mbuf *src,
+                                         struct rte_mbuf *dst) {
     rte_memcpy(&dst->rearm_data, &src->rearm_data,
                offsetof(struct rte_mbuf, cacheline1) -
                    offsetof(struct rte_mbuf, rearm_data));
+    if (latency_enabled) *LATENCY_TS(dst) = *LATENCY_TS(src);
+}
+
+/* Header split: set up dst as a copy of src whose data is the header copy,
+ * then a payload mbuf attached to the src buffer for the rest. The payload
+ * holds a reference on the src buffer, which stays valid until the copy is
+ * sent, whenever src itself is freed. Returns false if the whole packet fits
+ * in the header, in which case the payload mbuf is not used.
+ */
+static inline bool pktmbuf_split(struct rte_mbuf *src, struct rte_mbuf *dst,
+                                 struct rte_mbuf *payload) {
+    pktmbuf_copy_metadata(src, dst);
+
+    if (src->data_len <= header_split_len) return false;
+
+    rte_pktmbuf_attach(payload, src);
+    rte_pktmbuf_adj(payload, header_split_len);
+    dst->data_len = header_split_len;
+    dst->next = payload;
+    dst->nb_segs = 2;
+    return true;
+}
+
+/* Copy packet data by CPU. When the copy is streamed to memory, its first
+ * cache line, whose MAC addresses TX rewrites, is still copied in cache.
+ */
+static inline void pktmbuf_copy_data(char *dst, const char *src,
+                                     uint32_t len) {
+    if (mac_updating && len >= ioat_copy_dispatch.stream_min &&
+        len > RTE_CACHE_LINE_SIZE) {
+        ioat_copy_dispatch.narrow(dst, src, RTE_CACHE_LINE_SIZE);
+        dst += RTE_CACHE_LINE_SIZE;
+        src += RTE_CACHE_LINE_SIZE;
+        len -= RTE_CACHE_LINE_SIZE;
+    }
+    ioat_copy(dst, src, len);
+}
+
+static inline void pktmbuf_sw_copy(struct rte_mbuf *src, struct rte_mbuf *dst) {
+    pktmbuf_copy_metadata(src, dst);
 
     /* Copy packet data */
-    rte_memcpy(rte_pktmbuf_mtod(dst, char *), rte_pktmbuf_mtod(src, char *),
-               src->data_len);
+    pktmbuf_copy_data(rte_pktmbuf_mtod(dst, char *),
+                      rte_pktmbuf_mtod(src, char *), src->data_len);
 }
 
-static uint32_t ioat_enqueue_packets(struct rte_mbuf **pkts, uint32_t nb_rx,
-                                     uint16_t dev_id) {
+/* Chain to dst, a copy of the metadata of the chained packet src, the
+ * nb_segs - 1 mbufs of segs, set up to hold the data of the next segments
+ * of src
+ */
+static inline void pktmbuf_chain_segs(const struct rte_mbuf *src,
+                                      struct rte_mbuf *dst,
+                                      struct rte_mbuf **segs) {
+    const struct rte_mbuf *s;
+    uint16_t j;
+
+    for (j = 0, s = src->next; s != NULL; j++, s = s->next) {
+        segs[j]->data_off = s->data_off;
+        segs[j]->data_len = s->data_len;
+        dst->next = segs[j];
+        dst = segs[j];
+    }
+}
+
+/* Copy a chained packet by CPU to dst and segments allocated to match.
+ * Returns false if the mempool is short of them.
+ */
+static bool pktmbuf_sw_copy_chain(struct rte_mempool *pool,
+                                  struct rte_mbuf *src, struct rte_mbuf *dst) {
+    struct rte_mbuf *segs[MAX_PKT_SEGS];
+    const struct rte_mbuf *s;
+    uint16_t j;
+
+    if (unlikely(rte_pktmbuf_alloc_bulk(pool, segs, src->nb_segs - 1) != 0))
+        return false;
+
+    pktmbuf_sw_copy(src, dst);
+    pktmbuf_chain_segs(src, dst, segs);
+    for (j = 0, s = src->next; s != NULL; j++, s = s->next)
+        ioat_copy(rte_pktmbuf_mtod(segs[j], char *),
+                  rte_pktmbuf_mtod(s, char *), s->data_len);
+    return true;
+}
+
+/* Track the mbufs of an IOAT copy without handles, see struct
+ * ioat_mbuf_ring. The rawdev ring had room for the copy, so does the mbuf
+ * ring.
+ */
+static inline void mbuf_ring_push(struct ioat_mbuf_ring *mbuf_ring,
+                                  struct rte_mbuf *src, struct rte_mbuf *dst) {
+    const unsigned short slot = mbuf_ring->head++ & mbuf_ring->mask;
+
+    mbuf_ring->srcs[slot] = src;
+    mbuf_ring->dsts[slot] = dst;
+}
+
+/* Enqueue the IOAT copy of a chained packet: its metadata is copied by the
+ * CPU, as the copy of the first segment would carry the link to the next
+ * source segment along, then each segment by its own descriptor to a chain
+ * of mbufs built to match. Only the descriptor of the last segment carries
+ * the mbufs, which the rawdev completes after the others: its completion is
+ * that of the whole packet. Returns false, with nothing enqueued, if the
+ * rawdev ring or the mempool is short of room for the packet.
+ */
+static bool ioat_enqueue_chain(struct rte_mempool *pool, struct rte_mbuf *src,
+                               struct rte_mbuf *dst, uint16_t dev_id,
+                               struct ioat_mbuf_ring *mbuf_ring) {
+    struct rte_mbuf *segs[MAX_PKT_SEGS];
+    struct rte_mbuf *s, *d;
+
+    if (ioat_dev_burst_capacity(dev_id) < src->nb_segs) return false;
+    if (unlikely(rte_pktmbuf_alloc_bulk(pool, segs, src->nb_segs - 1) != 0))
+        return false;
+
+    pktmbuf_copy_metadata(src, dst);
+    pktmbuf_chain_segs(src, dst, segs);
+
+    for (s = src, d = dst; s != NULL; s = s->next, d = d->next) {
+        struct rte_mbuf *const src_hdl = s->next == NULL ? src : NULL;
+        struct rte_mbuf *const dst_hdl = s->next == NULL ? dst : NULL;
+
+        /* Cannot fail, the capacity was checked */
+        ioat_dev_enqueue_copy(dev_id, rte_pktmbuf_iova(s), rte_pktmbuf_iova(d),
+                              s->data_len, (uintptr_t)src_hdl,
+                              (uintptr_t)dst_hdl);
+        if (hdls_disable) mbuf_ring_push(mbuf_ring, src_hdl, dst_hdl);
+    }
+    return true;
+}
+
+/* Completions of chained packets also hold an entry without mbufs for each
+ * of their segments but the last, which is dropped. Returns the number of
+ * packets left.
+ */
+static inline uint32_t completions_compact(struct rte_mbuf **srcs,
+                                           struct rte_mbuf **dsts,
+                                           uint32_t nb) {
+    uint32_t j, n = 0;
+
+    for (j = 0; j < nb; j++) {
+        if (dsts[j] == NULL) continue;
+        srcs[n] = srcs[j];
+        dsts[n++] = dsts[j];
+    }
+    return n;
+}
+
+static uint32_t ioat_enqueue_packets(struct rte_mempool *pool,
+                                     struct rte_mbuf **pkts, uint32_t nb_rx,
+                                     uint16_t dev_id,
+                                     struct ioat_mbuf_ring *mbuf_ring) {
     int ret;
-    uint32_t i;
+    uint32_t i, nb_payloads = 0;
     struct rte_mbuf *pkts_copy[MAX_PKT_BURST];
+    struct rte_mbuf *payloads[MAX_PKT_BURST];
 
     const uint64_t addr_offset =
         RTE_PTR_DIFF(pkts[0]->buf_addr, &pkts[0]->rearm_data);
 
-    ret = rte_mempool_get_bulk(ioat_pktmbuf_pool, (void *)pkts_copy, nb_rx);
+    /* No mbuf to copy to for now, the caller keeps the packets */
+    ret = rte_mempool_get_bulk(pool, (void *)pkts_copy, nb_rx);
+    if (unlikely(ret < 0)) return 0;
+    if (header_split_len > 0 &&
+        unlikely(rte_pktmbuf_alloc_bulk(pool, payloads, nb_rx) != 0)) {
+        rte_mempool_put_bulk(pool, (void *)pkts_copy, nb_rx);
+        return 0;
+    }
 
-    if (unlikely(ret < 0))
-        rte_exit(EXIT_FAILURE, "Unable to allocate memory.\n");
+    /* Packets not enqueued now are stamped again on their next try */
+    if (latency_enabled) latency_stamp_copy(pkts, nb_rx);
 
     for (i = 0; i < nb_rx; i++) {
-        /* Perform data copy */
-        ret =
-            rte_ioat_enqueue_copy(dev_id, pkts[i]->buf_iova - addr_offset,
-                                  pkts_copy[i]->buf_iova - addr_offset,
-                                  rte_pktmbuf_data_len(pkts[i]) + addr_offset,
-                                  (uintptr_t)pkts[i], (uintptr_t)pkts_copy[i]);
+        if (pkts[i]->nb_segs > 1) {
+            if (!ioat_enqueue_chain(pool, pkts[i], pkts_copy[i], dev_id,
+                                    mbuf_ring))
+                break;
+            continue;
+        }
+        if (header_split_len > 0) {
+            /* Copy the header only, the metadata is set up by the CPU */
+            ret = ioat_dev_enqueue_copy(
+                dev_id, rte_pktmbuf_iova(pkts[i]),
+                pkts_copy[i]->buf_iova + pkts[i]->data_off,
+                RTE_MIN(rte_pktmbuf_data_len(pkts[i]), header_split_len),
+                (uintptr_t)pkts[i], (uintptr_t)pkts_copy[i]);
+            if (ret != 1) break;
+            if (pktmbuf_split(pkts[i], pkts_copy[i], payloads[nb_payloads]))
+                nb_payloads++;
+        } else {
+            /* Perform data copy */
+            ret = ioat_dev_enqueue_copy(
+                dev_id, pkts[i]->buf_iova - addr_offset,
+                pkts_copy[i]->buf_iova - addr_offset,
+                rte_pktmbuf_data_len(pkts[i]) + addr_offset,
+                (uintptr_t)pkts[i], (uintptr_t)pkts_copy[i]);
+            if (ret != 1) break;
+        }
+
+        if (hdls_disable) mbuf_ring_push(mbuf_ring, pkts[i], pkts_copy[i]);
+    }
+
+    ret = i;
+    /* Free the unused copies, the caller keeps the not enqueued packets. */
+    rte_mempool_put_bulk(pool, (void *)&pkts_copy[i], nb_rx - i);
+    if (header_split_len > 0)
+        rte_pktmbuf_free_bulk(&payloads[nb_payloads], nb_rx - nb_payloads);
+
+    return ret;
+}
+
+/* Copy packets by CPU and pass the copies to TX through the rte_ring, the
+ * source packets are freed. Returns the number of packets passed to TX.
+ */
+static uint32_t sw_copy_packets(struct rte_mempool *pool,
+                                struct rte_mbuf **pkts, uint32_t nb_rx,
+                                struct rte_ring *rx_to_tx_ring) {
+    int ret;
+    uint32_t j, nb_enq, nb_copy = nb_rx, nb_payloads = 0;
+    struct rte_mbuf *pkts_copy[MAX_PKT_BURST];
+    struct rte_mbuf *payloads[MAX_PKT_BURST];
+
+    /* Drop the burst rather than wait for mbufs */
+    ret = rte_mempool_get_bulk(pool, (void *)pkts_copy, nb_rx);
+    if (unlikely(ret < 0)) {
+        pktmbuf_free_bulk(pool, pkts, nb_rx);
+        return 0;
+    }
+    if (header_split_len > 0 &&
+        unlikely(rte_pktmbuf_alloc_bulk(pool, payloads, nb_rx) != 0)) {
+        rte_mempool_put_bulk(pool, (void *)pkts_copy, nb_rx);
+        pktmbuf_free_bulk(pool, pkts, nb_rx);
+        return 0;
+    }
+
+    if (latency_enabled) latency_stamp_copy(pkts, nb_rx);
+
+    if (header_split_len > 0) {
+        for (j = 0; j < nb_rx; j++) {
+            if (pktmbuf_split(pkts[j], pkts_copy[j], payloads[nb_payloads]))
+                nb_payloads++;
+            /* Copy the header */
+            pktmbuf_copy_data(rte_pktmbuf_mtod(pkts_copy[j], char *),
+                              rte_pktmbuf_mtod(pkts[j], char *),
+                              pkts_copy[j]->data_len);
+        }
+        rte_pktmbuf_free_bulk(&payloads[nb_payloads], nb_rx - nb_payloads);
+    } else {
+        /* Chains short of mbufs to copy to are dropped */
+        for (j = 0, nb_copy = 0; j < nb_rx; j++) {
+            if (likely(pkts[j]->nb_segs == 1))
+                pktmbuf_sw_copy(pkts[j], pkts_copy[nb_copy++]);
+            else if (pktmbuf_sw_copy_chain(pool, pkts[j], pkts_copy[nb_copy]))
+                nb_copy++;
+        }
+        rte_mempool_put_bulk(pool, (void *)&pkts_copy[nb_copy],
+                             nb_rx - nb_copy);
+    }
+
+    pktmbuf_free_bulk(pool, pkts, nb_rx);
+
+    /* Streamed copies must be in memory before TX sees them */
+    if (ioat_copy_dispatch.stream_min != SIZE_MAX) ioat_copy_fence();
+    nb_enq = rte_ring_enqueue_burst(rx_to_tx_ring, (void *)pkts_copy, nb_copy,
+                                    NULL);
+
+    /* Free any not enqueued packets. */
+    pktmbuf_free_bulk(pool, &pkts_copy[nb_enq], nb_copy - nb_enq);
+
+    return nb_enq;
+}
+
+static inline void ioat_doorbell_ring(struct ioat_doorbell *db, uint16_t dev_id,
+                                      struct ioat_queue_statistics *stats,
+                                      uint64_t now) {
+    ioat_dev_perform_ops(dev_id);
+    stats_add(&stats->doorbells, 1);
+    stats_add(&stats->doorbell_wait, now - db->first_tsc);
+    db->pending = 0;
+}
+
+/* Submit the copies just enqueued on the IOAT rawdev of a queue, or hold
+ * them back for the next ones, see struct ioat_doorbell. Called on every RX
+ * poll of the queue, with nb_enq 0 if nothing was enqueued, so that pending
+ * copies meet their deadline. short_of_room is set when copies could not be
+ * enqueued, and submits the pending ones right away.
+ */
+static void ioat_doorbell(struct rxtx_port_config *rx_config,
+                          uint16_t queue_id,
+                          struct ioat_queue_statistics *stats,
+                          uint32_t nb_enq, bool short_of_room) {
+    struct ioat_doorbell *db = &rx_config->doorbells[queue_id];
+    const uint16_t dev_id = rx_config->ioat_ids[queue_id];
+
+    if (doorbell_batch <= 1) {
+        if (nb_enq > 0) {
+            ioat_dev_perform_ops(dev_id);
+            stats_add(&stats->doorbells, 1);
+        }
+        return;
+    }
+
+    const uint64_t now = rte_rdtsc();
+    const uint64_t elapsed = now - db->window_start;
+
+    db->window_count += nb_enq;
+    if (elapsed >= doorbell_deadline_tsc) {
+        /* copies over the elapsed time, scaled to one window */
+        const uint32_t count =
+            (uint64_t)db->window_count * 16 * doorbell_deadline_tsc / elapsed;
+
+        /* a long idle period tells nothing of the current load */
+        if (elapsed >= 8 * doorbell_deadline_tsc)
+            db->ewma = count;
+        else
+            db->ewma = db->ewma - (db->ewma >> 3) + (count >> 3);
+        db->threshold =
+            RTE_MIN(RTE_MAX((db->ewma + 8) >> 4, 1U), (uint32_t)doorbell_batch);
+        db->window_start = now;
+        db->window_count = 0;
+    }
+
+    if (nb_enq > 0 && db->pending == 0) db->first_tsc = now;
+    db->pending += nb_enq;
+    if (db->pending == 0) return;
+
+    if (short_of_room || db->pending >= db->threshold) {
+        ioat_doorbell_ring(db, dev_id, stats, now);
+    } else if (now - db->first_tsc >= doorbell_deadline_tsc) {
+        ioat_doorbell_ring(db, dev_id, stats, now);
+        stats_add(&stats->doorbell_deadlines, 1);
+    }
+}
+
+/* Copy the staged packets of a queue, then the new ones, with its IOAT
+ * rawdev. Packets finding the rawdev ring full, or no mbuf to copy to, are
+ * staged to be retried on the next loop iterations, and dropped only once
+ * the staging queue is full.
+ */
+static void ioat_stage_enqueue(struct rxtx_port_config *rx_config,
+                               uint16_t queue_id,
+                               struct ioat_queue_statistics *stats,
+                               struct rte_mbuf **pkts, uint32_t nb_rx) {
+    struct ioat_staging *staging = &rx_config->stagings[queue_id];
+    struct ioat_mbuf_ring *mbuf_ring = &rx_config->mbuf_rings[queue_id];
+    struct rte_mempool *pool = rx_config->pktmbuf_pool;
+    const uint16_t dev_id = rx_config->ioat_ids[queue_id];
+    uint32_t nb_enq = 0, nb_new = 0, nb, n, j;
+    unsigned short occupancy;
+
+    /* Oldest packets first, in slices when they wrap around */
+    while ((occupancy = staging->head - staging->tail) > 0) {
+        const unsigned short slot = staging->tail & staging->mask;
+
+        nb = RTE_MIN((uint32_t)occupancy, (uint32_t)staging->mask + 1 - slot);
+        nb = RTE_MIN(nb, (uint32_t)MAX_PKT_BURST);
+        n = ioat_enqueue_packets(pool, &staging->pkts[slot], nb, dev_id,
+                                 mbuf_ring);
+        staging->tail += n;
+        nb_enq += n;
+        if (n < nb) break;
+    }
 
-        if (ret != 1) break;
+    /* New packets may only overtake staged ones when none is left */
+    if (nb_rx > 0 && staging->head == staging->tail)
+        nb_new = ioat_enqueue_packets(pool, pkts, nb_rx, dev_id, mbuf_ring);
+    nb_enq += nb_new;
+    ioat_doorbell(rx_config, queue_id, stats, nb_enq,
+                  nb_new < nb_rx || staging->head != staging->tail);
+
+    /* Stage the others, as long as there is room */
+    occupancy = staging->head - staging->tail;
+    nb = RTE_MIN(nb_rx - nb_new, (uint32_t)(staging->size - occupancy));
+    for (j = 0; j < nb; j++)
+        staging->pkts[staging->head++ & staging->mask] = pkts[nb_new + j];
+    if (nb > 0) stats_add(&stats->staged, nb);
+    occupancy += nb;
+    if (occupancy > staging->max_occupancy) staging->max_occupancy = occupancy;
+
+    n = nb_rx - nb_new - nb;
+    if (n > 0) {
+        pktmbuf_free_bulk(pool, &pkts[nb_new + nb], n);
+        stats_add(&stats->staging_overflow, n);
+        stats_add(&stats->copy_dropped, n);
     }
+    if (nb_enq > 0) stats_add(&stats->copy_hw, nb_enq);
+}
 
-    ret = i;
-    /* Free any not enqueued packets. */
-    rte_mempool_put_bulk(ioat_pktmbuf_pool, (void *)&pkts[i], nb_rx - i);
-    rte_mempool_put_bulk(ioat_pktmbuf_pool, (void *)&pkts_copy[i], nb_rx - i);
+/* Split a burst by packet length: short packets are copied by the CPU, the
+ * others by the IOAT rawdev. Both kinds of copies end up in ioat_tx_queue.
+ */
+static void hybrid_copy_packets(struct rxtx_port_config *rx_config,
+                                struct ioat_queue_statistics *stats,
+                                struct rte_mbuf **pkts, uint32_t nb_rx,
+                                uint16_t queue_id) {
+    struct rte_mbuf *pkts_sw[MAX_PKT_BURST], *pkts_hw[MAX_PKT_BURST];
+    uint32_t j, nb_sw = 0, nb_hw = 0, nb_enq_sw = 0;
+
+    for (j = 0; j < nb_rx; j++) {
+        if (rte_pktmbuf_pkt_len(pkts[j]) <= copy_threshold)
+            pkts_sw[nb_sw++] = pkts[j];
+        else
+            pkts_hw[nb_hw++] = pkts[j];
+    }
 
-    return ret;
+    /* Kick the IOAT first so that it copies while the CPU does, staged
+     * packets are retried even if none is received
+     */
+    ioat_stage_enqueue(rx_config, queue_id, stats, pkts_hw, nb_hw);
+    if (nb_sw > 0) {
+        nb_enq_sw = sw_copy_packets(rx_config->pktmbuf_pool, pkts_sw, nb_sw,
+                                    rx_config->rx_to_tx_rings[queue_id]);
+        stats_add(&stats->copy_sw, nb_enq_sw);
+        stats_add(&stats->copy_dropped, nb_sw - nb_enq_sw);
+    }
 }
 
-/* Receive packets on one port and enqueue to IOAT rawdev or rte_ring. */
-static void ioat_rx_port(struct rxtx_port_config *rx_config) {
-    uint32_t nb_rx, nb_enq, i, j;
+/* Receive packets on one queue and enqueue to IOAT rawdev or rte_ring.
+ * Returns false if there was nothing to do.
+ */
+static bool ioat_rx_queue(struct rxtx_port_config *rx_config,
+                          uint16_t queue_id,
+                          struct ioat_queue_statistics *stats) {
+    const struct ioat_staging *staging = &rx_config->stagings[queue_id];
+    const struct ioat_doorbell *db = &rx_config->doorbells[queue_id];
+    uint32_t nb_rx, nb_enq;
     struct rte_mbuf *pkts_burst[MAX_PKT_BURST];
 
-    for (i = 0; i < rx_config->nb_queues; i++) {
-        nb_rx = rte_eth_rx_burst(rx_config->rxtx_port, i, pkts_burst,
-                                 MAX_PKT_BURST);
+    nb_rx = rte_eth_rx_burst(rx_config->rxtx_port, queue_id, pkts_burst,
+                             MAX_PKT_BURST);
 
-        if (nb_rx == 0) continue;
+    /* Staged packets are retried, and held back copies submitted on time,
+     * even if none is received
+     */
+    if (nb_rx == 0 && staging->head == staging->tail && db->pending == 0)
+        return false;
 
-        port_statistics.rx[rx_config->rxtx_port] += nb_rx;
+    stats_add(&stats->rx, nb_rx);
+    if (latency_enabled && nb_rx > 0) latency_stamp_rx(pkts_burst, nb_rx);
 
-        if (copy_mode == COPY_MODE_IOAT_NUM) {
-            /* Perform packet hardware copy */
-            nb_enq =
-                ioat_enqueue_packets(pkts_burst, nb_rx, rx_config->ioat_ids[i]);
-            if (nb_enq > 0) rte_ioat_perform_ops(rx_config->ioat_ids[i]);
-        } else {
-            /* Perform packet software copy, free source packets */
-            int ret;
-            struct rte_mbuf *pkts_burst_copy[MAX_PKT_BURST];
+    if (copy_mode == COPY_MODE_IOAT_NUM) {
+        /* Perform packet hardware copy */
+        ioat_stage_enqueue(rx_config, queue_id, stats, pkts_burst, nb_rx);
+    } else if (copy_mode == COPY_MODE_SW_NUM) {
+        /* Perform packet software copy, free source packets */
+        nb_enq = sw_copy_packets(rx_config->pktmbuf_pool, pkts_burst, nb_rx,
+                                 rx_config->rx_to_tx_rings[queue_id]);
+        stats_add(&stats->copy_sw, nb_enq);
+        stats_add(&stats->copy_dropped, nb_rx - nb_enq);
+    } else {
+        hybrid_copy_packets(rx_config, stats, pkts_burst, nb_rx, queue_id);
+    }
+
+    return true;
+}
 
-            ret = rte_mempool_get_bulk(ioat_pktmbuf_pool,
-                                       (void *)pkts_burst_copy, nb_rx);
+/* Update MACs and transmit copied packets, free any unsent ones. done_tsc
+ * is when IOAT copies were seen completed, 0 for CPU copies or without
+ * latency timestamps.
+ */
+static void ioat_tx_burst(struct rxtx_port_config *tx_config, uint16_t queue_id,
+                          struct ioat_queue_statistics *stats,
+                          struct rte_mbuf **mbufs_dst, uint32_t nb_dq,
+                          uint64_t done_tsc) {
+    uint32_t j;
 
-            if (unlikely(ret < 0))
-                rte_exit(EXIT_FAILURE, "Unable to allocate memory.\n");
+    /* Update macs if enabled */
+    if (mac_updating) {
+        for (j = 0; j < nb_dq; j++)
+            update_mac_addrs(mbufs_dst[j], tx_config->rxtx_port);
+    }
 
-            for (j = 0; j < nb_rx; j++)
-                pktmbuf_sw_copy(pkts_burst[j], pkts_burst_copy[j]);
+    /* Sent packets may be freed by the driver at any time */
+    if (latency_enabled)
+        latency_record(cfg.workers[tx_config->worker_ids[queue_id]].latency,
+                       mbufs_dst, nb_dq, done_tsc);
 
-            rte_mempool_put_bulk(ioat_pktmbuf_pool, (void *)pkts_burst, nb_rx);
+    /* The TX queue belongs to the worker of the RX queue */
+    const uint16_t nb_tx =
+        rte_eth_tx_burst(tx_config->rxtx_port,
+                         tx_config->tx_queue_ids[queue_id], (void *)mbufs_dst,
+                         nb_dq);
 
-            nb_enq = rte_ring_enqueue_burst(
-                rx_config->rx_to_tx_ring, (void *)pkts_burst_copy, nb_rx, NULL);
+    stats_add(&stats->tx, nb_tx);
 
-            /* Free any not enqueued packets. */
-            rte_mempool_put_bulk(ioat_pktmbuf_pool,
-                                 (void *)&pkts_burst_copy[nb_enq],
-                                 nb_rx - nb_enq);
-        }
+    /* Free any unsent packets. */
+    if (unlikely(nb_tx < nb_dq)) {
+        pktmbuf_free_bulk(tx_config->pktmbuf_pool, &mbufs_dst[nb_tx],
+                          nb_dq - nb_tx);
+        stats_add(&stats->tx_dropped, nb_dq - nb_tx);
+    }
+}
 
-        port_statistics.copy_dropped[rx_config->rxtx_port] += (nb_rx - nb_enq);
+/* Transmit the copies completed by an IOAT rawdev without handles: they are
+ * the oldest entries of its mbuf ring, which are passed in place to the
+ * mempool and to TX, in two slices when they wrap around. Returns the number
+ * of copies transmitted, which may be more than max.
+ */
+static uint32_t ioat_tx_mbuf_ring(struct rxtx_port_config *tx_config,
+                                  uint16_t queue_id,
+                                  struct ioat_queue_statistics *stats,
+                                  uint32_t max) {
+    struct ioat_mbuf_ring *mbuf_ring = &tx_config->mbuf_rings[queue_id];
+    int nb_dq;
+
+    /* Without handles the rawdev reports every completed copy, whatever
+     * the max given, and fills no handle array
+     */
+    nb_dq = ioat_dev_completed_ops(tx_config->ioat_ids[queue_id], max, NULL,
+                                   NULL);
+    if (nb_dq <= 0) return 0;
+
+    const uint64_t done_tsc = latency_enabled ? rte_rdtsc() : 0;
+    uint32_t nb_done = 0;
+
+    while (nb_dq > 0) {
+        const unsigned short slot = mbuf_ring->tail & mbuf_ring->mask;
+        const uint32_t nb =
+            RTE_MIN((uint32_t)nb_dq, (uint32_t)mbuf_ring->mask + 1 - slot);
+        uint32_t nb_pkts = nb;
+
+        /* The slots are free once read, compaction may reuse them */
+        if (max_pkt_segs > 1)
+            nb_pkts = completions_compact(&mbuf_ring->srcs[slot],
+                                          &mbuf_ring->dsts[slot], nb);
+        pktmbuf_free_bulk(tx_config->pktmbuf_pool, &mbuf_ring->srcs[slot],
+                          nb_pkts);
+        ioat_tx_burst(tx_config, queue_id, stats, &mbuf_ring->dsts[slot],
+                      nb_pkts, done_tsc);
+        mbuf_ring->tail += nb;
+        nb_dq -= nb;
+        nb_done += nb_pkts;
     }
+
+    stats_add(&stats->copy_hw_done, nb_done);
+    return nb_done;
 }
 
-/* Transmit packets from IOAT rawdev/rte_ring for one port. */
-static void ioat_tx_port(struct rxtx_port_config *tx_config) {
-    uint32_t i, j, nb_dq = 0;
+/* Transmit up to max packets, of at most MAX_PKT_BURST, from IOAT
+ * rawdev/rte_ring for one queue. Returns the number of packets transmitted.
+ */
+static uint32_t ioat_tx_queue(struct rxtx_port_config *tx_config,
+                              uint16_t queue_id,
+                              struct ioat_queue_statistics *stats,
+                              uint32_t max) {
+    uint32_t nb_dq = 0, nb_ring = 0;
+    uint64_t done_tsc = 0;
     struct rte_mbuf *mbufs_src[MAX_PKT_BURST];
     struct rte_mbuf *mbufs_dst[MAX_PKT_BURST];
+    int ret;
 
-    for (i = 0; i < tx_config->nb_queues; i++) {
-        if (copy_mode == COPY_MODE_IOAT_NUM) {
-            /* Deque the mbufs from IOAT device. */
-            nb_dq =
-                rte_ioat_completed_ops(tx_config->ioat_ids[i], MAX_PKT_BURST,
-                                       (void *)mbufs_src, (void *)mbufs_dst);
-        } else {
-            /* Deque the mbufs from rx_to_tx_ring. */
-            nb_dq =
-                rte_ring_dequeue_burst(tx_config->rx_to_tx_ring,
-                                       (void *)mbufs_dst, MAX_PKT_BURST, NULL);
+    stats_add(&stats->tx_polls, 1);
+
+    if (copy_mode != COPY_MODE_SW_NUM && hdls_disable) {
+        nb_dq = ioat_tx_mbuf_ring(tx_config, queue_id, stats, max);
+    } else if (copy_mode != COPY_MODE_SW_NUM) {
+        /* Deque the mbufs from IOAT device. */
+        ret = ioat_dev_completed_ops(tx_config->ioat_ids[queue_id], max,
+                                     (void *)mbufs_src, (void *)mbufs_dst);
+        if (ret > 0) {
+            nb_dq = ret;
+            if (max_pkt_segs > 1)
+                nb_dq = completions_compact(mbufs_src, mbufs_dst, nb_dq);
+            if (latency_enabled) done_tsc = rte_rdtsc();
+            pktmbuf_free_bulk(tx_config->pktmbuf_pool, mbufs_src, nb_dq);
+            stats_add(&stats->copy_hw_done, nb_dq);
+            ioat_tx_burst(tx_config, queue_id, stats, mbufs_dst, nb_dq,
+                          done_tsc);
         }
+    }
+
+    /* The CPU copies come through the ring, in hybrid mode with what the
+     * IOAT completions leave of max: those free ring slots first
+     */
+    if (copy_mode != COPY_MODE_IOAT_NUM && nb_dq < max) {
+        nb_ring = rte_ring_dequeue_burst(tx_config->rx_to_tx_rings[queue_id],
+                                         (void *)mbufs_dst, max - nb_dq, NULL);
+        if (nb_ring > 0)
+            ioat_tx_burst(tx_config, queue_id, stats, mbufs_dst, nb_ring, 0);
+    }
+
+    if (nb_dq + nb_ring >= max) stats_add(&stats->tx_full_polls, 1);
+    return nb_dq + nb_ring;
+}
+
+static void tx_sched_init(struct tx_sched *s,
+                          const struct worker_config *worker) {
+    uint16_t i;
 
-        if ((int32_t)nb_dq <= 0) return;
+    memset(s, 0, sizeof(*s));
+    for (i = 0; i < worker->nb_queues; i++)
+        s->quantum[i] =
+            queue_weights[worker->queues[i].queue_id] * MAX_PKT_BURST;
+}
 
-        if (copy_mode == COPY_MODE_IOAT_NUM)
-            rte_mempool_put_bulk(ioat_pktmbuf_pool, (void *)mbufs_src, nb_dq);
+/* One round of completion polls over the queues of a TX lcore, see struct
+ * tx_sched. Returns false if there was nothing to send.
+ */
+static bool ioat_tx_round(const struct worker_config *worker,
+                          struct tx_sched *s) {
+    uint32_t budget = tx_budget > 0 ? tx_budget : UINT32_MAX;
+    uint32_t max, nb;
+    uint16_t n, i, first = s->first;
+    bool busy = false;
+
+    for (n = 0, i = s->first; n < worker->nb_queues;
+         n++, i = i + 1 < worker->nb_queues ? i + 1 : 0) {
+        struct ioat_queue_statistics *stats = &worker->tx_stats[i];
+
+        if (budget == 0) {
+            if (first == s->first) first = i;
+            stats_add(&stats->tx_starved, 1);
+            continue;
+        }
 
-        /* Update macs if enabled */
-        if (mac_updating) {
-            for (j = 0; j < nb_dq; j++)
-                update_mac_addrs(mbufs_dst[j], tx_config->rxtx_port);
+        s->deficit[i] += s->quantum[i];
+        while (s->deficit[i] > 0 && budget > 0) {
+            max = RTE_MIN(RTE_MIN((uint32_t)s->deficit[i], budget),
+                          (uint32_t)MAX_PKT_BURST);
+            nb = ioat_tx_queue(worker->queues[i].port,
+                               worker->queues[i].queue_id, stats, max);
+            s->deficit[i] -= nb;
+            budget -= RTE_MIN(nb, budget);
+            if (nb > 0) busy = true;
+            /* A drained queue keeps no credit for later rounds */
+            if (nb < max) {
+                s->deficit[i] = 0;
+                break;
+            }
         }
+    }
 
-        const uint16_t nb_tx =
-            rte_eth_tx_burst(tx_config->rxtx_port, 0, (void *)mbufs_dst, nb_dq);
+    s->first = first;
+    return busy;
+}
 
-        port_statistics.tx[tx_config->rxtx_port] += nb_tx;
+static void idle_backoff_init(struct idle_backoff *b,
+                              struct ioat_idle_statistics *stats) {
+    b->last_busy_tsc = b->prev_tsc = rte_rdtsc();
+    b->stats = stats;
+}
 
-        /* Free any unsent packets. */
-        if (unlikely(nb_tx < nb_dq))
-            rte_mempool_put_bulk(ioat_pktmbuf_pool, (void *)&mbufs_dst[nb_tx],
-                                 nb_dq - nb_tx);
+/* Called after each round of polls of an lcore: wait according to how long
+ * they have been coming back empty, and account the round and the wait to
+ * the state of the lcore. Any work brings it back to busy at once, so under
+ * load it only costs a TSC read per round.
+ */
+static void idle_backoff(struct idle_backoff *b, bool busy) {
+    uint64_t now = rte_rdtsc();
+    enum idle_state state;
+
+    if (busy) {
+        b->last_busy_tsc = now;
+        state = IDLE_BUSY;
+    } else {
+        const uint64_t idle = now - b->last_busy_tsc;
+
+        if (idle < idle_pause_tsc) {
+            state = IDLE_SPIN;
+        } else if (idle < idle_tpause_tsc) {
+            state = IDLE_PAUSE;
+            rte_pause();
+        } else if (idle < idle_sleep_tsc && idle_has_tpause) {
+            state = IDLE_TPAUSE;
+            rte_power_pause(now + idle_tpause_len_tsc);
+        } else {
+            state = IDLE_SLEEP;
+            rte_delay_us_sleep(IDLE_SLEEP_LEN_US);
+        }
+        if (state != IDLE_SPIN) now = rte_rdtsc();
     }
+
+    stats_add(&b->stats->cycles[state], now - b->prev_tsc);
+    b->prev_tsc = now;
 }
 
 /* Main rx processing loop for IOAT rawdev. */
-static void rx_main_loop(void) {
+static int rx_main_loop(void *arg) {
+    const struct worker_config *worker = arg;
+    struct idle_backoff backoff;
     uint16_t i;
-    uint16_t nb_ports = cfg.nb_ports;
+    bool busy;
 
     RTE_LOG(INFO, IOAT, "Entering main rx loop for copy on lcore %u\n",
             rte_lcore_id());
 
-    while (!force_quit)
-        for (i = 0; i < nb_ports; i++) ioat_rx_port(&cfg.ports[i]);
+    idle_backoff_init(&backoff, worker->rx_idle);
+    while (!force_quit) {
+        busy = false;
+        for (i = 0; i < worker->nb_queues; i++)
+            busy |= ioat_rx_queue(worker->queues[i].port,
+                                  worker->queues[i].queue_id,
+                                  &worker->rx_stats[i]);
+        if (idle_backoff_enabled) idle_backoff(&backoff, busy);
+    }
+
+    return 0;
 }
 
 /* Main tx processing loop for hardware copy. */
-static void tx_main_loop(void) {
-    uint16_t i;
-    uint16_t nb_ports = cfg.nb_ports;
+static int tx_main_loop(void *arg) {
+    const struct worker_config *worker = arg;
+    struct idle_backoff backoff;
+    struct tx_sched sched;
+    bool busy;
 
     RTE_LOG(INFO, IOAT, "Entering main tx loop for copy on lcore %u\n",
             rte_lcore_id());
 
-    while (!force_quit)
-        for (i = 0; i < nb_ports; i++) ioat_tx_port(&cfg.ports[i]);
+    idle_backoff_init(&backoff, worker->tx_idle);
+    tx_sched_init(&sched, worker);
+    while (!force_quit) {
+        busy = ioat_tx_round(worker, &sched);
+        if (idle_backoff_enabled) idle_backoff(&backoff, busy);
+    }
+
+    return 0;
 }
 
-/* Main rx and tx loop if only one worker lcore available */
-static void rxtx_main_loop(void) {
+/* Main rx and tx loop of a run-to-completion worker */
+static int rxtx_main_loop(void *arg) {
+    const struct worker_config *worker = arg;
+    struct idle_backoff backoff;
+    struct tx_sched sched;
     uint16_t i;
-    uint16_t nb_ports = cfg.nb_ports;
+    bool busy;
 
     RTE_LOG(INFO, IOAT,
             "Entering main rx and tx loop for copy on"
             " lcore %u\n",
             rte_lcore_id());
 
-    while (!force_quit)
-        for (i = 0; i < nb_ports; i++) {
-            ioat_rx_port(&cfg.ports[i]);
-            ioat_tx_port(&cfg.ports[i]);
+    idle_backoff_init(&backoff, worker->rx_idle);
+    tx_sched_init(&sched, worker);
+    while (!force_quit) {
+        busy = false;
+        for (i = 0; i < worker->nb_queues; i++)
+            busy |= ioat_rx_queue(worker->queues[i].port,
+                                  worker->queues[i].queue_id,
+                                  &worker->rx_stats[i]);
+        busy |= ioat_tx_round(worker, &sched);
+        if (idle_backoff_enabled) idle_backoff(&backoff, busy);
+    }
+
+    return 0;
+}
+
+/* Number of workers the lcores allow, at most one per (port, RX queue) */
+static uint16_t count_workers(uint16_t nb_ports) {
+    const uint32_t nb_pairs = (uint32_t)nb_ports * nb_queues;
+    uint32_t nb_workers;
+
+    /* A single worker lcore has to do both RX and TX */
+    if (cfg.nb_lcores < 2) run_to_completion = 1;
+    nb_workers = run_to_completion ? cfg.nb_lcores : cfg.nb_lcores / 2;
+    if (nb_workers > nb_pairs) nb_workers = nb_pairs;
+    if (nb_workers == 0) rte_exit(EXIT_FAILURE, "No worker lcore available\n");
+
+    return nb_workers;
+}
+
+/* Next unused worker lcore, preferably on the given NUMA node */
+static uint32_t find_lcore(int socket_id, bool *used) {
+    uint32_t lcore_id, remote_id = RTE_MAX_LCORE;
+
+    RTE_LCORE_FOREACH_WORKER(lcore_id) {
+        if (used[lcore_id]) continue;
+        if ((int)rte_lcore_to_socket_id(lcore_id) == socket_id) {
+            remote_id = lcore_id;
+            break;
+        }
+        if (remote_id == RTE_MAX_LCORE) remote_id = lcore_id;
+    }
+
+    /* count_workers() left enough lcores for all the workers */
+    used[remote_id] = true;
+    return remote_id;
+}
+
+/* Counters of the queues of an lcore, on its node. rte_malloc rounds blocks
+ * to cache lines, so no other data shares them.
+ */
+static struct ioat_queue_statistics *alloc_queue_stats(uint32_t lcore_id,
+                                                       uint16_t nb_queues) {
+    struct ioat_queue_statistics *stats = rte_zmalloc_socket(
+        "queue_stats", sizeof(*stats) * nb_queues, RTE_CACHE_LINE_SIZE,
+        rte_lcore_to_socket_id(lcore_id));
+
+    if (stats == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate statistics of lcore %u\n",
+                 lcore_id);
+    return stats;
+}
+
+/* Latency histograms of the packets sent by an lcore, on its node */
+static struct ioat_hist *alloc_latency(uint32_t lcore_id) {
+    struct ioat_hist *latency = rte_zmalloc_socket(
+        "latency", sizeof(*latency) * LATENCY_NB_STAGES, RTE_CACHE_LINE_SIZE,
+        rte_lcore_to_socket_id(lcore_id));
+
+    if (latency == NULL)
+        rte_exit(EXIT_FAILURE,
+                 "Cannot allocate latency histograms of lcore %u\n", lcore_id);
+    return latency;
+}
+
+static struct ioat_idle_statistics *alloc_idle_stats(uint32_t lcore_id) {
+    struct ioat_idle_statistics *stats = rte_zmalloc_socket(
+        "idle_stats", sizeof(*stats), RTE_CACHE_LINE_SIZE,
+        rte_lcore_to_socket_id(lcore_id));
+
+    if (stats == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate idle statistics of lcore %u\n",
+                 lcore_id);
+    return stats;
+}
+
+static void check_lcore_socket(uint16_t worker_id, uint32_t lcore_id,
+                               const struct rxtx_port_config *port) {
+    const int socket_id = rte_lcore_to_socket_id(lcore_id);
+
+    if (!socket_local(socket_id, port->socket_id))
+        NUMA_MISMATCH(
+            "No lcore left on socket %d: worker %u serving port %u runs "
+            "on lcore %u of socket %d\n",
+            port->socket_id, worker_id, port->rxtx_port, lcore_id, socket_id);
+}
+
+/* Spread the (port, RX queue) pairs over the workers, round-robin. A pair
+ * brings its rawdev, ring and TX queue along, so that no two workers share
+ * any of them. Ports are taken node by node, so that a worker mostly serves
+ * a single node, and then gets lcores on that node.
+ */
+static void assign_workers(void) {
+    bool used[RTE_MAX_LCORE] = {false};
+    const uint16_t nb_workers = cfg.nb_workers;
+    uint16_t i, j, w;
+    int socket_id;
+
+    for (w = 0; w < nb_workers; w++) cfg.workers[w].nb_queues = 0;
+
+    w = 0;
+    for (socket_id = 0; socket_id < RTE_MAX_NUMA_NODES; socket_id++) {
+        for (i = 0; i < cfg.nb_ports; i++) {
+            struct rxtx_port_config *port = &cfg.ports[i];
+
+            if (port->socket_id != socket_id) continue;
+            for (j = 0; j < port->nb_queues; j++) {
+                struct worker_config *worker = &cfg.workers[w];
+
+                worker->queues[worker->nb_queues].port = port;
+                worker->queues[worker->nb_queues].queue_id = j;
+                worker->nb_queues++;
+                port->worker_ids[j] = w;
+                /* RX queues j and j + nb_tx_queues go to the same worker,
+                 * as they are given to consecutive workers
+                 */
+                port->tx_queue_ids[j] = j % port->nb_tx_queues;
+                w = (w + 1) % nb_workers;
+            }
+        }
+    }
+
+    for (w = 0; w < nb_workers; w++) {
+        struct worker_config *worker = &cfg.workers[w];
+
+        socket_id = worker->queues[0].port->socket_id;
+        worker->rx_lcore = find_lcore(socket_id, used);
+        worker->tx_lcore = run_to_completion ? worker->rx_lcore
+                                             : find_lcore(socket_id, used);
+
+        /* The queues of a port are next to each other */
+        for (j = 0; j < worker->nb_queues; j++) {
+            if (j > 0 && worker->queues[j].port == worker->queues[j - 1].port)
+                continue;
+            check_lcore_socket(w, worker->rx_lcore, worker->queues[j].port);
+            if (!run_to_completion)
+                check_lcore_socket(w, worker->tx_lcore, worker->queues[j].port);
         }
+
+        worker->rx_stats = alloc_queue_stats(worker->rx_lcore,
+                                             worker->nb_queues);
+        worker->tx_stats =
+            run_to_completion
+                ? worker->rx_stats
+                : alloc_queue_stats(worker->tx_lcore, worker->nb_queues);
+        if (latency_enabled) worker->latency = alloc_latency(worker->tx_lcore);
+        worker->rx_idle = alloc_idle_stats(worker->rx_lcore);
+        worker->tx_idle = run_to_completion
+                              ? worker->rx_idle
+                              : alloc_idle_stats(worker->tx_lcore);
+    }
 }
 
 static void start_forwarding_cores(void) {
-    uint32_t lcore_id = rte_lcore_id();
+    uint16_t w;
 
     RTE_LOG(INFO, IOAT, "Entering %s on lcore %u\n", __func__, rte_lcore_id());
 
-    if (cfg.nb_lcores == 1) {
-        lcore_id = rte_get_next_lcore(lcore_id, true, true);
-        rte_eal_remote_launch((lcore_function_t *)rxtx_main_loop, NULL,
-                              lcore_id);
-    } else if (cfg.nb_lcores > 1) {
-        lcore_id = rte_get_next_lcore(lcore_id, true, true);
-        rte_eal_remote_launch((lcore_function_t *)rx_main_loop, NULL, lcore_id);
+    for (w = 0; w < cfg.nb_workers; w++) {
+        struct worker_config *worker = &cfg.workers[w];
 
-        lcore_id = rte_get_next_lcore(lcore_id, true, true);
-        rte_eal_remote_launch((lcore_function_t *)tx_main_loop, NULL, lcore_id);
+        if (run_to_completion) {
+            rte_eal_remote_launch(rxtx_main_loop, worker, worker->rx_lcore);
+        } else {
+            rte_eal_remote_launch(rx_main_loop, worker, worker->rx_lcore);
+            rte_eal_remote_launch(tx_main_loop, worker, worker->tx_lcore);
+        }
     }
 }
 
@@ -503,9 +2273,58 @@ static void ioat_usage(const char *prgname) {
         "address\n"
         "       - The destination MAC address is replaced by "
         "02:00:00:00:00:TX_PORT_ID\n"
-        "  -c --copy-type CT: type of copy: sw|hw\n"
+        "  -c --copy-type CT: type of copy: sw|hw|hybrid|auto\n"
+        "      hybrid: CPU copy of packets up to the copy threshold, IOAT "
+        "copy of longer ones\n"
+        "      auto: hybrid with the copy threshold calibrated at startup\n"
+        "  -t --copy-threshold LEN: longest packet copied by the CPU in "
+        "hybrid mode (default is 256)\n"
         "  -s --ring-size RS: size of IOAT rawdev ring for hardware copy mode "
-        "or rte_ring for software copy mode\n",
+        "or rte_ring for software copy mode\n"
+        "  --no-handles: configure IOAT rawdevs without handles and track "
+        "copies in application mbuf rings\n"
+        "  --run-to-completion: each worker lcore does both RX and TX, "
+        "rather than one RX and one TX lcore per worker\n"
+        "  --numa-strict: exit rather than warn when a rawdev or worker lcore "
+        "is not on the NUMA node of its port\n"
+        "  -g --staging-size SZ: packets kept per RX queue while its IOAT "
+        "rawdev ring is full, a power of two up to 32768, or 0 to drop them "
+        "(default is 1024)\n"
+        "  -H --header-split LEN: copy only the first LEN bytes of each "
+        "packet, the rest is sent from the received buffer through an "
+        "indirect mbuf (default is 0, copy whole packets)\n"
+        "  --latency: timestamp packets and report percentiles of their "
+        "latency from RX to copy, through the IOAT copy, and to TX\n"
+        "  -i --stats-interval MS: statistics output interval (default is "
+        "1000)\n"
+        "  -f --stats-format FMT: statistics output: text|json|csv (default "
+        "is text)\n"
+        "      json: one JSON object per interval and line\n"
+        "      csv: one row per RX queue and interval\n"
+        "  --headless: print text statistics without refreshing the "
+        "screen\n"
+        "  -b --doorbell-batch N: most IOAT copies submitted per doorbell, "
+        "held back only while the load lets them fill up in time, or 1 to "
+        "ring it for every burst (default is 32)\n"
+        "  -d --doorbell-deadline US: longest wait of a copy for its "
+        "doorbell (default is 5)\n"
+        "  --idle-backoff: when polls come back empty, back off through "
+        "pause, timed pause (on CPUs with WAITPKG) and sleep, rather than "
+        "spinning\n"
+        "  -n --nt-threshold LEN: CPU copies of LEN bytes and more use "
+        "non-temporal stores, which leave the destination out of the caches, "
+        "or 0 to never use them (default is 1024)\n"
+        "  -w --queue-weights W0,W1,...: bursts of completions RX queue 0, 1, "
+        "... of each port may drain per TX round, from 1 to 64 (default is "
+        "1 each)\n"
+        "  -B --tx-budget N: most completions a TX lcore drains per round "
+        "over all its queues, or 0 for no limit (default is 0)\n"
+        "  -J --max-pkt-len LEN: longest frame received, CRC included, up "
+        "to 16128 for jumbo frames; frames longer than an mbuf are received "
+        "and copied as mbuf chains (default is 1518)\n"
+        "  -P --placement FILE: take the IOAT rawdevs from a placement map "
+        "saved by ioat_devices -o, those that passed its self test only, "
+        "local ones first and the fastest first\n",
         prgname);
 }
 
@@ -520,22 +2339,84 @@ static int ioat_parse_portmask(const char *portmask) {
     return pm;
 }
 
+/* Parse a copy threshold in bytes, -1 if not a number up to UINT16_MAX */
+static int ioat_parse_copy_threshold(const char *threshold) {
+    char *end = NULL;
+    unsigned long t;
+
+    /* strtoul takes "-1" as ULONG_MAX */
+    if (!isdigit(threshold[0])) return -1;
+    t = strtoul(threshold, &end, 10);
+    if (end == NULL || *end != '\0' || t > UINT16_MAX) return -1;
+
+    return t;
+}
+
 static copy_mode_t ioat_parse_copy_mode(const char *copy_mode) {
     if (strcmp(copy_mode, COPY_MODE_SW) == 0)
         return COPY_MODE_SW_NUM;
     else if (strcmp(copy_mode, COPY_MODE_IOAT) == 0)
         return COPY_MODE_IOAT_NUM;
+    else if (strcmp(copy_mode, COPY_MODE_HYBRID) == 0)
+        return COPY_MODE_HYBRID_NUM;
+    else if (strcmp(copy_mode, COPY_MODE_AUTO) == 0) {
+        calibrate_threshold = true;
+        return COPY_MODE_HYBRID_NUM;
+    }
 
     return COPY_MODE_INVALID_NUM;
 }
 
+static stats_format_t ioat_parse_stats_format(const char *format) {
+    if (strcmp(format, STATS_FORMAT_TEXT) == 0)
+        return STATS_FORMAT_TEXT_NUM;
+    else if (strcmp(format, STATS_FORMAT_JSON) == 0)
+        return STATS_FORMAT_JSON_NUM;
+    else if (strcmp(format, STATS_FORMAT_CSV) == 0)
+        return STATS_FORMAT_CSV_NUM;
+
+    return STATS_FORMAT_INVALID_NUM;
+}
+
+/* Parse a comma-separated list of weights of RX queues 0, 1, ... */
+static int ioat_parse_queue_weights(const char *list) {
+    const char *p = list;
+    char *end;
+    unsigned long w;
+    unsigned int i;
+
+    for (i = 0; i < MAX_RX_QUEUES_COUNT; i++) {
+        w = strtoul(p, &end, 10);
+        if (end == p || w == 0 || w > MAX_QUEUE_WEIGHT) return -1;
+        queue_weights[i] = w;
+        if (*end == '\0') break;
+        if (*end != ',') return -1;
+        p = end + 1;
+    }
+    if (i == MAX_RX_QUEUES_COUNT) return -1;
+    queue_weights_set = true;
+    return 0;
+}
+
 /* Parse the argument given in the command line of the application */
 static int ioat_parse_args(int argc, char **argv, unsigned int nb_ports) {
     static const char short_options[] =
         "p:" /* portmask */
         "q:" /* number of RX queues per port */
-        "c:" /* copy type (sw|hw) */
+        "c:" /* copy type (sw|hw|hybrid|auto) */
         "s:" /* ring size */
+        "t:" /* copy threshold */
+        "g:" /* staging size */
+        "H:" /* header split length */
+        "i:" /* statistics interval */
+        "f:" /* statistics format */
+        "b:" /* doorbell batch */
+        "d:" /* doorbell deadline */
+        "n:" /* non-temporal copy threshold */
+        "w:" /* queue weights */
+        "B:" /* TX budget */
+        "J:" /* max packet length */
+        "P:" /* placement map */
         ;
 
     static const struct option lgopts[] = {
@@ -545,6 +2426,24 @@ static int ioat_parse_args(int argc, char **argv, unsigned int nb_ports) {
         {CMD_LINE_OPT_NB_QUEUE, required_argument, NULL, 'q'},
         {CMD_LINE_OPT_COPY_TYPE, required_argument, NULL, 'c'},
         {CMD_LINE_OPT_RING_SIZE, required_argument, NULL, 's'},
+        {CMD_LINE_OPT_COPY_THRESHOLD, required_argument, NULL, 't'},
+        {CMD_LINE_OPT_NO_HANDLES, no_argument, &hdls_disable, 1},
+        {CMD_LINE_OPT_RUN_TO_COMPLETION, no_argument, &run_to_completion, 1},
+        {CMD_LINE_OPT_NUMA_STRICT, no_argument, &numa_strict, 1},
+        {CMD_LINE_OPT_STAGING_SIZE, required_argument, NULL, 'g'},
+        {CMD_LINE_OPT_HEADER_SPLIT, required_argument, NULL, 'H'},
+        {CMD_LINE_OPT_LATENCY, no_argument, &latency_enabled, 1},
+        {CMD_LINE_OPT_STATS_INTERVAL, required_argument, NULL, 'i'},
+        {CMD_LINE_OPT_STATS_FORMAT, required_argument, NULL, 'f'},
+        {CMD_LINE_OPT_HEADLESS, no_argument, &headless, 1},
+        {CMD_LINE_OPT_DOORBELL_BATCH, required_argument, NULL, 'b'},
+        {CMD_LINE_OPT_DOORBELL_DEADLINE, required_argument, NULL, 'd'},
+        {CMD_LINE_OPT_IDLE_BACKOFF, no_argument, &idle_backoff_enabled, 1},
+        {CMD_LINE_OPT_NT_THRESHOLD, required_argument, NULL, 'n'},
+        {CMD_LINE_OPT_QUEUE_WEIGHTS, required_argument, NULL, 'w'},
+        {CMD_LINE_OPT_TX_BUDGET, required_argument, NULL, 'B'},
+        {CMD_LINE_OPT_MAX_PKT_LEN, required_argument, NULL, 'J'},
+        {CMD_LINE_OPT_PLACEMENT, required_argument, NULL, 'P'},
         {NULL, 0, 0, 0}};
 
     const unsigned int default_port_mask = (1 << nb_ports) - 1;
@@ -584,7 +2483,7 @@ static int ioat_parse_args(int argc, char **argv, unsigned int nb_ports) {
             case 'c':
                 copy_mode = ioat_parse_copy_mode(optarg);
                 if (copy_mode == COPY_MODE_INVALID_NUM) {
-                    printf("Invalid copy type. Use: sw, hw\n");
+                    printf("Invalid copy type. Use: sw, hw, hybrid, auto\n");
                     ioat_usage(prgname);
                     return -1;
                 }
@@ -599,6 +2498,131 @@ static int ioat_parse_args(int argc, char **argv, unsigned int nb_ports) {
                 }
                 break;
 
+            case 't':
+                ret = ioat_parse_copy_threshold(optarg);
+                if (ret < 0) {
+                    printf("Invalid copy threshold, %s. Max %u\n", optarg,
+                           UINT16_MAX);
+                    ioat_usage(prgname);
+                    return -1;
+                }
+                copy_threshold = ret;
+                break;
+
+            case 'g':
+                ret = atoi(optarg);
+                if (ret < 0 || ret > MAX_STAGING_SIZE ||
+                    (ret > 0 && !rte_is_power_of_2(ret))) {
+                    printf("Invalid staging size, %s.\n", optarg);
+                    ioat_usage(prgname);
+                    return -1;
+                }
+                staging_size = ret;
+                break;
+
+            case 'H':
+                ret = atoi(optarg);
+                if (ret < 0 || ret > RTE_MBUF_DEFAULT_DATAROOM) {
+                    printf("Invalid header split length, %s.\n", optarg);
+                    ioat_usage(prgname);
+                    return -1;
+                }
+                header_split_len = ret;
+                break;
+
+            case 'i':
+                ret = atoi(optarg);
+                if (ret <= 0) {
+                    printf("Invalid statistics interval, %s.\n", optarg);
+                    ioat_usage(prgname);
+                    return -1;
+                }
+                stats_interval_ms = ret;
+                break;
+
+            case 'b':
+                ret = atoi(optarg);
+                if (ret <= 0 || ret > UINT16_MAX) {
+                    printf("Invalid doorbell batch, %s.\n", optarg);
+                    ioat_usage(prgname);
+                    return -1;
+                }
+                doorbell_batch = ret;
+                break;
+
+            case 'd':
+                ret = atoi(optarg);
+                if (ret <= 0) {
+                    printf("Invalid doorbell deadline, %s.\n", optarg);
+                    ioat_usage(prgname);
+                    return -1;
+                }
+                doorbell_deadline_us = ret;
+                break;
+
+            case 'n':
+                ret = atoi(optarg);
+                if (ret < 0) {
+                    printf("Invalid non-temporal copy threshold, %s.\n",
+                           optarg);
+                    ioat_usage(prgname);
+                    return -1;
+                }
+                nt_threshold = ret;
+                break;
+
+            case 'w':
+                if (ioat_parse_queue_weights(optarg) < 0) {
+                    printf("Invalid queue weights, %s.\n", optarg);
+                    ioat_usage(prgname);
+                    return -1;
+                }
+                break;
+
+            case 'B':
+                ret = atoi(optarg);
+                if (ret < 0) {
+                    printf("Invalid TX budget, %s.\n", optarg);
+                    ioat_usage(prgname);
+                    return -1;
+                }
+                tx_budget = ret;
+                break;
+
+            case 'J':
+                ret = atoi(optarg);
+                if (ret < RTE_ETHER_MIN_LEN ||
+                    ret > RTE_ETHER_MAX_JUMBO_FRAME_LEN) {
+                    printf("Invalid max packet length, %s. Max %u\n", optarg,
+                           RTE_ETHER_MAX_JUMBO_FRAME_LEN);
+                    ioat_usage(prgname);
+                    return -1;
+                }
+                max_pkt_len = ret;
+                max_pkt_segs = (max_pkt_len + RTE_MBUF_DEFAULT_DATAROOM - 1) /
+                               RTE_MBUF_DEFAULT_DATAROOM;
+                break;
+
+            case 'P':
+                ret = ioat_placement_load(optarg, &placement);
+                if (ret <= 0) {
+                    printf("Invalid placement map, %s: %s.\n", optarg,
+                           ret < 0 ? strerror(-ret) : "no channel");
+                    ioat_usage(prgname);
+                    return -1;
+                }
+                placement_file = optarg;
+                break;
+
+            case 'f':
+                stats_format = ioat_parse_stats_format(optarg);
+                if (stats_format == STATS_FORMAT_INVALID_NUM) {
+                    printf("Invalid statistics format. Use: text, json, csv\n");
+                    ioat_usage(prgname);
+                    return -1;
+                }
+                break;
+
             /* long options */
             case 0:
                 break;
@@ -609,6 +2633,13 @@ static int ioat_parse_args(int argc, char **argv, unsigned int nb_ports) {
         }
     }
 
+    /* The payload mbuf references the first segment only */
+    if (header_split_len > 0 && max_pkt_segs > 1) {
+        printf("Header split does not support frames longer than an mbuf\n");
+        ioat_usage(prgname);
+        return -1;
+    }
+
     printf("MAC updating %s\n", mac_updating ? "enabled" : "disabled");
     if (optind >= 0) argv[optind - 1] = prgname;
 
@@ -645,7 +2676,8 @@ static int check_link_status(uint32_t port_mask) {
 }
 
 static void configure_rawdev_queue(uint32_t dev_id) {
-    struct rte_ioat_rawdev_config dev_config = {.ring_size = ring_size};
+    struct rte_ioat_rawdev_config dev_config = {
+        .ring_size = ring_size, .hdls_disable = hdls_disable};
     struct rte_rawdev_info info = {.dev_private = &dev_config};
 
     if (rte_rawdev_configure(dev_id, &info, sizeof(dev_config)) != 0) {
@@ -656,23 +2688,88 @@ static void configure_rawdev_queue(uint32_t dev_id) {
     }
 }
 
+static void init_mbuf_ring(struct ioat_mbuf_ring *mbuf_ring, int socket_id) {
+    /* Same size as the rawdev ring, which checked it is a power of two */
+    mbuf_ring->head = mbuf_ring->tail = 0;
+    mbuf_ring->mask = ring_size - 1;
+    mbuf_ring->srcs = rte_zmalloc_socket(
+        "mbuf_ring", sizeof(void *) * ring_size, RTE_CACHE_LINE_SIZE, socket_id);
+    mbuf_ring->dsts = rte_zmalloc_socket(
+        "mbuf_ring", sizeof(void *) * ring_size, RTE_CACHE_LINE_SIZE, socket_id);
+    if (mbuf_ring->srcs == NULL || mbuf_ring->dsts == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate mbuf ring\n");
+}
+
+static void init_staging(struct ioat_staging *staging, int socket_id) {
+    memset(staging, 0, sizeof(*staging));
+    if (staging_size == 0) return;
+
+    staging->size = staging_size;
+    staging->mask = staging_size - 1;
+    staging->pkts =
+        rte_zmalloc_socket("staging", sizeof(void *) * staging_size,
+                           RTE_CACHE_LINE_SIZE, socket_id);
+    if (staging->pkts == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate staging queue\n");
+}
+
+/* Next unused IOAT rawdev, preferably on the given NUMA node. With a
+ * placement map, in the order of the map.
+ */
+static int find_rawdev(int socket_id, const bool *used) {
+    struct rte_rawdev_info rdev_info;
+    int dev_id, remote_id = -1;
+
+    if (placement_file != NULL) {
+        uint16_t ids[IOAT_PLACEMENT_MAX_CHANNELS];
+        const unsigned int n =
+            ioat_placement_order(&placement, socket_id, ids, RTE_DIM(ids));
+        unsigned int i;
+
+        for (i = 0; i < n; i++)
+            if (!used[ids[i]]) return ids[i];
+        return -1;
+    }
+
+    for (dev_id = 0; dev_id < rte_rawdev_count(); dev_id++) {
+        if (used[dev_id]) continue;
+        memset(&rdev_info, 0, sizeof(rdev_info));
+        rte_rawdev_info_get(dev_id, &rdev_info, 0);
+        if (!ioat_dev_driver_supported(rdev_info.driver_name)) continue;
+
+        if (socket_local(rte_rawdev_socket_id(dev_id), socket_id))
+            return dev_id;
+        if (remote_id < 0) remote_id = dev_id;
+    }
+    return remote_id;
+}
+
 static void assign_rawdevs(void) {
-    uint16_t nb_rawdev = 0, rdev_id = 0;
+    bool used[RTE_RAWDEV_MAX_DEVS] = {false};
+    uint16_t nb_rawdev = 0;
     uint32_t i, j;
+    int dev_id;
 
     for (i = 0; i < cfg.nb_ports; i++) {
-        for (j = 0; j < cfg.ports[i].nb_queues; j++) {
-            struct rte_rawdev_info rdev_info = {0};
-
-            do {
-                if (rdev_id == rte_rawdev_count()) goto end;
-                rte_rawdev_info_get(rdev_id++, &rdev_info, 0);
-            } while (rdev_info.driver_name == NULL ||
-                     strcmp(rdev_info.driver_name, IOAT_PMD_RAWDEV_NAME_STR) !=
-                         0);
-
-            cfg.ports[i].ioat_ids[j] = rdev_id - 1;
-            configure_rawdev_queue(cfg.ports[i].ioat_ids[j]);
+        struct rxtx_port_config *port = &cfg.ports[i];
+
+        for (j = 0; j < port->nb_queues; j++) {
+            dev_id = find_rawdev(port->socket_id, used);
+            if (dev_id < 0) goto end;
+            if (!socket_local(rte_rawdev_socket_id(dev_id), port->socket_id))
+                NUMA_MISMATCH(
+                    "No IOAT rawdev left on socket %d: port %u queue %u "
+                    "uses rawdev %d of socket %d\n",
+                    port->socket_id, port->rxtx_port, j, dev_id,
+                    rte_rawdev_socket_id(dev_id));
+
+            used[dev_id] = true;
+            port->ioat_ids[j] = dev_id;
+            configure_rawdev_queue(dev_id);
+            if (hdls_disable)
+                init_mbuf_ring(&port->mbuf_rings[j], port->socket_id);
+            init_staging(&port->stagings[j], port->socket_id);
+            port->doorbells[j] = (struct ioat_doorbell){.threshold = 1};
             ++nb_rawdev;
         }
     }
@@ -682,24 +2779,117 @@ end:
                  "Not enough IOAT rawdevs (%u) for all queues (%u).\n",
                  nb_rawdev, cfg.nb_ports * cfg.ports[0].nb_queues);
     RTE_LOG(INFO, IOAT, "Number of used rawdevs: %u.\n", nb_rawdev);
+    if (placement_file != NULL)
+        RTE_LOG(INFO, IOAT, "Rawdevs picked from placement map %s.\n",
+                placement_file);
+}
+
+/* Candidate thresholds for the calibration of hybrid copy mode */
+static const uint16_t calib_lengths[] = {64, 128, 256, 512, 1024, 1518};
+#define CALIB_ROUNDS 256
+
+/* Measure the worker cycles per packet of a CPU copy and of an IOAT copy
+ * (enqueue, doorbell and completion, not the wait for the hardware) for each
+ * candidate length. The threshold is the longest length up to which the CPU
+ * copy is the cheaper one.
+ */
+static void calibrate_copy_threshold(struct rte_mempool *pool,
+                                     uint16_t dev_id) {
+    struct rte_mbuf *srcs[MAX_PKT_BURST], *dsts[MAX_PKT_BURST];
+    uintptr_t src_hdls[MAX_PKT_BURST], dst_hdls[MAX_PKT_BURST];
+    uint64_t sw_cycles, hw_cycles, start;
+    uint32_t i, j, r, nb_enq, nb_done;
+    bool crossed = false;
+    int ret;
+
+    if (rte_pktmbuf_alloc_bulk(pool, srcs, MAX_PKT_BURST) != 0)
+        rte_exit(EXIT_FAILURE, "Unable to allocate memory.\n");
+    if (rte_pktmbuf_alloc_bulk(pool, dsts, MAX_PKT_BURST) != 0)
+        rte_exit(EXIT_FAILURE, "Unable to allocate memory.\n");
+
+    const uint64_t addr_offset =
+        RTE_PTR_DIFF(srcs[0]->buf_addr, &srcs[0]->rearm_data);
+
+    copy_threshold = 0;
+    for (i = 0; i < RTE_DIM(calib_lengths); i++) {
+        for (j = 0; j < MAX_PKT_BURST; j++)
+            srcs[j]->data_len = srcs[j]->pkt_len = calib_lengths[i];
+
+        start = rte_rdtsc();
+        for (r = 0; r < CALIB_ROUNDS; r++)
+            for (j = 0; j < MAX_PKT_BURST; j++)
+                pktmbuf_sw_copy(srcs[j], dsts[j]);
+        sw_cycles = rte_rdtsc() - start;
+
+        hw_cycles = 0;
+        for (r = 0; r < CALIB_ROUNDS; r++) {
+            start = rte_rdtsc();
+            for (nb_enq = 0; nb_enq < MAX_PKT_BURST; nb_enq++)
+                if (ioat_dev_enqueue_copy(
+                        dev_id, srcs[nb_enq]->buf_iova - addr_offset,
+                        dsts[nb_enq]->buf_iova - addr_offset,
+                        calib_lengths[i] + addr_offset, (uintptr_t)srcs[nb_enq],
+                        (uintptr_t)dsts[nb_enq]) != 1)
+                    break;
+            ioat_dev_perform_ops(dev_id);
+            hw_cycles += rte_rdtsc() - start;
+
+            for (nb_done = 0; nb_done < nb_enq; nb_done += ret) {
+                start = rte_rdtsc();
+                ret = ioat_dev_completed_ops(dev_id, MAX_PKT_BURST, src_hdls,
+                                             dst_hdls);
+                if (ret < 0)
+                    rte_exit(EXIT_FAILURE, "IOAT completion failed: %s\n",
+                             rte_strerror(rte_errno));
+                if (ret > 0) hw_cycles += rte_rdtsc() - start;
+            }
+        }
+
+        RTE_LOG(INFO, IOAT,
+                "Copy of %u bytes: CPU %" PRIu64 ", IOAT %" PRIu64
+                " cycles per packet\n",
+                calib_lengths[i], sw_cycles / (CALIB_ROUNDS * MAX_PKT_BURST),
+                hw_cycles / (CALIB_ROUNDS * MAX_PKT_BURST));
+
+        crossed |= (sw_cycles > hw_cycles);
+        if (!crossed) copy_threshold = calib_lengths[i];
+    }
+
+    rte_pktmbuf_free_bulk(srcs, MAX_PKT_BURST);
+    rte_pktmbuf_free_bulk(dsts, MAX_PKT_BURST);
+
+    RTE_LOG(INFO, IOAT, "Calibrated copy threshold: %u bytes\n",
+            copy_threshold);
 }
 
 static void assign_rings(void) {
-    uint32_t i;
+    uint32_t i, j;
 
     for (i = 0; i < cfg.nb_ports; i++) {
-        char ring_name[RTE_RING_NAMESIZE];
+        for (j = 0; j < cfg.ports[i].nb_queues; j++) {
+            char ring_name[RTE_RING_NAMESIZE];
+
+            snprintf(ring_name, sizeof(ring_name), "rx_to_tx_ring_%u_%u", i,
+                     j);
+            /* Create ring for inter core communication, one per RX queue
+             * as a queue is served by a single worker
+             */
+            cfg.ports[i].rx_to_tx_rings[j] =
+                rte_ring_create(ring_name, ring_size, cfg.ports[i].socket_id,
+                                RING_F_SP_ENQ | RING_F_SC_DEQ);
+
+            if (cfg.ports[i].rx_to_tx_rings[j] == NULL)
+                rte_exit(EXIT_FAILURE, "Ring create failed: %s\n",
+                         rte_strerror(rte_errno));
+        }
+    }
+}
 
-        snprintf(ring_name, sizeof(ring_name), "rx_to_tx_ring_%u", i);
-        /* Create ring for inter core communication */
-        cfg.ports[i].rx_to_tx_ring =
-            rte_ring_create(ring_name, ring_size, rte_socket_id(),
-                            RING_F_SP_ENQ | RING_F_SC_DEQ);
+/* NUMA node of a port, the one of the main lcore if unknown */
+static int port_socket_id(uint16_t portid) {
+    const int socket_id = rte_eth_dev_socket_id(portid);
 
-        if (cfg.ports[i].rx_to_tx_ring == NULL)
-            rte_exit(EXIT_FAILURE, "Ring create failed: %s\n",
-                     rte_strerror(rte_errno));
-    }
+    return socket_id < 0 ? (int)rte_socket_id() : socket_id;
 }
 
 /*
@@ -707,7 +2897,7 @@ static void assign_rings(void) {
  * coming from the mbuf_pool passed as a parameter.
  */
 static inline void port_init(uint16_t portid, struct rte_mempool *mbuf_pool,
-                             uint16_t nb_queues) {
+                             uint16_t nb_queues, uint16_t nb_tx_queues) {
     /* configuring port to use RSS for multiple RX queues */
     static const struct rte_eth_conf port_conf = {
         .rxmode = {.mq_mode = ETH_MQ_RX_RSS,
@@ -739,15 +2929,57 @@ static inline void port_init(uint16_t portid, struct rte_mempool *mbuf_pool,
 
     local_port_conf.rx_adv_conf.rss_conf.rss_hf &=
         dev_info.flow_type_rss_offloads;
-    if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE)
+    if (max_pkt_len > RTE_ETHER_MAX_LEN) {
+        if (!(dev_info.rx_offload_capa & DEV_RX_OFFLOAD_JUMBO_FRAME) ||
+            max_pkt_len > dev_info.max_rx_pktlen)
+            rte_exit(EXIT_FAILURE,
+                     "Port %u cannot receive %u byte frames, max %u\n",
+                     portid, max_pkt_len, dev_info.max_rx_pktlen);
+        local_port_conf.rxmode.offloads |= DEV_RX_OFFLOAD_JUMBO_FRAME;
+        local_port_conf.rxmode.max_rx_pkt_len = max_pkt_len;
+    }
+    /* Frames longer than an mbuf are received as chains */
+    if (max_pkt_segs > 1) {
+        if (!(dev_info.rx_offload_capa & DEV_RX_OFFLOAD_SCATTER))
+            rte_exit(EXIT_FAILURE,
+                     "Port %u cannot receive frames into mbuf chains\n",
+                     portid);
+        local_port_conf.rxmode.offloads |= DEV_RX_OFFLOAD_SCATTER;
+    }
+    /* Header split sends two segment packets, one of them indirect, and
+     * jumbo frames chains, which fast free does not handle
+     */
+    if (header_split_len > 0 || max_pkt_segs > 1) {
+        if (!(dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MULTI_SEGS))
+            rte_exit(EXIT_FAILURE,
+                     "Port %u cannot send multi-segment packets for %s\n",
+                     portid,
+                     header_split_len > 0 ? "header split" : "jumbo frames");
+        local_port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MULTI_SEGS;
+    } else if (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_MBUF_FAST_FREE) {
         local_port_conf.txmode.offloads |= DEV_TX_OFFLOAD_MBUF_FAST_FREE;
-    ret = rte_eth_dev_configure(portid, nb_queues, 1, &local_port_conf);
+    }
+    if (nb_tx_queues > dev_info.max_tx_queues)
+        rte_exit(EXIT_FAILURE,
+                 "Port %u has %u TX queues, %u workers need one each\n",
+                 portid, dev_info.max_tx_queues, nb_tx_queues);
+    ret = rte_eth_dev_configure(portid, nb_queues, nb_tx_queues,
+                                &local_port_conf);
     if (ret < 0)
         rte_exit(EXIT_FAILURE,
                  "Cannot configure device:"
                  " err=%d, port=%u\n",
                  ret, portid);
 
+    /* Not all drivers take the MTU from max_rx_pkt_len */
+    if (max_pkt_len > RTE_ETHER_MAX_LEN) {
+        ret = rte_eth_dev_set_mtu(
+            portid, max_pkt_len - RTE_ETHER_HDR_LEN - RTE_ETHER_CRC_LEN);
+        if (ret < 0 && ret != -ENOTSUP)
+            rte_exit(EXIT_FAILURE, "Cannot set MTU: %s, port=%u\n",
+                     rte_strerror(-ret), portid);
+    }
+
     ret = rte_eth_dev_adjust_nb_rx_tx_desc(portid, &nb_rxd, &nb_txd);
     if (ret < 0)
         rte_exit(EXIT_FAILURE,
@@ -769,32 +3001,17 @@ static inline void port_init(uint16_t portid, struct rte_mempool *mbuf_pool,
                      ret, portid, i);
     }
 
-    /* Init one TX queue on each port */
+    /* Init one TX queue per worker transmitting on the port */
     txq_conf = dev_info.default_txconf;
     txq_conf.offloads = local_port_conf.txmode.offloads;
-    ret = rte_eth_tx_queue_setup(portid, 0, nb_txd,
-                                 rte_eth_dev_socket_id(portid), &txq_conf);
-    if (ret < 0)
-        rte_exit(EXIT_FAILURE, "rte_eth_tx_queue_setup:err=%d,port=%u\n", ret,
-                 portid);
-
-    /* Initialize TX buffers */
-    tx_buffer[portid] =
-        rte_zmalloc_socket("tx_buffer", RTE_ETH_TX_BUFFER_SIZE(MAX_PKT_BURST),
-                           0, rte_eth_dev_socket_id(portid));
-    if (tx_buffer[portid] == NULL)
-        rte_exit(EXIT_FAILURE, "Cannot allocate buffer for tx on port %u\n",
-                 portid);
-
-    rte_eth_tx_buffer_init(tx_buffer[portid], MAX_PKT_BURST);
-
-    ret = rte_eth_tx_buffer_set_err_callback(
-        tx_buffer[portid], rte_eth_tx_buffer_count_callback,
-        &port_statistics.tx_dropped[portid]);
-    if (ret < 0)
-        rte_exit(EXIT_FAILURE,
-                 "Cannot set error callback for tx buffer on port %u\n",
-                 portid);
+    for (i = 0; i < nb_tx_queues; i++) {
+        ret = rte_eth_tx_queue_setup(portid, i, nb_txd,
+                                     rte_eth_dev_socket_id(portid), &txq_conf);
+        if (ret < 0)
+            rte_exit(EXIT_FAILURE,
+                     "rte_eth_tx_queue_setup:err=%d,port=%u, queue_id=%u\n",
+                     ret, portid, i);
+    }
 
     /* Start device */
     ret = rte_eth_dev_start(portid);
@@ -813,6 +3030,9 @@ static inline void port_init(uint16_t portid, struct rte_mempool *mbuf_pool,
            ioat_ports_eth_addr[portid].addr_bytes[5]);
 
     cfg.ports[cfg.nb_ports].rxtx_port = portid;
+    cfg.ports[cfg.nb_ports].socket_id = port_socket_id(portid);
+    cfg.ports[cfg.nb_ports].pktmbuf_pool = mbuf_pool;
+    cfg.ports[cfg.nb_ports].nb_tx_queues = nb_tx_queues;
     cfg.ports[cfg.nb_ports++].nb_queues = nb_queues;
 }
 
@@ -825,9 +3045,11 @@ static void signal_handler(int signum) {
 
 int main(int argc, char **argv) {
     int ret;
-    uint16_t nb_ports, portid;
+    uint16_t nb_ports, nb_enabled_ports, portid;
+    uint16_t nb_socket_ports[RTE_MAX_NUMA_NODES] = {0};
     uint32_t i;
-    unsigned int nb_mbufs;
+    unsigned int nb_mbufs, nb_tx_mbufs;
+    char pool_name[RTE_MEMPOOL_NAMESIZE];
 
     /* Init EAL */
     ret = rte_eal_init(argc, argv);
@@ -845,39 +3067,82 @@ int main(int argc, char **argv) {
     /* Parse application arguments (after the EAL ones) */
     ret = ioat_parse_args(argc, argv, nb_ports);
     if (ret < 0) rte_exit(EXIT_FAILURE, "Invalid IOAT arguments\n");
+    doorbell_deadline_tsc = rte_get_tsc_hz() * doorbell_deadline_us / 1000000;
+    idle_pause_tsc = rte_get_tsc_hz() * IDLE_PAUSE_US / 1000000;
+    idle_tpause_tsc = rte_get_tsc_hz() * IDLE_TPAUSE_US / 1000000;
+    idle_sleep_tsc = rte_get_tsc_hz() * IDLE_SLEEP_US / 1000000;
+    idle_tpause_len_tsc = rte_get_tsc_hz() * IDLE_TPAUSE_LEN_US / 1000000;
+    idle_has_tpause = rte_cpu_get_flag_enabled(RTE_CPUFLAG_WAITPKG) > 0;
+    ioat_copy_init(nt_threshold);
+
+    if (latency_enabled) {
+        static const struct rte_mbuf_dynfield latency_ts_desc = {
+            .name = "ioat_fwd_latency_ts",
+            .size = sizeof(struct latency_ts),
+            .align = __alignof__(struct latency_ts),
+        };
+
+        latency_ts_offset = rte_mbuf_dynfield_register(&latency_ts_desc);
+        if (latency_ts_offset < 0)
+            rte_exit(EXIT_FAILURE, "Cannot register latency timestamps: %s\n",
+                     rte_strerror(rte_errno));
+    }
 
-    nb_mbufs =
-        RTE_MAX(nb_ports * (nb_queues * (nb_rxd + nb_txd + 4 * MAX_PKT_BURST) +
-                            rte_lcore_count() * MEMPOOL_CACHE_SIZE),
-                MIN_POOL_SIZE);
-
-    /* Create the mbuf pool */
-    ioat_pktmbuf_pool =
-        rte_pktmbuf_pool_create("mbuf_pool", nb_mbufs, MEMPOOL_CACHE_SIZE, 0,
-                                RTE_MBUF_DEFAULT_BUF_SIZE, rte_socket_id());
-    if (ioat_pktmbuf_pool == NULL)
-        rte_exit(EXIT_FAILURE, "Cannot init mbuf pool\n");
-
-    /* Initialise each port */
-    cfg.nb_ports = 0;
+    nb_enabled_ports = 0;
     RTE_ETH_FOREACH_DEV(portid)
-    port_init(portid, ioat_pktmbuf_pool, nb_queues);
-
-    /* Initialize port xstats */
-    memset(&port_statistics, 0, sizeof(port_statistics));
+    if (ioat_enabled_port_mask & (1 << portid)) {
+        nb_socket_ports[port_socket_id(portid)]++;
+        nb_enabled_ports++;
+    }
 
-    while (!check_link_status(ioat_enabled_port_mask) && !force_quit) sleep(1);
+    /* With header split, a packet being sent also holds a payload mbuf and
+     * the received mbuf, with jumbo frames a chain of mbufs
+     */
+    nb_tx_mbufs = header_split_len > 0 ? 3 : max_pkt_segs;
+
+    /* Create the mbuf pools, one on the NUMA node of each port */
+    for (i = 0; i < RTE_MAX_NUMA_NODES; i++) {
+        if (nb_socket_ports[i] == 0) continue;
+
+        nb_mbufs = RTE_MAX(
+            nb_socket_ports[i] *
+                    (nb_queues *
+                     (nb_rxd + nb_txd * nb_tx_mbufs +
+                      (4 * MAX_PKT_BURST + staging_size) * max_pkt_segs)) +
+                rte_lcore_count() * MEMPOOL_CACHE_SIZE,
+            MIN_POOL_SIZE);
+        snprintf(pool_name, sizeof(pool_name), "mbuf_pool_%u", i);
+        ioat_pktmbuf_pools[i] =
+            rte_pktmbuf_pool_create(pool_name, nb_mbufs, MEMPOOL_CACHE_SIZE, 0,
+                                    RTE_MBUF_DEFAULT_BUF_SIZE, i);
+        if (ioat_pktmbuf_pools[i] == NULL)
+            rte_exit(EXIT_FAILURE, "Cannot init mbuf pool on socket %u\n", i);
+    }
 
     /* Check if there is enough lcores for all ports. */
     cfg.nb_lcores = rte_lcore_count() - 1;
     if (cfg.nb_lcores < 1)
         rte_exit(EXIT_FAILURE, "There should be at least one worker lcore.\n");
 
-    if (copy_mode == COPY_MODE_IOAT_NUM)
-        assign_rawdevs();
-    else /* copy_mode == COPY_MODE_SW_NUM */
-        assign_rings();
+    /* The worker layout gives the number of TX queues of the ports */
+    cfg.nb_workers = count_workers(nb_enabled_ports);
+
+    /* Initialise each port */
+    cfg.nb_ports = 0;
+    RTE_ETH_FOREACH_DEV(portid)
+    port_init(portid, ioat_pktmbuf_pools[port_socket_id(portid)], nb_queues,
+              RTE_MIN(nb_queues, cfg.nb_workers));
+
+    while (!check_link_status(ioat_enabled_port_mask) && !force_quit) sleep(1);
+
+    if (copy_mode != COPY_MODE_SW_NUM) assign_rawdevs();
+    if (copy_mode != COPY_MODE_IOAT_NUM) assign_rings();
+    if (copy_mode == COPY_MODE_HYBRID_NUM && calibrate_threshold)
+        calibrate_copy_threshold(cfg.ports[0].pktmbuf_pool,
+                                 cfg.ports[0].ioat_ids[0]);
 
+    assign_workers();
+    register_telemetry();
     start_forwarding_cores();
     /* main core prints stats while other cores forward */
     print_stats(argv[0]);
@@ -894,13 +3159,24 @@ int main(int argc, char **argv) {
                     rte_strerror(-ret), cfg.ports[i].rxtx_port);
 
         rte_eth_dev_close(cfg.ports[i].rxtx_port);
-        if (copy_mode == COPY_MODE_IOAT_NUM) {
+        if (copy_mode != COPY_MODE_SW_NUM) {
             for (j = 0; j < cfg.ports[i].nb_queues; j++) {
                 printf("Stopping rawdev %d\n", cfg.ports[i].ioat_ids[j]);
                 rte_rawdev_stop(cfg.ports[i].ioat_ids[j]);
+                rte_free(cfg.ports[i].mbuf_rings[j].srcs);
+                rte_free(cfg.ports[i].mbuf_rings[j].dsts);
+                rte_free(cfg.ports[i].stagings[j].pkts);
             }
-        } else /* copy_mode == COPY_MODE_SW_NUM */
-            rte_ring_free(cfg.ports[i].rx_to_tx_ring);
+        }
+        if (copy_mode != COPY_MODE_IOAT_NUM)
+            for (j = 0; j < cfg.ports[i].nb_queues; j++)
+                rte_ring_free(cfg.ports[i].rx_to_tx_rings[j]);
+    }
+    for (i = 0; i < cfg.nb_workers; i++) {
+        rte_free(cfg.workers[i].latency);
+        if (cfg.workers[i].tx_idle != cfg.workers[i].rx_idle)
+            rte_free(cfg.workers[i].tx_idle);
+        rte_free(cfg.workers[i].rx_idle);
     }
 
     printf("Bye...\n");
@@ -0,0 +1,417 @@
+// \ref https://doc.dpdk.org/guides-20.11/rawdevs/ioat.html
+// \ref https://man7.org/linux/man-pages/man8/ld.so.8.html
+//
+// LD_PRELOAD library which offloads large memcpy and memmove calls to IOAT
+// channels, for programs that cannot be changed to call rte_ioat_* directly:
+//
+//   LD_PRELOAD=./build/libioat_preload.so IOAT_PRELOAD_THRESHOLD=4M prog args
+//
+// Settings come from the environment:
+//   IOAT_PRELOAD_EAL_ARGS: EAL arguments (default: "-l 0 --iova-mode=va
+//       --in-memory --log-level=0")
+//   IOAT_PRELOAD_THRESHOLD: smallest copy offloaded (default: 1M)
+//   IOAT_PRELOAD_CACHE_BYTES: user memory kept mapped after a copy (default:
+//       0). Only safe for programs which never give their buffers back to the
+//       OS, as the IOMMU keeps pointing at the pinned pages of a stale mapping.
+//
+// Each thread claims a channel of its own on its first large copy, waits for
+// its copies to complete before returning, and gives the channel back when it
+// exits. A copy is done by the CPU if no channel was free, the ranges overlap,
+// or a buffer cannot be mapped for DMA, eg read-only memory.
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dlfcn.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ioat_dev.h"
+#include "ioat_regcache.h"
+#include "rte_eal.h"
+#include "rte_ethdev.h"  // Not include this header will cause BUGs
+#include "rte_ioat_rawdev.h"
+#include "rte_rawdev.h"
+
+#define KB(x) ((x) << 10)
+#define MB(x) ((x) << 20)
+#define GB(x) ((x) << 30)
+
+#define MAX_CHANNELS 16
+#define MAX_EAL_ARGS 64
+#define RING_SIZE 512
+#define MAX_XFER MB(1UL)  // bytes per descriptor
+#define COMPLETION_BURST 64
+// Small copies are counted per thread, and added to the totals this often
+#define STATS_FLUSH_COPIES 1024
+// How long the destructor waits for copies of other threads to finish
+#define FINI_TIMEOUT_MS 1000
+
+#define DEFAULT_EAL_ARGS "-l 0 --iova-mode=va --in-memory --log-level=0"
+
+typedef void *(*copy_fn)(void *, const void *, size_t);
+
+struct preload_stats {
+    uint64_t ioat_copies, ioat_bytes;
+    uint64_t cpu_copies, cpu_bytes;
+    uint64_t fallbacks;  // large copies the channels could not take
+};
+
+static copy_fn libc_memcpy, libc_memmove;
+
+static struct {
+    volatile bool ready;
+    size_t threshold;
+    uint16_t channels[MAX_CHANNELS];
+    unsigned int nb_channels;
+    // Indexes of the channels no thread holds; a failed channel is never
+    // put back
+    unsigned int free_channels[MAX_CHANNELS];
+    unsigned int nb_free;
+    pthread_mutex_t lock;
+    pthread_key_t channel_key;  // gives the channel back on thread exit
+    unsigned int nb_copying;    // threads inside ioat_copy
+    struct ioat_regcache *regcache;  // NULL if all channels are software
+} preload = {.threshold = MB(1UL), .lock = PTHREAD_MUTEX_INITIALIZER};
+
+static struct preload_stats stats;
+
+// Loaded at startup, so the static TLS model is available, and it keeps
+// __tls_get_addr, which may allocate, out of memcpy
+#define PRELOAD_TLS __thread __attribute__((tls_model("initial-exec")))
+
+static PRELOAD_TLS bool in_preload;  // DPDK calls memcpy too
+static PRELOAD_TLS int channel = -1;  // claimed channel index, -1 if none
+static PRELOAD_TLS struct preload_stats thread_stats;
+
+// Used until libc is resolved, which must not be turned into a memcpy call
+static void *byte_move(void *dst, const void *src, size_t n) {
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    if (d < s)
+        while (n--) *d++ = *s++;
+    else
+        while (n--) d[n] = s[n];
+    return dst;
+}
+
+static void count_cpu_copy(size_t n) {
+    thread_stats.cpu_copies++;
+    thread_stats.cpu_bytes += n;
+    if (thread_stats.cpu_copies % STATS_FLUSH_COPIES != 0) return;
+
+    __atomic_fetch_add(&stats.cpu_copies, thread_stats.cpu_copies,
+                       __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats.cpu_bytes, thread_stats.cpu_bytes,
+                       __ATOMIC_RELAXED);
+    thread_stats.cpu_copies = 0;
+    thread_stats.cpu_bytes = 0;
+}
+
+// A thread without a channel tries again on each large copy, as threads
+// exiting give theirs back
+static int claim_channel(void) {
+    if (channel >= 0) return channel;
+    if (__atomic_load_n(&preload.nb_free, __ATOMIC_RELAXED) == 0) return -1;
+
+    pthread_mutex_lock(&preload.lock);
+    if (preload.nb_free > 0)
+        channel = preload.free_channels[--preload.nb_free];
+    pthread_mutex_unlock(&preload.lock);
+
+    // The key holds the index plus one, as NULL skips the destructor
+    if (channel >= 0)
+        pthread_setspecific(preload.channel_key,
+                            (void *)(uintptr_t)(channel + 1));
+    return channel;
+}
+
+static void release_channel(void *value) {
+    pthread_mutex_lock(&preload.lock);
+    preload.free_channels[preload.nb_free++] = (uintptr_t)value - 1;
+    pthread_mutex_unlock(&preload.lock);
+}
+
+// Copy with the channel of the thread and wait for it, false if the copy is
+// left to the CPU
+static bool ioat_copy(void *dst, const void *src, size_t n) {
+    uintptr_t hdls[COMPLETION_BURST];
+    uint64_t nb_enq = 0, nb_done = 0;
+    size_t off = 0;
+    bool mapped, failed = false;
+    int ch, ret;
+
+    ch = claim_channel();
+    if (ch < 0) return false;
+    const uint16_t dev_id = preload.channels[ch];
+
+    // Software channels work on virtual addresses and need no IOMMU mapping
+    mapped = preload.regcache != NULL && ioat_sw_devs[dev_id] == NULL;
+    if (mapped) {
+        if (ioat_regcache_map(preload.regcache, src, n) < 0) return false;
+        if (ioat_regcache_map(preload.regcache, dst, n) < 0) {
+            ioat_regcache_unmap(preload.regcache, src, n);
+            return false;
+        }
+    }
+
+    // IOVA as VA, see the EAL arguments
+    while (off < n || nb_done < nb_enq) {
+        unsigned int nb_batch = 0;
+
+        while (off < n) {
+            const size_t len = RTE_MIN(MAX_XFER, n - off);
+
+            if (ioat_dev_enqueue_copy(dev_id, (uintptr_t)src + off,
+                                      (uintptr_t)dst + off, len, 0, 0) != 1)
+                break;
+            off += len;
+            nb_enq++;
+            nb_batch++;
+        }
+        if (nb_batch > 0) ioat_dev_perform_ops(dev_id);
+
+        ret = ioat_dev_completed_ops(dev_id, COMPLETION_BURST, hdls, hdls);
+        if (ret < 0) {
+            // The channel halted: drop it for good and let the CPU redo the
+            // copy
+            fprintf(stderr, "ioat_preload: channel %u failed: %s\n", dev_id,
+                    rte_strerror(rte_errno));
+            pthread_setspecific(preload.channel_key, NULL);
+            channel = -1;
+            failed = true;
+            break;
+        }
+        nb_done += ret;
+    }
+
+    if (mapped) {
+        ioat_regcache_unmap(preload.regcache, src, n);
+        ioat_regcache_unmap(preload.regcache, dst, n);
+    }
+
+    return !failed;
+}
+
+static void *do_copy(void *dst, const void *src, size_t n, copy_fn libc_fn) {
+    if (n >= preload.threshold && preload.ready && !in_preload) {
+        bool done = false;
+
+        // Announce the copy before checking ready again, so that the
+        // destructor, which clears ready first, waits for it
+        in_preload = true;
+        __atomic_fetch_add(&preload.nb_copying, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&preload.ready, __ATOMIC_SEQ_CST))
+            done = ioat_copy(dst, src, n);
+        __atomic_fetch_sub(&preload.nb_copying, 1, __ATOMIC_RELEASE);
+        in_preload = false;
+
+        if (done) {
+            __atomic_fetch_add(&stats.ioat_copies, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&stats.ioat_bytes, n, __ATOMIC_RELAXED);
+            return dst;
+        }
+        __atomic_fetch_add(&stats.fallbacks, 1, __ATOMIC_RELAXED);
+    }
+
+    count_cpu_copy(n);
+    return libc_fn != NULL ? libc_fn(dst, src, n) : byte_move(dst, src, n);
+}
+
+void *memcpy(void *dst, const void *src, size_t n) {
+    return do_copy(dst, src, n, libc_memcpy);
+}
+
+void *memmove(void *dst, const void *src, size_t n) {
+    // The engine gives no ordering guarantee within overlapping ranges
+    if ((uintptr_t)dst < (uintptr_t)src + n &&
+        (uintptr_t)src < (uintptr_t)dst + n) {
+        count_cpu_copy(n);
+        return libc_memmove != NULL ? libc_memmove(dst, src, n)
+                                    : byte_move(dst, src, n);
+    }
+    return do_copy(dst, src, n, libc_memmove);
+}
+
+// A size with an optional K, M or G suffix, or def if unset or not one
+static size_t env_size(const char *name, size_t def) {
+    const char *str = getenv(name);
+    unsigned long long v;
+    char *end = NULL;
+
+    if (str == NULL) return def;
+    // strtoull takes "-1" as ULLONG_MAX
+    if (!isdigit((unsigned char)str[0])) goto invalid;
+    v = strtoull(str, &end, 0);
+    switch (*end) {
+        case 'k':
+        case 'K':
+            v = KB(v);
+            end++;
+            break;
+        case 'm':
+        case 'M':
+            v = MB(v);
+            end++;
+            break;
+        case 'g':
+        case 'G':
+            v = GB(v);
+            end++;
+            break;
+    }
+    if (*end != '\0') goto invalid;
+    return v;
+
+invalid:
+    fprintf(stderr, "ioat_preload: invalid %s=%s, using %zu\n", name, str,
+            def);
+    return def;
+}
+
+static unsigned int split_args(char *str, char **argv, unsigned int max) {
+    unsigned int argc = 0;
+    char *save = NULL, *tok;
+
+    for (tok = strtok_r(str, " \t", &save); tok != NULL && argc < max;
+         tok = strtok_r(NULL, " \t", &save))
+        argv[argc++] = tok;
+    return argc;
+}
+
+// Configure and start all the functional channels, see hello_ioat
+static void setup_channels(void) {
+    struct rte_device *hw_dev = NULL;
+    int num_rawdev = rte_rawdev_count();
+    int dev_id;
+
+    for (dev_id = 0; dev_id < num_rawdev; dev_id++) {
+        struct rte_rawdev_info dev_info = {.dev_private = NULL};
+        struct rte_ioat_rawdev_config ioat_dev_conf = {
+            .ring_size = RING_SIZE,
+            .hdls_disable = true  // only the number of completions matters
+        };
+        struct rte_rawdev_info conf_info = {.dev_private = &ioat_dev_conf};
+
+        if (preload.nb_channels == MAX_CHANNELS) break;
+        if (rte_rawdev_info_get(dev_id, &dev_info, 0) != 0 ||
+            !ioat_dev_driver_supported(dev_info.driver_name) ||
+            rte_rawdev_selftest(dev_id) != 0)
+            continue;
+        if (rte_rawdev_configure(dev_id, &conf_info, sizeof(ioat_dev_conf)) !=
+                0 ||
+            rte_rawdev_start(dev_id) != 0)
+            continue;
+
+        preload.channels[preload.nb_channels++] = dev_id;
+        if (hw_dev == NULL && ioat_sw_devs[dev_id] == NULL)
+            hw_dev = dev_info.device;
+    }
+
+    if (hw_dev != NULL)
+        preload.regcache = ioat_regcache_create(
+            hw_dev, env_size("IOAT_PRELOAD_CACHE_BYTES", 0));
+}
+
+__attribute__((constructor)) static void ioat_preload_init(void) {
+    char *eal_args, *argv[MAX_EAL_ARGS + 1];
+    const char *env;
+    cpu_set_t cpuset;
+    unsigned int argc;
+    bool affinity;
+
+    libc_memcpy = (copy_fn)dlsym(RTLD_NEXT, "memcpy");
+    libc_memmove = (copy_fn)dlsym(RTLD_NEXT, "memmove");
+
+    preload.threshold = env_size("IOAT_PRELOAD_THRESHOLD", preload.threshold);
+    // Every copy, down to empty ones, would go through a channel
+    if (preload.threshold == 0) {
+        fprintf(stderr, "ioat_preload: IOAT_PRELOAD_THRESHOLD=0, disabled\n");
+        return;
+    }
+    env = getenv("IOAT_PRELOAD_EAL_ARGS");
+    eal_args = strdup(env != NULL ? env : DEFAULT_EAL_ARGS);
+    if (eal_args == NULL) return;
+    argv[0] = "ioat_preload";
+    argc = 1 + split_args(eal_args, argv + 1, MAX_EAL_ARGS - 1);
+    argv[argc] = NULL;
+
+    in_preload = true;
+    // The EAL pins the calling thread, which belongs to the program
+    affinity =
+        pthread_getaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) == 0;
+    if (rte_eal_init(argc, argv) < 0) {
+        fprintf(stderr, "ioat_preload: invalid EAL arguments, disabled\n");
+        goto out;
+    }
+    if (affinity)
+        pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+
+    if (rte_eal_iova_mode() != RTE_IOVA_VA) {
+        fprintf(stderr, "ioat_preload: needs --iova-mode=va, disabled\n");
+        goto out;
+    }
+
+    setup_channels();
+    if (preload.nb_channels == 0) {
+        fprintf(stderr, "ioat_preload: no IOAT channel, disabled\n");
+        goto out;
+    }
+    if (pthread_key_create(&preload.channel_key, release_channel) != 0) {
+        fprintf(stderr, "ioat_preload: cannot create thread key, disabled\n");
+        goto out;
+    }
+    // Handed out from the end, so the first channel goes first
+    for (preload.nb_free = 0; preload.nb_free < preload.nb_channels;
+         preload.nb_free++)
+        preload.free_channels[preload.nb_free] =
+            preload.nb_channels - 1 - preload.nb_free;
+    fprintf(stderr,
+            "ioat_preload: %u channels, offloading copies of %zu bytes and "
+            "more\n",
+            preload.nb_channels, preload.threshold);
+    preload.ready = true;
+
+out:
+    in_preload = false;
+}
+
+__attribute__((destructor)) static void ioat_preload_fini(void) {
+    const struct timespec tick = {.tv_nsec = 1000000};
+    unsigned int i, ms;
+
+    if (!preload.ready) return;
+    __atomic_store_n(&preload.ready, false, __ATOMIC_SEQ_CST);
+
+    // Threads still running may be in the middle of a copy
+    for (ms = 0; ms < FINI_TIMEOUT_MS &&
+                 __atomic_load_n(&preload.nb_copying, __ATOMIC_ACQUIRE) > 0;
+         ms++)
+        nanosleep(&tick, NULL);
+
+    // Small copies of other threads not flushed yet are not counted
+    stats.cpu_copies += thread_stats.cpu_copies;
+    stats.cpu_bytes += thread_stats.cpu_bytes;
+    fprintf(stderr,
+            "ioat_preload: offloaded %" PRIu64 " copies, %" PRIu64
+            " bytes; CPU copied %" PRIu64 " copies, %" PRIu64
+            " bytes; %" PRIu64 " large copies fell back to the CPU\n",
+            stats.ioat_copies, stats.ioat_bytes, stats.cpu_copies,
+            stats.cpu_bytes, stats.fallbacks);
+
+    // Better leak them than pull them from under a copy
+    if (__atomic_load_n(&preload.nb_copying, __ATOMIC_ACQUIRE) > 0) {
+        fprintf(stderr, "ioat_preload: copies still running, channels left "
+                        "started\n");
+        return;
+    }
+    for (i = 0; i < preload.nb_channels; i++)
+        rte_rawdev_stop(preload.channels[i]);
+    ioat_regcache_destroy(preload.regcache);
+}
@@ -0,0 +1,695 @@
+// \ref https://doc.dpdk.org/guides-20.11/prog_guide/multi_proc_support.html
+// \ref https://doc.dpdk.org/guides-20.11/rawdevs/ioat.html
+//
+// IOAT copy service, see ioat_svc.h. Run as the primary process, it owns the
+// channels and serves the clients; run as a secondary process, it is a client
+// which copies a buffer through the service and checks the copies.
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ioat_dev.h"
+#include "ioat_hist.h"
+#include "ioat_svc.h"
+#include "rte_cycles.h"
+#include "rte_ioat_rawdev.h"
+#include "rte_launch.h"
+#include "rte_lcore.h"
+#include "rte_memzone.h"
+#include "rte_rawdev.h"
+
+#define MAX_CHANNELS 16
+// Jobs moved per ring operation
+#define SVC_BURST 32
+// Every client may have a full submission ring, and as many jobs being
+// copied or completed
+#define NB_JOBS (2 * IOAT_SVC_MAX_CLIENTS * IOAT_SVC_RING_SIZE)
+// How often the service looks for clients which left or died, in ms
+#define RECLAIM_INTERVAL_MS 100
+// Longest wait of a client for its last copies, in ms
+#define DRAIN_TIMEOUT_MS 1000
+
+struct svc_config {
+    // service
+    unsigned int nb_channels;  // 0 for all the functional ones
+    unsigned int ring_size;
+    uint32_t max_len;
+    unsigned int stats_interval_ms;
+    // client
+    char name[IOAT_SVC_NAME_LEN];
+    uint32_t size;
+    unsigned int window;
+    unsigned int duration;
+    unsigned int weight;
+};
+
+static struct svc_config cfg = {
+    .ring_size = 1024,
+    .max_len = 1U << 20,
+    .stats_interval_ms = 1000,
+    .size = 4096,
+    .window = 64,
+    .duration = 10,
+    .weight = 1,
+};
+
+// A channel of the service, only used by the service lcore
+struct svc_channel {
+    uint16_t dev_id;
+    uint16_t pending;       // jobs enqueued since the last doorbell
+    uint32_t pending_mask;  // clients of those jobs
+    uint64_t doorbells;
+    uint64_t shared_doorbells;  // doorbells for the jobs of several clients
+    uint64_t jobs;
+};
+
+static struct ioat_svc_shared *shared;
+static struct rte_mempool *job_pool;
+static struct svc_channel channels[MAX_CHANNELS];
+static unsigned int nb_channels;
+
+// Per client, only used by the service lcore
+static int32_t deficits[IOAT_SVC_MAX_CLIENTS];
+static uint64_t inflight[IOAT_SVC_MAX_CLIENTS];
+static uint64_t total_inflight;
+
+static volatile bool force_quit;
+
+static void usage(const char *prgname) {
+    printf(
+        "%s [EAL options] -- [options]\n"
+        "As the primary process, the copy service:\n"
+        "  -n CHANNELS: IOAT channels to serve with (default: all the "
+        "functional ones, up to 16)\n"
+        "  -r RING: ring size of the channels (default: 1024)\n"
+        "  -m MAX_LEN: longest copy accepted (default: 1M)\n"
+        "  -i MS: statistics interval (default: 1000)\n"
+        "As a secondary process, a client of the service:\n"
+        "  -N NAME: client name (default: client-PID)\n"
+        "  -s SIZE: bytes per copy (default: 4096)\n"
+        "  -w WINDOW: copies in flight, up to %u (default: 64)\n"
+        "  -t SECS: duration (default: 10)\n"
+        "  -W WEIGHT: bursts of copies the service takes per round, 1 to %u "
+        "(default: 1)\n",
+        prgname, IOAT_SVC_RING_SIZE - 1, IOAT_SVC_MAX_WEIGHT);
+}
+
+static int parse_uint(const char *str, unsigned int min, unsigned int max,
+                      unsigned int *v) {
+    char *end = NULL;
+    unsigned long n = strtoul(str, &end, 0);
+
+    if (end == str) return -1;
+    if (*end == 'k' || *end == 'K')
+        n <<= 10, end++;
+    else if (*end == 'm' || *end == 'M')
+        n <<= 20, end++;
+    if (*end != '\0' || n < min || n > max) return -1;
+    *v = n;
+    return 0;
+}
+
+static int parse_args(int argc, char **argv) {
+    const char *prgname = argv[0];
+    unsigned int v;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:m:i:N:s:w:t:W:")) != -1) {
+        switch (opt) {
+            case 'n':
+                if (parse_uint(optarg, 1, MAX_CHANNELS, &cfg.nb_channels) < 0)
+                    goto invalid;
+                break;
+            case 'r':
+                if (parse_uint(optarg, 64, 4096, &v) < 0 ||
+                    !rte_is_power_of_2(v))
+                    goto invalid;
+                cfg.ring_size = v;
+                break;
+            case 'm':
+                if (parse_uint(optarg, 1, UINT32_MAX, &cfg.max_len) < 0)
+                    goto invalid;
+                break;
+            case 'i':
+                if (parse_uint(optarg, 1, UINT32_MAX, &v) < 0) goto invalid;
+                cfg.stats_interval_ms = v;
+                break;
+            case 'N':
+                snprintf(cfg.name, sizeof(cfg.name), "%s", optarg);
+                break;
+            case 's':
+                if (parse_uint(optarg, 1, UINT32_MAX, &cfg.size) < 0)
+                    goto invalid;
+                break;
+            case 'w':
+                if (parse_uint(optarg, 1, IOAT_SVC_RING_SIZE - 1, &v) < 0)
+                    goto invalid;
+                cfg.window = v;
+                break;
+            case 't':
+                if (parse_uint(optarg, 1, UINT32_MAX, &cfg.duration) < 0)
+                    goto invalid;
+                break;
+            case 'W':
+                if (parse_uint(optarg, 1, IOAT_SVC_MAX_WEIGHT, &v) < 0)
+                    goto invalid;
+                cfg.weight = v;
+                break;
+            default:
+                usage(prgname);
+                return -1;
+        }
+    }
+    return 0;
+
+invalid:
+    printf("Invalid -%c value, %s\n", opt, optarg);
+    usage(prgname);
+    return -1;
+}
+
+static void signal_handler(int signum) {
+    if (signum == SIGINT || signum == SIGTERM) force_quit = true;
+}
+
+static inline void stats_add(uint64_t *counter, uint64_t n) {
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+// Hand a job back to its client, or free it if the client is gone
+static void svc_complete(struct ioat_svc_job *job) {
+    struct ioat_svc_client *c = &shared->clients[job->client];
+
+    if (job->status == 0)
+        stats_add(&c->stats.completed, 1);
+    else
+        stats_add(&c->stats.rejected, 1);
+
+    if (__atomic_load_n(&c->state, __ATOMIC_ACQUIRE) != IOAT_SVC_ATTACHED) {
+        rte_mempool_put(job_pool, job);
+    } else if (rte_ring_enqueue(c->cq, job) != 0) {
+        rte_mempool_put(job_pool, job);
+        stats_add(&c->stats.dropped, 1);
+    }
+}
+
+// The channel with the most room left, NULL if they are all full
+static struct svc_channel *svc_pick_channel(uint16_t *room) {
+    struct svc_channel *best = NULL;
+    unsigned int ch;
+
+    *room = 0;
+    for (ch = 0; ch < nb_channels; ch++) {
+        const uint16_t cap = ioat_dev_burst_capacity(channels[ch].dev_id);
+
+        if (cap > *room) {
+            *room = cap;
+            best = &channels[ch];
+        }
+    }
+    return best;
+}
+
+// Take up to max jobs from the submission ring of client i onto a channel.
+// Returns the number of jobs taken.
+static unsigned int svc_take_jobs(unsigned int i, struct svc_channel *ch,
+                                  unsigned int max) {
+    struct ioat_svc_client *c = &shared->clients[i];
+    struct ioat_svc_job *jobs[SVC_BURST];
+    unsigned int nb, j;
+    uint64_t bytes = 0;
+
+    nb = rte_ring_dequeue_burst(c->sq, (void **)jobs, max, NULL);
+    for (j = 0; j < nb; j++) {
+        struct ioat_svc_job *job = jobs[j];
+
+        job->client = i;
+        if (job->len == 0 || job->len > shared->max_len) {
+            job->status = -EINVAL;
+            svc_complete(job);
+            continue;
+        }
+        job->status = 0;
+        // Cannot fail, the room was checked
+        ioat_dev_enqueue_copy(ch->dev_id, job->src, job->dst, job->len,
+                              (uintptr_t)job, 0);
+        bytes += job->len;
+        ch->pending++;
+        ch->pending_mask |= 1U << i;
+        inflight[i]++;
+        total_inflight++;
+    }
+    if (nb > 0) {
+        stats_add(&c->stats.jobs, nb);
+        stats_add(&c->stats.bytes, bytes);
+        __atomic_store_n(&c->stats.inflight, inflight[i], __ATOMIC_RELAXED);
+    }
+    return nb;
+}
+
+// Take the jobs of the clients by deficit round robin, each earning weight
+// bursts of jobs per round, as long as the channels have room. Clients the
+// channels had no room for are served first next round. Returns false if
+// there was no job to take.
+static bool svc_take_round(uint16_t *first) {
+    unsigned int n, i, max, nb;
+    struct svc_channel *ch;
+    uint16_t room;
+    bool busy = false;
+
+    for (n = 0, i = *first; n < IOAT_SVC_MAX_CLIENTS;
+         n++, i = (i + 1) % IOAT_SVC_MAX_CLIENTS) {
+        struct ioat_svc_client *c = &shared->clients[i];
+
+        if (__atomic_load_n(&c->state, __ATOMIC_ACQUIRE) !=
+            IOAT_SVC_ATTACHED) {
+            deficits[i] = 0;
+            continue;
+        }
+
+        deficits[i] += c->weight * SVC_BURST;
+        while (deficits[i] > 0) {
+            ch = svc_pick_channel(&room);
+            if (ch == NULL) {
+                *first = i;
+                return busy;
+            }
+            max = RTE_MIN((unsigned int)deficits[i], (unsigned int)room);
+            max = RTE_MIN(max, (unsigned int)SVC_BURST);
+            nb = svc_take_jobs(i, ch, max);
+            deficits[i] -= nb;
+            if (nb > 0) busy = true;
+            // A drained client keeps no credit for later rounds
+            if (nb < max) {
+                deficits[i] = 0;
+                break;
+            }
+        }
+    }
+    return busy;
+}
+
+// Ring the doorbell of each channel once for the jobs of all the clients
+// taken this round
+static void svc_doorbells(void) {
+    unsigned int ch;
+
+    for (ch = 0; ch < nb_channels; ch++) {
+        struct svc_channel *c = &channels[ch];
+
+        if (c->pending == 0) continue;
+        ioat_dev_perform_ops(c->dev_id);
+        stats_add(&c->doorbells, 1);
+        stats_add(&c->jobs, c->pending);
+        if (c->pending_mask & (c->pending_mask - 1))
+            stats_add(&c->shared_doorbells, 1);
+        c->pending = 0;
+        c->pending_mask = 0;
+    }
+}
+
+// Returns the number of jobs completed, or -1 on a channel error
+static int svc_completions(void) {
+    uintptr_t src_hdls[SVC_BURST], dst_hdls[SVC_BURST];
+    unsigned int ch;
+    int ret, j, total = 0;
+
+    for (ch = 0; ch < nb_channels; ch++) {
+        ret = ioat_dev_completed_ops(channels[ch].dev_id, SVC_BURST, src_hdls,
+                                     dst_hdls);
+        if (ret < 0) {
+            printf("Rawdev %u failed: %s\n", channels[ch].dev_id,
+                   rte_strerror(rte_errno));
+            return -1;
+        }
+        for (j = 0; j < ret; j++) {
+            struct ioat_svc_job *job = (struct ioat_svc_job *)src_hdls[j];
+            const uint16_t i = job->client;
+
+            inflight[i]--;
+            total_inflight--;
+            __atomic_store_n(&shared->clients[i].stats.inflight, inflight[i],
+                             __ATOMIC_RELAXED);
+            svc_complete(job);
+        }
+        total += ret;
+    }
+    return total;
+}
+
+static void drain_ring(struct rte_ring *r) {
+    void *objs[SVC_BURST];
+    unsigned int nb;
+
+    while ((nb = rte_ring_dequeue_burst(r, objs, SVC_BURST, NULL)) > 0)
+        rte_mempool_put_bulk(job_pool, objs, nb);
+}
+
+// Free the slots of the clients which left, or died without leaving, once
+// none of their jobs is being copied any more
+static void svc_reclaim(void) {
+    unsigned int i;
+
+    for (i = 0; i < IOAT_SVC_MAX_CLIENTS; i++) {
+        struct ioat_svc_client *c = &shared->clients[i];
+        uint32_t state = __atomic_load_n(&c->state, __ATOMIC_ACQUIRE);
+
+        if (state == IOAT_SVC_ATTACHED && kill(c->pid, 0) < 0 &&
+            errno == ESRCH) {
+            printf("Client %s (pid %d) died\n", c->name, (int)c->pid);
+            state = IOAT_SVC_DETACHING;
+            __atomic_store_n(&c->state, state, __ATOMIC_RELAXED);
+        }
+        if (state != IOAT_SVC_DETACHING || inflight[i] > 0) continue;
+
+        drain_ring(c->sq);
+        drain_ring(c->cq);
+        __atomic_store_n(&c->state, IOAT_SVC_FREE, __ATOMIC_RELEASE);
+    }
+}
+
+static int service_loop(void *arg) {
+    const uint64_t reclaim_tsc = rte_get_tsc_hz() * RECLAIM_INTERVAL_MS / 1000;
+    uint64_t last_reclaim = rte_rdtsc();
+    uint16_t first = 0;
+
+    RTE_SET_USED(arg);
+
+    // Once stopped, the jobs being copied are still completed
+    while (!force_quit || total_inflight > 0) {
+        if (!force_quit && svc_take_round(&first)) svc_doorbells();
+        if (svc_completions() < 0) return -1;
+        if (rte_rdtsc() - last_reclaim >= reclaim_tsc) {
+            svc_reclaim();
+            last_reclaim = rte_rdtsc();
+        }
+    }
+    return 0;
+}
+
+static unsigned int setup_channels(void) {
+    struct rte_ioat_rawdev_config p = {.ring_size = cfg.ring_size};
+    int dev_id, num_rawdev = rte_rawdev_count();
+
+    for (dev_id = 0; dev_id < num_rawdev; dev_id++) {
+        struct rte_rawdev_info info = {.dev_private = NULL};
+
+        if (cfg.nb_channels > 0 && nb_channels == cfg.nb_channels) break;
+        if (nb_channels == MAX_CHANNELS) break;
+        if (rte_rawdev_info_get(dev_id, &info, 0) != 0 ||
+            !ioat_dev_driver_supported(info.driver_name))
+            continue;
+        info.dev_private = &p;
+        if (rte_rawdev_configure(dev_id, &info, sizeof(p)) != 0 ||
+            rte_rawdev_start(dev_id) != 0) {
+            printf("Cannot start rawdev %d, skipped\n", dev_id);
+            continue;
+        }
+        channels[nb_channels++].dev_id = dev_id;
+    }
+    return nb_channels;
+}
+
+static void setup_shared(void) {
+    const struct rte_memzone *mz;
+    char name[RTE_RING_NAMESIZE];
+    unsigned int i;
+
+    mz = rte_memzone_reserve(IOAT_SVC_MZ_NAME, sizeof(*shared), SOCKET_ID_ANY,
+                             0);
+    if (mz == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot reserve the shared state: %s\n",
+                 rte_strerror(rte_errno));
+    shared = mz->addr;
+    memset(shared, 0, sizeof(*shared));
+
+    // No per-lcore cache: the lcore ids of the clients overlap those of the
+    // service
+    job_pool = rte_mempool_create(IOAT_SVC_POOL_NAME, NB_JOBS,
+                                  sizeof(struct ioat_svc_job), 0, 0, NULL,
+                                  NULL, NULL, NULL, SOCKET_ID_ANY, 0);
+    if (job_pool == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot create the job pool: %s\n",
+                 rte_strerror(rte_errno));
+
+    for (i = 0; i < IOAT_SVC_MAX_CLIENTS; i++) {
+        struct ioat_svc_client *c = &shared->clients[i];
+
+        snprintf(name, sizeof(name), "ioat_svc_sq_%u", i);
+        c->sq = rte_ring_create(name, IOAT_SVC_RING_SIZE, SOCKET_ID_ANY,
+                                RING_F_SP_ENQ | RING_F_SC_DEQ);
+        snprintf(name, sizeof(name), "ioat_svc_cq_%u", i);
+        c->cq = rte_ring_create(name, IOAT_SVC_RING_SIZE, SOCKET_ID_ANY,
+                                RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (c->sq == NULL || c->cq == NULL)
+            rte_exit(EXIT_FAILURE, "Cannot create the rings of client %u\n",
+                     i);
+    }
+
+    shared->max_len = cfg.max_len;
+    shared->nb_channels = nb_channels;
+    __atomic_store_n(&shared->running, 1, __ATOMIC_RELEASE);
+}
+
+static void print_service_stats(double secs) {
+    static struct ioat_svc_client_stats prev[IOAT_SVC_MAX_CLIENTS];
+    static uint64_t prev_doorbells, prev_shared, prev_jobs;
+    uint64_t doorbells = 0, shared_doorbells = 0, jobs = 0;
+    double per_doorbell = 0, shared_pct = 0;
+    unsigned int ch, i;
+
+    for (ch = 0; ch < nb_channels; ch++) {
+        doorbells += __atomic_load_n(&channels[ch].doorbells, __ATOMIC_RELAXED);
+        shared_doorbells +=
+            __atomic_load_n(&channels[ch].shared_doorbells, __ATOMIC_RELAXED);
+        jobs += __atomic_load_n(&channels[ch].jobs, __ATOMIC_RELAXED);
+    }
+    if (doorbells > prev_doorbells) {
+        per_doorbell =
+            (double)(jobs - prev_jobs) / (doorbells - prev_doorbells);
+        shared_pct = 100.0 * (shared_doorbells - prev_shared) /
+                     (doorbells - prev_doorbells);
+    }
+    printf("Service: %.0f jobs/s, %.0f doorbells/s, %.1f jobs/doorbell, "
+           "%.1f%% of doorbells shared by several clients\n",
+           (jobs - prev_jobs) / secs, (doorbells - prev_doorbells) / secs,
+           per_doorbell, shared_pct);
+    prev_doorbells = doorbells;
+    prev_shared = shared_doorbells;
+    prev_jobs = jobs;
+
+    for (i = 0; i < IOAT_SVC_MAX_CLIENTS; i++) {
+        const struct ioat_svc_client *c = &shared->clients[i];
+        const uint32_t state = __atomic_load_n(&c->state, __ATOMIC_ACQUIRE);
+        struct ioat_svc_client_stats s;
+
+        if (state != IOAT_SVC_ATTACHED && state != IOAT_SVC_DETACHING) {
+            memset(&prev[i], 0, sizeof(prev[i]));
+            continue;
+        }
+        s.jobs = __atomic_load_n(&c->stats.jobs, __ATOMIC_RELAXED);
+        s.completed = __atomic_load_n(&c->stats.completed, __ATOMIC_RELAXED);
+        s.rejected = __atomic_load_n(&c->stats.rejected, __ATOMIC_RELAXED);
+        s.bytes = __atomic_load_n(&c->stats.bytes, __ATOMIC_RELAXED);
+        s.dropped = __atomic_load_n(&c->stats.dropped, __ATOMIC_RELAXED);
+        s.inflight = __atomic_load_n(&c->stats.inflight, __ATOMIC_RELAXED);
+        printf("  [%2u] %-20s pid %-7d weight %-2u %10.0f jobs/s %9.1f MB/s "
+               "in flight %-5" PRIu64 " rejected %-8" PRIu64
+               " dropped %" PRIu64 "%s\n",
+               i, c->name, (int)c->pid, c->weight,
+               (s.jobs - prev[i].jobs) / secs,
+               (s.bytes - prev[i].bytes) / secs / 1e6, s.inflight, s.rejected,
+               s.dropped, state == IOAT_SVC_DETACHING ? " (leaving)" : "");
+        prev[i] = s;
+    }
+    fflush(stdout);
+}
+
+static int run_service(void) {
+    unsigned int lcore_id, ch;
+    uint64_t last;
+    int ret;
+
+    if (rte_lcore_count() < 2)
+        rte_exit(EXIT_FAILURE, "The service needs a worker lcore\n");
+    if (setup_channels() == 0)
+        rte_exit(EXIT_FAILURE, "No IOAT channel to serve with\n");
+    setup_shared();
+
+    printf("Serving up to %u clients with %u channels, ring size %u, "
+           "copies up to %u bytes\n",
+           IOAT_SVC_MAX_CLIENTS, nb_channels, cfg.ring_size, cfg.max_len);
+    for (ch = 0; ch < nb_channels; ch++)
+        printf("  channel %u: rawdev %u\n", ch, channels[ch].dev_id);
+
+    lcore_id = rte_get_next_lcore(-1, 1, 0);
+    rte_eal_remote_launch(service_loop, NULL, lcore_id);
+
+    last = rte_rdtsc();
+    while (!force_quit) {
+        usleep(cfg.stats_interval_ms * 1000);
+        const uint64_t now = rte_rdtsc();
+
+        print_service_stats((double)(now - last) / rte_get_tsc_hz());
+        last = now;
+    }
+
+    // Clients see the service stop, the jobs being copied still complete
+    __atomic_store_n(&shared->running, 0, __ATOMIC_RELEASE);
+    ret = rte_eal_wait_lcore(lcore_id);
+    for (ch = 0; ch < nb_channels; ch++) rte_rawdev_stop(channels[ch].dev_id);
+    return ret;
+}
+
+static int run_client(void) {
+    const uint64_t hz = rte_get_tsc_hz();
+    const size_t stride = RTE_ALIGN_CEIL(cfg.size, RTE_CACHE_LINE_SIZE);
+    const struct rte_memzone *src_mz, *dst_mz;
+    struct ioat_svc_job *jobs[SVC_BURST];
+    struct ioat_svc_conn conn;
+    char mz_name[RTE_MEMZONE_NAMESIZE];
+    uint64_t *submit_tsc;
+    uint32_t *free_slots;
+    unsigned int nb_free, nb, nb_sub, j;
+    uint64_t nb_done = 0, nb_rejected = 0, nb_mismatches = 0, start, end,
+             deadline, drain_deadline;
+    struct ioat_hist *hist;
+    uint8_t *src, *dst;
+    int ret;
+
+    if (cfg.name[0] == '\0')
+        snprintf(cfg.name, sizeof(cfg.name), "client-%d", (int)getpid());
+    ret = ioat_svc_attach(&conn, cfg.name, cfg.weight);
+    if (ret == -ENOENT)
+        rte_exit(EXIT_FAILURE, "No copy service running, start ioat_service "
+                               "as the primary process first\n");
+    if (ret < 0)
+        rte_exit(EXIT_FAILURE, "Cannot attach to the copy service: %s\n",
+                 rte_strerror(-ret));
+    if (cfg.size > conn.shared->max_len)
+        rte_exit(EXIT_FAILURE, "The service copies up to %u bytes\n",
+                 conn.shared->max_len);
+
+    // Memzones of a secondary process outlive it unless freed, their names
+    // must not clash with those of the other clients
+    snprintf(mz_name, sizeof(mz_name), "svc_src_%d", (int)getpid());
+    src_mz = rte_memzone_reserve_aligned(mz_name, cfg.size, SOCKET_ID_ANY,
+                                         RTE_MEMZONE_IOVA_CONTIG,
+                                         RTE_CACHE_LINE_SIZE);
+    snprintf(mz_name, sizeof(mz_name), "svc_dst_%d", (int)getpid());
+    dst_mz = rte_memzone_reserve_aligned(mz_name, stride * cfg.window,
+                                         SOCKET_ID_ANY, RTE_MEMZONE_IOVA_CONTIG,
+                                         RTE_CACHE_LINE_SIZE);
+    submit_tsc = calloc(cfg.window, sizeof(*submit_tsc));
+    free_slots = calloc(cfg.window, sizeof(*free_slots));
+    hist = calloc(1, sizeof(*hist));
+    if (src_mz == NULL || dst_mz == NULL || submit_tsc == NULL ||
+        free_slots == NULL || hist == NULL)
+        rte_exit(EXIT_FAILURE, "Cannot allocate the client buffers\n");
+    src = src_mz->addr;
+    dst = dst_mz->addr;
+    for (j = 0; j < cfg.size; j++) src[j] = rand();
+    for (nb_free = 0; nb_free < cfg.window; nb_free++)
+        free_slots[nb_free] = nb_free;
+
+    printf("Client %s in slot %u: %u byte copies, %u in flight, weight %u, "
+           "for %u s\n",
+           cfg.name, conn.idx, cfg.size, cfg.window, cfg.weight, cfg.duration);
+
+    start = rte_rdtsc();
+    deadline = start + cfg.duration * hz;
+    drain_deadline = UINT64_MAX;
+    while (nb_free < cfg.window || drain_deadline == UINT64_MAX) {
+        const uint64_t now = rte_rdtsc();
+
+        if (drain_deadline == UINT64_MAX &&
+            (force_quit || now >= deadline || !ioat_svc_running(&conn)))
+            drain_deadline = now + DRAIN_TIMEOUT_MS * hz / 1000;
+        if (now >= drain_deadline) {
+            printf("%u copies did not complete\n", cfg.window - nb_free);
+            break;
+        }
+
+        nb = drain_deadline == UINT64_MAX ? RTE_MIN(nb_free, SVC_BURST) : 0;
+        if (nb > 0 && ioat_svc_job_alloc(&conn, jobs, nb) == 0) {
+            for (j = 0; j < nb; j++) {
+                const uint32_t slot = free_slots[nb_free - 1 - j];
+
+                jobs[j]->src = src_mz->iova;
+                jobs[j]->dst = dst_mz->iova + slot * stride;
+                jobs[j]->len = cfg.size;
+                jobs[j]->cookie = slot;
+                submit_tsc[slot] = now;
+            }
+            nb_sub = ioat_svc_submit(&conn, jobs, nb);
+            nb_free -= nb_sub;
+            ioat_svc_job_free(&conn, &jobs[nb_sub], nb - nb_sub);
+        }
+
+        nb = ioat_svc_poll(&conn, jobs, SVC_BURST);
+        const uint64_t done = rte_rdtsc();
+
+        for (j = 0; j < nb; j++) {
+            const uint32_t slot = jobs[j]->cookie;
+
+            if (jobs[j]->status != 0)
+                nb_rejected++;
+            else if (memcmp(dst + slot * stride, src, cfg.size) != 0)
+                nb_mismatches++;
+            ioat_hist_record(hist, done - submit_tsc[slot]);
+            free_slots[nb_free++] = slot;
+        }
+        if (nb > 0) ioat_svc_job_free(&conn, jobs, nb);
+        nb_done += nb;
+    }
+    end = rte_rdtsc();
+
+    printf("%" PRIu64 " copies, %.1f MB/s, latency p50 %.1f us, p99 %.1f us, "
+           "%" PRIu64 " rejected, %" PRIu64 " mismatches\n",
+           nb_done, (double)nb_done * cfg.size * hz / (end - start) / 1e6,
+           ioat_hist_percentile(hist, 0.5) * 1e6 / hz,
+           ioat_hist_percentile(hist, 0.99) * 1e6 / hz, nb_rejected,
+           nb_mismatches);
+
+    // Copies still in flight may write to the buffers until the service
+    // frees their jobs
+    ioat_svc_detach(&conn);
+    if (nb_free == cfg.window) {
+        rte_memzone_free(src_mz);
+        rte_memzone_free(dst_mz);
+    }
+    free(hist);
+    free(free_slots);
+    free(submit_tsc);
+    return nb_mismatches == 0 && nb_rejected == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    int ret;
+
+    ret = rte_eal_init(argc, argv);
+    if (ret < 0) rte_exit(EXIT_FAILURE, "Invalid EAL arguments\n");
+    argc -= ret;
+    argv += ret;
+    if (parse_args(argc, argv) < 0)
+        rte_exit(EXIT_FAILURE, "Invalid arguments\n");
+
+    force_quit = false;
+    signal(SIGINT, signal_handler);
+    signal(SIGTERM, signal_handler);
+
+    if (rte_eal_process_type() == RTE_PROC_PRIMARY)
+        ret = run_service();
+    else
+        ret = run_client();
+
+    rte_eal_cleanup();
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
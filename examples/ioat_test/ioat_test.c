@@ -2,23 +2,225 @@
  * Copyright(c) 2019 Intel Corporation
  */
 
+#include <errno.h>
+#include <getopt.h>
+#include <immintrin.h>
 #include <inttypes.h>
 #include <rte_mbuf.h>
-#include <unistd.h>
+#include <stdbool.h>
 
+#include "ioat_dev.h"
+#include "rte_cpuflags.h"
+#include "rte_cycles.h"
 #include "rte_ioat_rawdev.h"
+#include "rte_launch.h"
+#include "rte_lcore.h"
+#include "rte_memzone.h"
 #include "rte_rawdev.h"
+#include "rte_version.h"
 
 #define MAX_SUPPORTED_RAWDEVS 64
 #define TEST_SKIPPED 77
 
+/* Longest wait for a completion before a test gives up, in seconds */
+#define COMPLETION_TIMEOUT 1
+
+/* Stress mode: copies read from anywhere in the first STRESS_SRC_SPAN bytes
+ * of their channel's source buffer, and write to a slot of their own per
+ * ring entry, between guard bytes that must be left untouched
+ */
+#define STRESS_SRC_SPAN 4096
+#define STRESS_GUARD 16
+#define STRESS_GUARD_BYTE 0x5a
+#define STRESS_MAX_BURST 64
+
+/* Perf mode: each point of the matrix is measured for PERF_DURATION_MS with
+ * copies spread over PERF_WSS of src and dst, then its latency over
+ * PERF_LAT_ROUNDS batches, one at a time
+ */
+#define PERF_DURATION_MS 250
+#define PERF_WSS (32U << 20)
+#define PERF_RING_SIZE 1024
+#define PERF_LAT_ROUNDS 1001
+#define PERF_POLL_BURST 64
+
 int ioat_rawdev_test(uint16_t dev_id); /* pre-define to keep compiler happy */
 
 static struct rte_mempool *pool;
 static unsigned short expected_ring_size[MAX_SUPPORTED_RAWDEVS];
 
+/* stress mode: random copies and fills on several channels at once, for
+ * stress_duration seconds
+ */
+static bool stress_mode;
+static uint64_t stress_seed;
+static bool stress_seed_set;
+static unsigned int stress_duration = 10;
+static unsigned int stress_channels; /* 0 for as many as lcores allow */
+static unsigned int stress_ring_size = 256;
+static unsigned int stress_max_size = 65536;
+static unsigned int stress_fill_pct = 25;
+static volatile bool stress_failed;
+
+/* perf mode: measure the matrix on one channel, the first one found unless
+ * perf_dev_id is set, then save it as a baseline and/or compare it with one
+ * within the tolerances, in percent
+ */
+static bool perf_mode;
+static int perf_dev_id = -1;
+static const char *perf_save_file, *perf_baseline_file;
+static double perf_tolerance = 10, perf_lat_tolerance = 25;
+
+static const unsigned int perf_sizes[] = {64, 256, 1024, 4096, 65536,
+                                          1048576};
+static const unsigned int perf_batches[] = {1, 8, 32};
+
+/* A point of the perf matrix and its results */
+struct perf_point {
+    bool fill;
+    unsigned int size;
+    unsigned int batch;
+    double gbps;
+    double mops;
+    double lat_ns; /* median from doorbell to the batch completed */
+};
+
+/* One channel of the stress test, run by one lcore */
+struct stress_worker {
+    unsigned int idx;
+    uint16_t dev_id;
+    unsigned int lcore_id;
+    uint64_t seed; /* of the ops, stress_seed + idx */
+    uint64_t rng;  /* of the batches and polls */
+    const struct rte_memzone *src_mz, *dst_mz;
+    uint8_t *src, *dst;
+    rte_iova_t src_iova, dst_iova;
+    size_t slot_size;
+    uint64_t nb_copies, nb_fills, nb_bytes, nb_batches, nb_fences;
+};
+
+/* A stress op, which only depends on the seed of its channel and its
+ * sequence number, so that a failing op can be replayed whatever the timing
+ */
+struct stress_op {
+    uint64_t pattern; /* of a fill */
+    uint32_t len;
+    uint32_t src_off; /* in the source buffer, for a copy */
+    uint32_t dst_off; /* in the slot, after its leading guard */
+    bool fill;
+};
+
+/* Offset of the first byte where a and b differ, len if they do not */
+static size_t (*mismatch)(const uint8_t *a, const uint8_t *b, size_t len);
+
 #define PRINT_ERR(...) print_err(__func__, __LINE__, __VA_ARGS__)
 
+static int stress_test(void);
+static int perf_test(void);
+
+static void usage(const char *prgname) {
+    printf(
+        "%s [EAL options] -- [--stress|--perf [options]]\n"
+        "  without --stress or --perf, run the self test of every IOAT "
+        "channel\n"
+        "  --stress: random copies and fills on several channels, one per "
+        "worker lcore\n"
+        "  -s SEED: seed of the stress ops (default: random, printed)\n"
+        "  -t SECONDS: stress duration (default: 10)\n"
+        "  -n CHANNELS: most channels to stress (default: one per worker "
+        "lcore)\n"
+        "  -r RING: ring size of the stressed channels, a power of two in "
+        "[64, 4096] (default: 256)\n"
+        "  -m MAX: largest op in bytes (default: 65536)\n"
+        "  -f PERCENT: share of fills among the ops (default: 25)\n"
+        "  --perf: measure copies and fills of several sizes and batch depths "
+        "on one channel, and exit with an error on a regression\n"
+        "  -d DEV_ID: rawdev id of the channel (default: first one)\n"
+        "  -o FILE: save the results as a JSON baseline\n"
+        "  -b FILE: compare the results with a JSON baseline\n"
+        "  -T PERCENT: largest throughput drop from the baseline (default: "
+        "10)\n"
+        "  -L PERCENT: largest latency increase from the baseline (default: "
+        "25)\n",
+        prgname);
+}
+
+static int parse_args(int argc, char **argv) {
+    static const struct option lgopts[] = {{"stress", no_argument, NULL, 'S'},
+                                           {"perf", no_argument, NULL, 'P'},
+                                           {NULL, 0, 0, 0}};
+    const char *prgname = argv[0];
+    char *end;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "s:t:n:r:m:f:d:o:b:T:L:h", lgopts,
+                              NULL)) != EOF) {
+        unsigned long v = 0;
+
+        /* All the options but file names are numbers */
+        if (optarg != NULL && opt != 'o' && opt != 'b') {
+            v = strtoul(optarg, &end, 0);
+            if (end == optarg || *end != '\0') opt = '?';
+        }
+        switch (opt) {
+            case 'S':
+                stress_mode = true;
+                break;
+            case 'P':
+                perf_mode = true;
+                break;
+            case 'd':
+                perf_dev_id = v;
+                break;
+            case 'o':
+                perf_save_file = optarg;
+                break;
+            case 'b':
+                perf_baseline_file = optarg;
+                break;
+            case 'T':
+                perf_tolerance = v;
+                break;
+            case 'L':
+                perf_lat_tolerance = v;
+                break;
+            case 's':
+                stress_seed = v;
+                stress_seed_set = true;
+                break;
+            case 't':
+                stress_duration = v;
+                break;
+            case 'n':
+                stress_channels = v;
+                break;
+            case 'r':
+                if (v < 64 || v > 4096 || !rte_is_power_of_2(v)) opt = '?';
+                stress_ring_size = v;
+                break;
+            case 'm':
+                if (v == 0 || v > UINT32_MAX / 2) opt = '?';
+                stress_max_size = v;
+                break;
+            case 'f':
+                if (v > 100) opt = '?';
+                stress_fill_pct = v;
+                break;
+            case 'h':
+                usage(prgname);
+                exit(EXIT_SUCCESS);
+            default:
+                opt = '?';
+        }
+        if (opt == '?') {
+            printf("Invalid argument: %s\n", optarg ? optarg : "");
+            usage(prgname);
+            return -1;
+        }
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     int ret;
 
@@ -28,6 +230,11 @@ int main(int argc, char *argv[]) {
     argc -= ret;
     argv += ret;
 
+    if (parse_args(argc, argv) < 0)
+        rte_exit(EXIT_FAILURE, "Invalid ioat_test arguments\n");
+    if (stress_mode) return stress_test() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    if (perf_mode) return perf_test() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
     // Count all the raw devices
     int num_rawdev = rte_rawdev_count();
     printf("Found %d raw devices\n", num_rawdev);
@@ -36,9 +243,9 @@ int main(int argc, char *argv[]) {
     int dev_id;
     for (dev_id = 0; dev_id < num_rawdev; dev_id++) {
         struct rte_rawdev_info dev_info = {.dev_private = NULL};
-        if (rte_rawdev_info_get(dev_id, &dev_info, 0) == 0 &&
-            strcmp(dev_info.driver_name, IOAT_PMD_RAWDEV_NAME_STR) == 0) {
-        }
+        if (rte_rawdev_info_get(dev_id, &dev_info, 0) != 0 ||
+            !ioat_dev_driver_supported(dev_info.driver_name))
+            continue;
         printf("IOAT device found: ioat_dev_name = %s, numa_node = %d\n",
                dev_info.device->name, dev_info.device->numa_node);
 
@@ -64,6 +271,25 @@ static inline int __rte_format_printf(3, 4)
     return ret;
 }
 
+/* Poll for n completions, the handles of which are stored in order, for at
+ * most COMPLETION_TIMEOUT. Returns the number of completions or an error.
+ */
+static int poll_completed(int dev_id, unsigned int n, uintptr_t *src_hdls,
+                          uintptr_t *dst_hdls) {
+    const uint64_t deadline =
+        rte_rdtsc() + rte_get_tsc_hz() * COMPLETION_TIMEOUT;
+    unsigned int nb_done = 0;
+    int ret;
+
+    while (nb_done < n && rte_rdtsc() < deadline) {
+        ret = ioat_dev_completed_ops(dev_id, RTE_MIN(n - nb_done, UINT8_MAX),
+                                     src_hdls + nb_done, dst_hdls + nb_done);
+        if (ret < 0) return ret;
+        nb_done += ret;
+    }
+    return nb_done;
+}
+
 static int test_enqueue_copies(int dev_id) {
     const unsigned int length = 1024;
     unsigned int i;
@@ -83,17 +309,16 @@ static int test_enqueue_copies(int dev_id) {
 
         for (i = 0; i < length; i++) src_data[i] = rand() & 0xFF;
 
-        if (rte_ioat_enqueue_copy(dev_id, src->buf_iova + src->data_off,
+        if (ioat_dev_enqueue_copy(dev_id, src->buf_iova + src->data_off,
                                   dst->buf_iova + dst->data_off, length,
                                   (uintptr_t)src, (uintptr_t)dst) != 1) {
             PRINT_ERR("Error with rte_ioat_enqueue_copy\n");
             return -1;
         }
-        rte_ioat_perform_ops(dev_id);
-        usleep(10);
+        ioat_dev_perform_ops(dev_id);
 
-        if (rte_ioat_completed_ops(dev_id, 1, (void *)&completed[0],
-                                   (void *)&completed[1]) != 1) {
+        if (poll_completed(dev_id, 1, (void *)&completed[0],
+                           (void *)&completed[1]) != 1) {
             PRINT_ERR("Error with rte_ioat_completed_ops\n");
             return -1;
         }
@@ -130,7 +355,7 @@ static int test_enqueue_copies(int dev_id) {
 
             for (j = 0; j < length; j++) src_data[j] = rand() & 0xFF;
 
-            if (rte_ioat_enqueue_copy(
+            if (ioat_dev_enqueue_copy(
                     dev_id, srcs[i]->buf_iova + srcs[i]->data_off,
                     dsts[i]->buf_iova + dsts[i]->data_off, length,
                     (uintptr_t)srcs[i], (uintptr_t)dsts[i]) != 1) {
@@ -139,11 +364,10 @@ static int test_enqueue_copies(int dev_id) {
                 return -1;
             }
         }
-        rte_ioat_perform_ops(dev_id);
-        usleep(100);
+        ioat_dev_perform_ops(dev_id);
 
-        if (rte_ioat_completed_ops(dev_id, 64, (void *)completed_src,
-                                   (void *)completed_dst) != RTE_DIM(srcs)) {
+        if (poll_completed(dev_id, RTE_DIM(srcs), (void *)completed_src,
+                           (void *)completed_dst) != RTE_DIM(srcs)) {
             PRINT_ERR("Error with rte_ioat_completed_ops\n");
             return -1;
         }
@@ -188,18 +412,17 @@ static int test_enqueue_fill(int dev_id) {
         memset(dst_data, 0, length[i]);
 
         /* perform the fill operation */
-        if (rte_ioat_enqueue_fill(dev_id, pattern,
+        if (ioat_dev_enqueue_fill(dev_id, pattern,
                                   dst->buf_iova + dst->data_off, length[i],
                                   (uintptr_t)dst) != 1) {
             PRINT_ERR("Error with rte_ioat_enqueue_fill\n");
             return -1;
         }
 
-        rte_ioat_perform_ops(dev_id);
-        usleep(100);
+        ioat_dev_perform_ops(dev_id);
 
-        if (rte_ioat_completed_ops(dev_id, 1, (void *)&completed[0],
-                                   (void *)&completed[1]) != 1) {
+        if (poll_completed(dev_id, 1, (void *)&completed[0],
+                           (void *)&completed[1]) != 1) {
             PRINT_ERR("Error with completed ops\n");
             return -1;
         }
@@ -346,3 +569,569 @@ err:
     free(ids);
     return -1;
 }
+
+/* splitmix64, which turns any state, even a counter, into good random
+ * numbers
+ */
+static inline uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static size_t mismatch_scalar(const uint8_t *a, const uint8_t *b, size_t len) {
+    size_t i;
+
+    if (memcmp(a, b, len) == 0) return len;
+    for (i = 0; a[i] == b[i]; i++)
+        ;
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t mismatch_avx2(const uint8_t *a,
+                                                            const uint8_t *b,
+                                                            size_t len) {
+    size_t i;
+
+    for (i = 0; i + 32 <= len; i += 32) {
+        const __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        const __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        const uint32_t eq =
+            (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+
+        if (eq != UINT32_MAX) return i + __builtin_ctz(~eq);
+    }
+    for (; i < len; i++)
+        if (a[i] != b[i]) return i;
+    return len;
+}
+
+/* Sizes are spread evenly over the powers of two up to stress_max_size, and
+ * alignments over the whole source span and a cache line of destination
+ */
+static void stress_op_gen(const struct stress_worker *w, uint64_t seq,
+                          struct stress_op *op) {
+    uint64_t state = w->seed ^ (seq * 0xd1b54a32d192ed03ULL);
+    const unsigned int bits =
+        splitmix64(&state) % (rte_log2_u32(stress_max_size) + 1);
+
+    op->len = 1 + splitmix64(&state) % RTE_MIN(1ULL << bits,
+                                               (uint64_t)stress_max_size);
+    op->fill = splitmix64(&state) % 100 < stress_fill_pct;
+    op->src_off = splitmix64(&state) % STRESS_SRC_SPAN;
+    op->dst_off = splitmix64(&state) % RTE_CACHE_LINE_SIZE;
+    op->pattern = splitmix64(&state);
+}
+
+static inline uint8_t stress_op_byte(const struct stress_worker *w,
+                                     const struct stress_op *op, size_t i) {
+    return op->fill ? ((const uint8_t *)&op->pattern)[i % 8]
+                    : w->src[op->src_off + i];
+}
+
+static inline size_t stress_dst_off(const struct stress_worker *w,
+                                    uint64_t seq, const struct stress_op *op) {
+    return (seq % stress_ring_size) * w->slot_size + STRESS_GUARD +
+           op->dst_off;
+}
+
+/* Reset the guards around the destination of an op, and make sure that its
+ * ends do not already hold what the op is to write there
+ */
+static void stress_op_prepare(const struct stress_worker *w,
+                              const struct stress_op *op, uint8_t *dst) {
+    memset(dst - STRESS_GUARD, STRESS_GUARD_BYTE, STRESS_GUARD);
+    memset(dst + op->len, STRESS_GUARD_BYTE, STRESS_GUARD);
+    dst[0] = ~stress_op_byte(w, op, 0);
+    dst[op->len - 1] = ~stress_op_byte(w, op, op->len - 1);
+}
+
+static void stress_report(const struct stress_worker *w, uint64_t seq,
+                          const struct stress_op *op, const char *error) {
+    fprintf(stderr,
+            "Channel %u (rawdev %u), op %" PRIu64 ": %s of %u bytes, src "
+            "offset %u, dst offset %u: %s\n"
+            "Reproduce with: --stress -s %" PRIu64 " -n %u -r %u -m %u "
+            "-f %u\n",
+            w->idx, w->dev_id, seq, op->fill ? "fill" : "copy", op->len,
+            op->src_off, op->dst_off, error, stress_seed, stress_channels,
+            stress_ring_size, stress_max_size, stress_fill_pct);
+    stress_failed = true;
+}
+
+/* Check the data and the guards of a completed op */
+static int stress_op_check(const struct stress_worker *w, uint64_t seq,
+                           const struct stress_op *op) {
+    const uint8_t *dst = w->dst + stress_dst_off(w, seq, op);
+    const size_t head = RTE_MIN(op->len, 8U);
+    char error[64];
+    size_t bad;
+    unsigned int i;
+
+    if (op->fill) {
+        /* A fill repeats every 8 bytes from its first ones */
+        bad = mismatch(dst, (const uint8_t *)&op->pattern, head);
+        if (bad == head && op->len > head)
+            bad = head + mismatch(dst + head, dst, op->len - head);
+    } else {
+        bad = mismatch(dst, w->src + op->src_off, op->len);
+    }
+    if (bad < op->len) {
+        snprintf(error, sizeof(error), "got %#x at byte %zu, not %#x",
+                 dst[bad], bad, stress_op_byte(w, op, bad));
+        stress_report(w, seq, op, error);
+        return -1;
+    }
+
+    for (i = 0; i < STRESS_GUARD; i++)
+        if (dst[-1 - (int)i] != STRESS_GUARD_BYTE ||
+            dst[op->len + i] != STRESS_GUARD_BYTE) {
+            stress_report(w, seq, op, "written out of bounds");
+            return -1;
+        }
+    return 0;
+}
+
+/* Enqueue random bursts of ops, fenced now and then, and poll for random
+ * numbers of completions, which must come in order and be right, until the
+ * duration is over or any channel fails
+ */
+static int stress_worker(void *arg) {
+    struct stress_worker *w = arg;
+    const uint64_t tsc_hz = rte_get_tsc_hz();
+    const uint64_t deadline = rte_rdtsc() + tsc_hz * stress_duration;
+    uintptr_t src_hdls[STRESS_MAX_BURST], dst_hdls[STRESS_MAX_BURST];
+    uint64_t head = 0, tail = 0; /* next op to enqueue, and to complete */
+    uint64_t last_done = rte_rdtsc(), now;
+    struct stress_op op;
+    unsigned int burst, b;
+    size_t off;
+    int i, ret;
+
+    while (!stress_failed) {
+        now = rte_rdtsc();
+        if (now >= deadline && head == tail) break;
+
+        /* The ring keeps a slot empty, so do the slots of the ops */
+        burst = 1 + splitmix64(&w->rng) % STRESS_MAX_BURST;
+        for (b = 0; b < burst && now < deadline &&
+                    head - tail < stress_ring_size - 1;
+             b++) {
+            stress_op_gen(w, head, &op);
+            off = stress_dst_off(w, head, &op);
+            stress_op_prepare(w, &op, w->dst + off);
+            if (op.fill)
+                ret = ioat_dev_enqueue_fill(w->dev_id, op.pattern,
+                                            w->dst_iova + off, op.len, head);
+            else
+                ret = ioat_dev_enqueue_copy(w->dev_id,
+                                            w->src_iova + op.src_off,
+                                            w->dst_iova + off, op.len, head,
+                                            head);
+            if (ret != 1) break;
+            if (splitmix64(&w->rng) % 16 == 0 &&
+                ioat_dev_fence(w->dev_id) == 1)
+                w->nb_fences++;
+            head++;
+        }
+        if (b > 0) {
+            ioat_dev_perform_ops(w->dev_id);
+            w->nb_batches++;
+        }
+
+        ret = ioat_dev_completed_ops(w->dev_id,
+                                     1 + splitmix64(&w->rng) % STRESS_MAX_BURST,
+                                     src_hdls, dst_hdls);
+        if (ret < 0) {
+            stress_op_gen(w, tail, &op);
+            stress_report(w, tail, &op, "rte_ioat_completed_ops failed");
+            return -1;
+        }
+        for (i = 0; i < ret; i++, tail++) {
+            stress_op_gen(w, tail, &op);
+            if (dst_hdls[i] != tail) {
+                stress_report(w, tail, &op, "completed out of order");
+                return -1;
+            }
+            if (stress_op_check(w, tail, &op) < 0) return -1;
+            if (op.fill)
+                w->nb_fills++;
+            else
+                w->nb_copies++;
+            w->nb_bytes += op.len;
+        }
+
+        if (ret > 0) {
+            last_done = rte_rdtsc();
+        } else if (head != tail &&
+                   rte_rdtsc() - last_done > tsc_hz * COMPLETION_TIMEOUT) {
+            stress_op_gen(w, tail, &op);
+            stress_report(w, tail, &op, "never completed");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Configure a channel for the stress test and allocate its buffers, on its
+ * NUMA node
+ */
+static int stress_setup(struct stress_worker *w) {
+    struct rte_ioat_rawdev_config p = {.ring_size = stress_ring_size};
+    struct rte_rawdev_info info = {.dev_private = &p};
+    char name[RTE_MEMZONE_NAMESIZE];
+    size_t i;
+
+    if (rte_rawdev_configure(w->dev_id, &info, sizeof(p)) != 0 ||
+        rte_rawdev_start(w->dev_id) != 0) {
+        PRINT_ERR("Cannot configure rawdev %u\n", w->dev_id);
+        return -1;
+    }
+    info.dev_private = NULL;
+    rte_rawdev_info_get(w->dev_id, &info, 0);
+
+    w->slot_size = RTE_ALIGN_CEIL(
+        stress_max_size + RTE_CACHE_LINE_SIZE + 2 * STRESS_GUARD,
+        RTE_CACHE_LINE_SIZE);
+    snprintf(name, sizeof(name), "stress_src_%u", w->idx);
+    w->src_mz = rte_memzone_reserve_aligned(
+        name, STRESS_SRC_SPAN + stress_max_size, info.socket_id,
+        RTE_MEMZONE_IOVA_CONTIG, RTE_CACHE_LINE_SIZE);
+    snprintf(name, sizeof(name), "stress_dst_%u", w->idx);
+    w->dst_mz = rte_memzone_reserve_aligned(
+        name, w->slot_size * stress_ring_size, info.socket_id,
+        RTE_MEMZONE_IOVA_CONTIG, RTE_CACHE_LINE_SIZE);
+    if (w->src_mz == NULL || w->dst_mz == NULL) {
+        PRINT_ERR("Cannot reserve the buffers of rawdev %u\n", w->dev_id);
+        return -1;
+    }
+    w->src = w->src_mz->addr;
+    w->src_iova = w->src_mz->iova;
+    w->dst = w->dst_mz->addr;
+    w->dst_iova = w->dst_mz->iova;
+
+    w->seed = stress_seed + w->idx;
+    w->rng = ~w->seed;
+    for (i = 0; i < STRESS_SRC_SPAN + stress_max_size; i++)
+        w->src[i] = splitmix64(&w->rng);
+    return 0;
+}
+
+static int stress_test(void) {
+    static struct stress_worker workers[RTE_MAX_LCORE];
+    const unsigned int nb_lcores = RTE_MAX(rte_lcore_count() - 1, 1U);
+    int num_rawdev = rte_rawdev_count();
+    unsigned int nb_channels = 0, c, lcore_id = rte_get_main_lcore();
+    int dev_id, ret = 0;
+
+    mismatch = rte_cpu_get_flag_enabled(RTE_CPUFLAG_AVX2) > 0
+                   ? mismatch_avx2
+                   : mismatch_scalar;
+    if (!stress_seed_set) stress_seed = rte_rdtsc();
+    if (stress_channels == 0) stress_channels = nb_lcores;
+    stress_channels = RTE_MIN(stress_channels, nb_lcores);
+
+    /* One channel per worker lcore, or the main one if there is none */
+    for (dev_id = 0; dev_id < num_rawdev && nb_channels < stress_channels;
+         dev_id++) {
+        struct rte_rawdev_info dev_info = {.dev_private = NULL};
+        struct stress_worker *w = &workers[nb_channels];
+
+        if (rte_rawdev_info_get(dev_id, &dev_info, 0) != 0 ||
+            !ioat_dev_driver_supported(dev_info.driver_name))
+            continue;
+        w->idx = nb_channels++;
+        w->dev_id = dev_id;
+        w->lcore_id = rte_lcore_count() > 1
+                          ? (lcore_id = rte_get_next_lcore(lcore_id, 1, 0))
+                          : lcore_id;
+        if (stress_setup(w) < 0) {
+            ret = -1;
+            goto out;
+        }
+    }
+    if (nb_channels == 0) {
+        PRINT_ERR("No IOAT channel to stress\n");
+        return -1;
+    }
+
+    printf("Stressing %u channels for %u s, seed %" PRIu64 "\n", nb_channels,
+           stress_duration, stress_seed);
+    for (c = 0; c < nb_channels; c++)
+        if (workers[c].lcore_id != rte_get_main_lcore())
+            rte_eal_remote_launch(stress_worker, &workers[c],
+                                  workers[c].lcore_id);
+    if (workers[0].lcore_id == rte_get_main_lcore()) stress_worker(&workers[0]);
+    rte_eal_mp_wait_lcore();
+
+    for (c = 0; c < nb_channels; c++) {
+        const struct stress_worker *w = &workers[c];
+
+        printf("Channel %u (rawdev %u, lcore %u): %" PRIu64 " copies, %" PRIu64
+               " fills, %.1f MB, %" PRIu64 " bursts, %" PRIu64
+               " fences, %" PRIu64 " ring wraps\n",
+               w->idx, w->dev_id, w->lcore_id, w->nb_copies, w->nb_fills,
+               w->nb_bytes / 1e6, w->nb_batches, w->nb_fences,
+               (w->nb_copies + w->nb_fills) / stress_ring_size);
+    }
+    ret = stress_failed ? -1 : 0;
+    printf("Stress test %s\n", ret == 0 ? "passed" : "failed");
+
+out:
+    for (c = 0; c < nb_channels; c++) {
+        rte_rawdev_stop(workers[c].dev_id);
+        rte_memzone_free(workers[c].src_mz);
+        rte_memzone_free(workers[c].dst_mz);
+    }
+    return ret;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static inline int perf_enqueue(int dev_id, const struct perf_point *pt,
+                               rte_iova_t src, rte_iova_t dst, uintptr_t hdl) {
+    if (pt->fill)
+        return ioat_dev_enqueue_fill(dev_id, 0xfedcba9876543210, dst,
+                                     pt->size, hdl);
+    return ioat_dev_enqueue_copy(dev_id, src, dst, pt->size, hdl, hdl);
+}
+
+/* Measure the throughput of a point, keeping the ring as full as batches of
+ * pt->batch ops allow, then the latency of single batches
+ */
+static int perf_run_point(int dev_id, rte_iova_t src_iova, rte_iova_t dst_iova,
+                          struct perf_point *pt) {
+    const size_t stride = RTE_ALIGN_CEIL(pt->size, 4096U);
+    const unsigned int nb_slots = PERF_WSS / stride;
+    const uint64_t tsc_hz = rte_get_tsc_hz();
+    uintptr_t hdls[2][PERF_POLL_BURST];
+    uint64_t lat[PERF_LAT_ROUNDS];
+    uint64_t nb_started = 0, nb_done = 0, start, end, t0;
+    unsigned int b, r;
+    int ret;
+
+    start = rte_rdtsc();
+    end = start + tsc_hz * PERF_DURATION_MS / 1000;
+    while (rte_rdtsc() < end) {
+        for (b = 0; b < pt->batch && nb_started - nb_done < PERF_RING_SIZE - 1;
+             b++, nb_started++) {
+            const size_t off = (nb_started % nb_slots) * stride;
+
+            if (perf_enqueue(dev_id, pt, src_iova + off, dst_iova + off,
+                             nb_started) != 1)
+                break;
+        }
+        if (b > 0) ioat_dev_perform_ops(dev_id);
+
+        ret = ioat_dev_completed_ops(dev_id, PERF_POLL_BURST, hdls[0],
+                                     hdls[1]);
+        if (ret < 0) return ret;
+        nb_done += ret;
+    }
+    /* Drain the ops in flight */
+    t0 = rte_rdtsc();
+    while (nb_done < nb_started) {
+        ret = ioat_dev_completed_ops(dev_id, PERF_POLL_BURST, hdls[0],
+                                     hdls[1]);
+        if (ret < 0) return ret;
+        nb_done += ret;
+        if (rte_rdtsc() - t0 > tsc_hz * COMPLETION_TIMEOUT) {
+            PRINT_ERR("Ops still in flight after %d s\n", COMPLETION_TIMEOUT);
+            return -1;
+        }
+    }
+    end = rte_rdtsc();
+    pt->mops = nb_started / ((double)(end - start) / tsc_hz) / 1e6;
+    pt->gbps = pt->mops * pt->size / 1e3;
+
+    for (r = 0; r < PERF_LAT_ROUNDS; r++) {
+        for (b = 0; b < pt->batch; b++) {
+            const size_t off = ((r * pt->batch + b) % nb_slots) * stride;
+
+            if (perf_enqueue(dev_id, pt, src_iova + off, dst_iova + off, b) !=
+                1)
+                return -1;
+        }
+        ioat_dev_perform_ops(dev_id);
+        t0 = rte_rdtsc();
+        if (poll_completed(dev_id, pt->batch, hdls[0], hdls[1]) !=
+            (int)pt->batch)
+            return -1;
+        lat[r] = rte_rdtsc() - t0;
+    }
+    qsort(lat, PERF_LAT_ROUNDS, sizeof(lat[0]), cmp_u64);
+    pt->lat_ns = lat[PERF_LAT_ROUNDS / 2] * 1e9 / tsc_hz;
+    return 0;
+}
+
+static int perf_save(const char *file, const char *dev_name,
+                     const struct perf_point *pts, unsigned int nb_pts) {
+    FILE *f = fopen(file, "w");
+    unsigned int i;
+
+    if (f == NULL) {
+        PRINT_ERR("Cannot write %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    fprintf(f, "{\n  \"version\": 1,\n  \"dpdk\": \"%s\",\n  \"device\": "
+               "\"%s\",\n  \"points\": [\n",
+            rte_version(), dev_name);
+    for (i = 0; i < nb_pts; i++)
+        fprintf(f,
+                "    {\"op\": \"%s\", \"size\": %u, \"batch\": %u, \"gbps\": "
+                "%.3f, \"mops\": %.3f, \"lat_ns\": %.0f}%s\n",
+                pts[i].fill ? "fill" : "copy", pts[i].size, pts[i].batch,
+                pts[i].gbps, pts[i].mops, pts[i].lat_ns,
+                i + 1 < nb_pts ? "," : "");
+    fprintf(f, "  ]\n}\n");
+    if (fclose(f) != 0) {
+        PRINT_ERR("Cannot write %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/* Compare the points with those of a baseline saved by perf_save(), which
+ * holds one point per line. Returns the number of regressions, or -1.
+ */
+static int perf_compare(const char *file, const struct perf_point *pts,
+                        unsigned int nb_pts) {
+    struct perf_point base;
+    bool found[RTE_DIM(perf_sizes) * RTE_DIM(perf_batches) * 2] = {false};
+    char line[256], op[8];
+    unsigned int i;
+    int nb_regressions = 0;
+    FILE *f = fopen(file, "r");
+
+    if (f == NULL) {
+        PRINT_ERR("Cannot read %s: %s\n", file, strerror(errno));
+        return -1;
+    }
+
+    printf("\nAgainst baseline %s (throughput -%.0f%%, latency +%.0f%%):\n",
+           file, perf_tolerance, perf_lat_tolerance);
+    printf("%4s %8s %5s %10s %8s %10s %8s\n", "op", "size", "batch", "GB/s",
+           "delta", "lat(ns)", "delta");
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line,
+                   " {\"op\": \"%7[a-z]\", \"size\": %u, \"batch\": %u, "
+                   "\"gbps\": %lf, \"mops\": %lf, \"lat_ns\": %lf}",
+                   op, &base.size, &base.batch, &base.gbps, &base.mops,
+                   &base.lat_ns) != 6)
+            continue;
+        base.fill = strcmp(op, "fill") == 0;
+
+        for (i = 0; i < nb_pts; i++)
+            if (pts[i].fill == base.fill && pts[i].size == base.size &&
+                pts[i].batch == base.batch)
+                break;
+        if (i == nb_pts) continue;
+        found[i] = true;
+
+        const double gbps_delta =
+            base.gbps > 0 ? (pts[i].gbps / base.gbps - 1) * 100 : 0;
+        const double lat_delta =
+            base.lat_ns > 0 ? (pts[i].lat_ns / base.lat_ns - 1) * 100 : 0;
+        const bool regressed = gbps_delta < -perf_tolerance ||
+                               lat_delta > perf_lat_tolerance;
+
+        printf("%4s %8u %5u %10.3f %+7.1f%% %10.0f %+7.1f%%%s\n", op,
+               base.size, base.batch, pts[i].gbps, gbps_delta, pts[i].lat_ns,
+               lat_delta, regressed ? "  REGRESSION" : "");
+        nb_regressions += regressed;
+    }
+    fclose(f);
+
+    for (i = 0; i < nb_pts; i++)
+        if (!found[i])
+            printf("%4s %8u %5u: not in the baseline\n",
+                   pts[i].fill ? "fill" : "copy", pts[i].size, pts[i].batch);
+    return nb_regressions;
+}
+
+static int perf_test(void) {
+    static struct perf_point pts[RTE_DIM(perf_sizes) * RTE_DIM(perf_batches) *
+                                 2];
+    struct rte_ioat_rawdev_config p = {.ring_size = PERF_RING_SIZE};
+    struct rte_rawdev_info info = {.dev_private = NULL};
+    const struct rte_memzone *src_mz = NULL, *dst_mz = NULL;
+    unsigned int nb_pts = 0, f, s, b;
+    int dev_id, ret = -1;
+
+    /* The first channel the examples can drive, unless one is given */
+    for (dev_id = 0; dev_id < rte_rawdev_count(); dev_id++) {
+        if (perf_dev_id >= 0 && dev_id != perf_dev_id) continue;
+        if (rte_rawdev_info_get(dev_id, &info, 0) == 0 &&
+            ioat_dev_driver_supported(info.driver_name))
+            break;
+    }
+    if (dev_id >= rte_rawdev_count()) {
+        PRINT_ERR("No IOAT channel to measure\n");
+        return -1;
+    }
+
+    info.dev_private = &p;
+    if (rte_rawdev_configure(dev_id, &info, sizeof(p)) != 0 ||
+        rte_rawdev_start(dev_id) != 0) {
+        PRINT_ERR("Cannot configure rawdev %d\n", dev_id);
+        return -1;
+    }
+    src_mz = rte_memzone_reserve_aligned("perf_src", PERF_WSS, info.socket_id,
+                                         RTE_MEMZONE_IOVA_CONTIG, 4096);
+    dst_mz = rte_memzone_reserve_aligned("perf_dst", PERF_WSS, info.socket_id,
+                                         RTE_MEMZONE_IOVA_CONTIG, 4096);
+    if (src_mz == NULL || dst_mz == NULL) {
+        PRINT_ERR("Cannot reserve the perf buffers\n");
+        goto out;
+    }
+    memset(src_mz->addr, 0xa5, PERF_WSS);
+
+    printf("Measuring rawdev %d (%s), DPDK %s\n", dev_id, info.device->name,
+           rte_version());
+    printf("%4s %8s %5s %10s %10s %10s\n", "op", "size", "batch", "GB/s",
+           "Mops/s", "lat(ns)");
+    for (f = 0; f < 2; f++)
+        for (s = 0; s < RTE_DIM(perf_sizes); s++)
+            for (b = 0; b < RTE_DIM(perf_batches); b++) {
+                struct perf_point *pt = &pts[nb_pts++];
+
+                pt->fill = f == 1;
+                pt->size = perf_sizes[s];
+                pt->batch = perf_batches[b];
+                if (perf_run_point(dev_id, src_mz->iova, dst_mz->iova, pt) <
+                    0) {
+                    PRINT_ERR("Error measuring %s of %u bytes\n",
+                              pt->fill ? "fills" : "copies", pt->size);
+                    goto out;
+                }
+                printf("%4s %8u %5u %10.3f %10.3f %10.0f\n",
+                       pt->fill ? "fill" : "copy", pt->size, pt->batch,
+                       pt->gbps, pt->mops, pt->lat_ns);
+                fflush(stdout);
+            }
+
+    if (perf_save_file != NULL &&
+        perf_save(perf_save_file, info.device->name, pts, nb_pts) < 0)
+        goto out;
+    ret = 0;
+    if (perf_baseline_file != NULL) {
+        const int nb_regressions =
+            perf_compare(perf_baseline_file, pts, nb_pts);
+
+        if (nb_regressions != 0) ret = -1;
+        if (nb_regressions > 0)
+            printf("\n%d regressions against %s\n", nb_regressions,
+                   perf_baseline_file);
+    }
+
+out:
+    rte_rawdev_stop(dev_id);
+    rte_memzone_free(src_mz);
+    rte_memzone_free(dst_mz);
+    return ret;
+}